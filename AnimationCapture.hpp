@@ -0,0 +1,539 @@
+#pragma once
+
+#include "SoftwareRenderer.hpp"
+#include "ThreadPool.hpp"
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <cctype>
+#include <cmath>
+#include <csignal>
+#include <string>
+#include <vector>
+#include <filesystem>
+#include <algorithm>
+#include <stdexcept>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <chrono>
+
+
+// Uncompressed video frames written one after another to a file or to the
+// standard input of a command, such as "ffmpeg -i - turntable.mp4":
+//
+//   Y4m   YUV4MPEG2, 4:2:0 with BT.601 studio range, which most players and encoders read
+//   Rgba  bare RGBA8 frames, opaque, with no header; the reader is told the size and rate
+class VideoStream
+{
+public:
+
+	enum class Format
+	{
+		Y4m,
+		Rgba,
+	};
+
+
+private:
+
+#ifndef _WIN32
+	// A command that exits early must fail the next write instead of ending the process,
+	// so SIGPIPE is ignored while any stream has a pipe open. The last one to close puts
+	// back whatever disposition the process had before.
+	static void IgnoreBrokenPipes(bool ignore)
+	{
+		static std::mutex mutex;
+		static int openPipes = 0;
+		static struct sigaction previous;
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		if (ignore)
+		{
+			if (openPipes++ == 0)
+			{
+				struct sigaction action{};
+				action.sa_handler = SIG_IGN;
+				sigemptyset(&action.sa_mask);
+
+				sigaction(SIGPIPE, &action, &previous);
+			}
+		}
+		else if (--openPipes == 0)
+		{
+			sigaction(SIGPIPE, &previous, nullptr);
+		}
+	}
+#endif
+
+
+	void Open(FILE* file, const std::string& name, bool pipe, Format format, int width, int height, int fps)
+	{
+		if (!file)
+			throw std::runtime_error("Cannot open " + name);
+
+		m_File = file;
+		m_Name = name;
+		m_Pipe = pipe;
+		m_Format = format;
+		m_Width = width;
+		m_Height = height;
+
+		setvbuf(m_File, nullptr, _IOFBF, 1 << 20);
+
+		if (format == Format::Y4m)
+		{
+			auto header = "YUV4MPEG2 W" + std::to_string(width) + " H" + std::to_string(height) + " F" + std::to_string(fps) + ":1 Ip A1:1 C420jpeg\n";
+
+			Write(header.data(), header.size());
+		}
+	}
+
+
+	void Write(const void* data, size_t size)
+	{
+		if (fwrite(data, 1, size, m_File) != size)
+			throw std::runtime_error("cannot write " + m_Name);
+	}
+
+
+	static uint8_t GetLuma(uint32_t pixel)
+	{
+		int r = pixel & 0xFF;
+		int g = (pixel >> 8) & 0xFF;
+		int b = (pixel >> 16) & 0xFF;
+
+		return static_cast<uint8_t>(((66 * r + 129 * g + 25 * b + 128) >> 8) + 16);
+	}
+
+
+	// Planes of one frame, each chroma sample the average of up to 2x2 pixels
+	void ConvertY4m(const uint32_t* pixels)
+	{
+		size_t numPixels = static_cast<size_t>(m_Width) * m_Height;
+		int chromaWidth = (m_Width + 1) / 2;
+		int chromaHeight = (m_Height + 1) / 2;
+
+		uint8_t* luma = m_Frame.data();
+		uint8_t* cb = luma + numPixels;
+		uint8_t* cr = cb + static_cast<size_t>(chromaWidth) * chromaHeight;
+
+		for (size_t i = 0; i < numPixels; i++)
+			luma[i] = GetLuma(pixels[i]);
+
+		for (int y = 0; y < chromaHeight; y++)
+		{
+			const uint32_t* row0 = pixels + static_cast<size_t>(2 * y) * m_Width;
+			const uint32_t* row1 = 2 * y + 1 < m_Height ? row0 + m_Width : row0;
+
+			for (int x = 0; x < chromaWidth; x++)
+			{
+				int x1 = (std::min)(2 * x + 1, m_Width - 1);
+				uint32_t quad[4] = { row0[2 * x], row0[x1], row1[2 * x], row1[x1] };
+
+				int r = 0;
+				int g = 0;
+				int b = 0;
+
+				for (auto pixel : quad)
+				{
+					r += pixel & 0xFF;
+					g += (pixel >> 8) & 0xFF;
+					b += (pixel >> 16) & 0xFF;
+				}
+
+				// Four pixels, so two more bits of precision to shift off
+				*cb++ = static_cast<uint8_t>(((-38 * r - 74 * g + 112 * b + 512) >> 10) + 128);
+				*cr++ = static_cast<uint8_t>(((112 * r - 94 * g - 18 * b + 512) >> 10) + 128);
+			}
+		}
+	}
+
+
+public:
+
+	// From the file extension, .y4m or .rgba; false for any other
+	static bool GetFormat(const std::filesystem::path& path, Format& format)
+	{
+		auto extension = path.extension().wstring();
+
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](int c) { return std::tolower(c); });
+
+		if (extension == L".y4m")
+			format = Format::Y4m;
+		else if (extension == L".rgba")
+			format = Format::Rgba;
+		else
+			return false;
+
+		return true;
+	}
+
+
+	// "y4m" or "rgba"
+	static bool ParseFormat(const std::string& name, Format& format)
+	{
+		if (name == "y4m")
+			format = Format::Y4m;
+		else if (name == "rgba")
+			format = Format::Rgba;
+		else
+			return false;
+
+		return true;
+	}
+
+
+	// Bytes of one frame as written, after the header
+	static size_t GetFrameSize(Format format, int width, int height)
+	{
+		if (format == Format::Rgba)
+			return static_cast<size_t>(width) * height * 4;
+
+		return 6 + static_cast<size_t>(width) * height + 2 * static_cast<size_t>((width + 1) / 2) * ((height + 1) / 2);
+	}
+
+
+	// Creates the parent directories as needed. Throws std::runtime_error if the file
+	// cannot be opened.
+	void OpenFile(const std::filesystem::path& path, Format format, int width, int height, int fps)
+	{
+		Close();
+
+		std::error_code error;
+
+		if (path.has_parent_path())
+			std::filesystem::create_directories(path.parent_path(), error);
+
+#ifdef _WIN32
+		FILE* file = _wfopen(path.c_str(), L"wb");
+#else
+		FILE* file = fopen(path.c_str(), "wb");
+#endif
+
+		Open(file, path.string(), false, format, width, height, fps);
+	}
+
+
+	// Runs command through the shell with the frames as its standard input
+	void OpenPipe(const std::string& command, Format format, int width, int height, int fps)
+	{
+		Close();
+
+#ifdef _WIN32
+		FILE* file = _popen(command.c_str(), "wb");
+#else
+		IgnoreBrokenPipes(true);
+
+		FILE* file = popen(command.c_str(), "w");
+
+		if (!file)
+			IgnoreBrokenPipes(false);
+#endif
+
+		Open(file, "pipe to " + command, true, format, width, height, fps);
+	}
+
+
+	// width * height pixels as the renderers produce them. Throws std::runtime_error
+	// if the frame cannot be written, a pipe whose command has exited included.
+	void WriteFrame(const uint32_t* pixels)
+	{
+		if (!m_File)
+			throw std::runtime_error("no video stream open");
+
+		size_t numPixels = static_cast<size_t>(m_Width) * m_Height;
+
+		if (m_Format == Format::Rgba)
+		{
+			m_Frame.resize(numPixels * 4);
+
+			// Alpha is not coverage, see ImageWriter
+			for (size_t i = 0; i < numPixels; i++)
+			{
+				uint32_t pixel = pixels[i] | 0xFF000000;
+				memcpy(m_Frame.data() + i * 4, &pixel, 4);
+			}
+		}
+		else
+		{
+			static const char marker[] = "FRAME\n";
+
+			Write(marker, 6);
+
+			m_Frame.resize(GetFrameSize(m_Format, m_Width, m_Height) - 6);
+			ConvertY4m(pixels);
+		}
+
+		Write(m_Frame.data(), m_Frame.size());
+	}
+
+
+	// Flushes and closes; for a pipe, also waits for the command to exit. Throws
+	// std::runtime_error if the last frames cannot be written or the command fails.
+	void Close()
+	{
+		if (!m_File)
+			return;
+
+		FILE* file = m_File;
+		m_File = nullptr;
+
+		bool flushed = fflush(file) == 0;
+
+#ifdef _WIN32
+		int status = m_Pipe ? _pclose(file) : fclose(file);
+#else
+		int status = m_Pipe ? pclose(file) : fclose(file);
+
+		if (m_Pipe)
+			IgnoreBrokenPipes(false);
+#endif
+
+		if (!flushed || status != 0)
+			throw std::runtime_error(m_Pipe ? m_Name + " failed" : "cannot write " + m_Name);
+	}
+
+
+	bool IsOpen() const
+	{
+		return m_File != nullptr;
+	}
+
+
+	VideoStream()
+		: m_File{}
+		, m_Pipe{}
+		, m_Format{ Format::Y4m }
+		, m_Width{}
+		, m_Height{}
+	{
+	}
+
+
+	VideoStream(const VideoStream&) = delete;
+	VideoStream& operator=(const VideoStream&) = delete;
+
+
+	// Without Close, errors go unreported
+	~VideoStream()
+	{
+		try
+		{
+			Close();
+		}
+		catch (const std::exception&)
+		{
+		}
+	}
+
+
+private:
+
+	FILE* m_File;
+	std::string m_Name;
+	bool m_Pipe;
+	Format m_Format;
+	int m_Width;
+	int m_Height;
+	std::vector<uint8_t> m_Frame; // converted
+};
+
+
+// Renders a sequence into a VideoStream at a fixed frame rate, stepping the frame
+// with StudioModelAnimating::AdvanceFrame, optionally with the camera turning about
+// the model. Frames go through a ring of a few slots to a thread of their own that
+// converts and writes them, so rendering the next frame overlaps writing the last.
+class AnimationCapture
+{
+public:
+
+	struct Settings
+	{
+		int Sequence;
+		int Frames; // 0 for one loop of the sequence, or one turn with TurntableSeconds
+		int Fps; // at least MinFps
+		float TurntableSeconds; // per turn of the camera; 0 keeps it still
+		size_t RingFrames; // 0 for DefaultRingFrames
+	};
+
+
+	struct Result
+	{
+		size_t Frames;
+		double Seconds;
+		double RenderSeconds; // animating, drawing and copying into the ring
+		double EncodeSeconds; // converting and writing, on the encoder thread
+		double StallSeconds; // rendering waited for a free slot
+	};
+
+
+	// AdvanceFrame clamps steps to a tenth of a second
+	static constexpr int MinFps = 10;
+	static constexpr size_t DefaultRingFrames = 4;
+
+
+	static int GetDefaultFrames(const studiohdr_t* header, const Settings& settings)
+	{
+		if (settings.TurntableSeconds > 0.0f)
+			return (std::max)(1, static_cast<int>(std::lround(settings.TurntableSeconds * settings.Fps)));
+
+		auto pseqdesc = reinterpret_cast<const mstudioseqdesc_t*>(reinterpret_cast<const byte*>(header) + header->seqindex) + settings.Sequence;
+
+		if (pseqdesc->numframes <= 1 || pseqdesc->fps <= 0.0f)
+			return 1;
+
+		// AdvanceFrame wraps after numframes - 1
+		return (std::max)(1, static_cast<int>(std::lround((pseqdesc->numframes - 1) / pseqdesc->fps * settings.Fps)));
+	}
+
+
+	// renderer is set up with the model, camera preset and viewport, and draws on
+	// workers if set. Does not close stream. Throws std::runtime_error if the
+	// settings or the sequence are unusable or the stream fails.
+	static Result Capture(SoftwareStudioModelRenderer& renderer, StudioModel& studioModel, const Settings& settings, const float clearColor[4], VideoStream& stream, ThreadPool* workers)
+	{
+		auto header = studioModel.GetStudioHeader();
+
+		if (!header || settings.Sequence < 0 || settings.Sequence >= header->numseq)
+			throw std::runtime_error("no sequence " + std::to_string(settings.Sequence));
+
+		if (settings.Fps < MinFps)
+			throw std::runtime_error("frame rate below " + std::to_string(MinFps));
+
+		if (renderer.GetWidth() == 0)
+			throw std::runtime_error("image size out of range");
+
+		auto start = std::chrono::steady_clock::now();
+
+		int numFrames = settings.Frames > 0 ? settings.Frames : GetDefaultFrames(header, settings);
+		size_t numPixels = static_cast<size_t>(renderer.GetWidth()) * renderer.GetHeight();
+
+		// Frame n is in slot n % slots.size() from when it is produced until it is consumed
+		std::vector<std::vector<uint32_t>> slots(settings.RingFrames ? settings.RingFrames : DefaultRingFrames);
+		int produced = 0;
+		int consumed = 0;
+		bool finished = false;
+		std::exception_ptr encodeError;
+		std::mutex mutex;
+		std::condition_variable frameAvailable;
+		std::condition_variable slotAvailable;
+
+		Result result{};
+
+		std::thread encoder([&]()
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+
+			while (true)
+			{
+				frameAvailable.wait(lock, [&]() { return consumed < produced || finished; });
+
+				if (consumed == produced)
+					return;
+
+				auto& slot = slots[consumed % slots.size()];
+				lock.unlock();
+
+				auto encodeStart = std::chrono::steady_clock::now();
+
+				try
+				{
+					stream.WriteFrame(slot.data());
+				}
+				catch (...)
+				{
+					lock.lock();
+					encodeError = std::current_exception();
+					slotAvailable.notify_one();
+					return;
+				}
+
+				lock.lock();
+				result.EncodeSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - encodeStart).count();
+				consumed++;
+				slotAvailable.notify_one();
+			}
+		});
+
+		std::vector<float> boneTransforms(static_cast<size_t>(header->numbones) * 12);
+		auto bones = reinterpret_cast<float(*)[3][4]>(boneTransforms.data());
+		auto& scratch = StudioModelAnimating::GetThreadScratch();
+
+		StudioModelAnimating::PoseParameters pose{ settings.Sequence, 0.0f, {}, {}, 0 };
+		std::exception_ptr renderError;
+
+		try
+		{
+			for (int frame = 0; frame < numFrames; frame++)
+			{
+				auto renderStart = std::chrono::steady_clock::now();
+
+				if (StudioModelAnimating::EvaluatePose(studioModel, pose, bones, header->numbones, scratch) == 0)
+					throw std::runtime_error("cannot evaluate sequence " + std::to_string(settings.Sequence));
+
+				if (settings.TurntableSeconds > 0.0f)
+					renderer.SetCameraYaw(360.0f * static_cast<float>(frame) / (settings.TurntableSeconds * settings.Fps));
+
+				renderer.Clear(clearColor);
+				renderer.Draw(bones, header->numbones, workers);
+
+				pose.Frame = StudioModelAnimating::AdvanceFrame(header, settings.Sequence, pose.Frame, 1.0 / settings.Fps);
+
+				auto waitStart = std::chrono::steady_clock::now();
+
+				std::unique_lock<std::mutex> lock(mutex);
+
+				slotAvailable.wait(lock, [&]() { return produced - consumed < static_cast<int>(slots.size()) || encodeError; });
+
+				auto waitEnd = std::chrono::steady_clock::now();
+
+				if (encodeError)
+					break;
+
+				// Free, as fewer than slots.size() frames are waiting or being written
+				auto& slot = slots[produced % slots.size()];
+				lock.unlock();
+
+				slot.assign(renderer.GetPixels(), renderer.GetPixels() + numPixels);
+
+				lock.lock();
+				produced++;
+				result.StallSeconds += std::chrono::duration<double>(waitEnd - waitStart).count();
+				result.RenderSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - renderStart - (waitEnd - waitStart)).count();
+				lock.unlock();
+
+				frameAvailable.notify_one();
+			}
+		}
+		catch (...)
+		{
+			renderError = std::current_exception();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			finished = true;
+		}
+
+		frameAvailable.notify_one();
+		encoder.join();
+
+		renderer.SetCameraYaw(0.0f);
+
+		if (renderError)
+			std::rethrow_exception(renderError);
+
+		if (encodeError)
+			std::rethrow_exception(encodeError);
+
+		result.Frames = static_cast<size_t>(consumed);
+		result.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		return result;
+	}
+};
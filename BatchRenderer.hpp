@@ -0,0 +1,636 @@
+#pragma once
+
+#include "SoftwareRenderer.hpp"
+#include "ImageWriter.hpp"
+#include "AnimationCapture.hpp"
+#include "ThreadPool.hpp"
+
+#include <istream>
+#include <stdexcept>
+#include <unordered_map>
+#include <charconv>
+
+
+// Renders previews of many models without a window or a D3D11 device. Jobs come
+// from a manifest, one per line:
+//
+//   model=monsters/barney.mdl sequence=walk frames=8 camera=three-quarter size=128x128 sheet=4 output=previews/barney_walk.tga
+//
+// model and output are required. sequence is a name or an index (default 0), frames
+// the number of evenly spaced frames of it to render (default 1), camera one of auto,
+// front, three-quarter, side, back and gun (default auto), size the image size
+// (default 400x400). Without sheet each frame is its own image, numbered before the
+// extension when there are several; sheet=N packs the frames N to a row into one
+// image. Values with spaces go in double quotes, # starts a comment and relative
+// paths are relative to the manifest.
+//
+// An output ending in .y4m or .rgba is a video, see VideoStream, played at fps frames
+// per second (default 30) from the start of the sequence. frames defaults to one loop
+// of it, or to one turn of the camera with turntable=S, S seconds per turn. An output
+// starting with | is a command to pipe the video to, which needs format=y4m or
+// format=rgba:
+//
+//   model=barney.mdl sequence=idle turntable=4 output="|ffmpeg -y -f yuv4mpegpipe -i - barney.mp4" format=y4m
+//
+// Each model is loaded once for all of its jobs. Models are dealt out to one lane
+// per thread, each lane with its own renderer, bone transforms and animation scratch.
+class BatchRenderer
+{
+public:
+
+	struct Job
+	{
+		std::filesystem::path Model;
+		std::string Sequence;
+		int Frames; // 0 only for videos, for the default
+		SoftwareStudioModelRenderer::CameraPreset Camera;
+		int Width;
+		int Height;
+		int SheetColumns; // 0 for an image per frame
+		int Fps;
+		float TurntableSeconds; // 0 for a still camera
+		std::filesystem::path Output;
+		std::string Pipe; // command the video goes to instead of Output
+		bool Video;
+		VideoStream::Format VideoFormat;
+		int Line; // in the manifest
+	};
+
+
+	struct Report
+	{
+		size_t Models;
+		size_t FailedModels;
+		size_t Jobs;
+		size_t FailedJobs;
+		size_t Images;
+		size_t Videos;
+		size_t Frames;
+		double Seconds;
+		std::vector<std::string> Errors; // of the failed jobs in manifest order, then of the images the encoder could not write
+		ImageEncodeQueue::Stats Encoding; // of the encoder, if there was one, over this run
+
+		double GetModelsPerSecond() const
+		{
+			return Seconds > 0.0 ? Models / Seconds : 0.0;
+		}
+	};
+
+
+	static constexpr int DefaultSize = 400;
+	static constexpr int DefaultFps = 30;
+
+
+private:
+
+	struct Lane
+	{
+		SoftwareStudioModelRenderer Renderer;
+		std::unique_ptr<StudioModelAnimating::Scratch> Scratch = std::make_unique<StudioModelAnimating::Scratch>();
+		float BoneTransforms[MAXSTUDIOBONES][3][4];
+		std::vector<uint32_t> Image;
+	};
+
+
+	struct JobResult
+	{
+		std::string Error;
+		size_t Images;
+		size_t Videos;
+		size_t Frames;
+	};
+
+
+	static std::filesystem::path ToPath(const std::string& utf8)
+	{
+		return std::filesystem::path(std::u8string(utf8.begin(), utf8.end()));
+	}
+
+
+	static bool ParseInt(const std::string& text, int& value)
+	{
+		auto end = text.data() + text.size();
+		auto result = std::from_chars(text.data(), end, value);
+
+		return result.ec == std::errc() && result.ptr == end;
+	}
+
+
+	static bool ParseFloat(const std::string& text, float& value)
+	{
+		auto end = text.data() + text.size();
+		auto result = std::from_chars(text.data(), end, value);
+
+		return result.ec == std::errc() && result.ptr == end;
+	}
+
+
+	static bool ParseCamera(const std::string& text, SoftwareStudioModelRenderer::CameraPreset& camera)
+	{
+		using CameraPreset = SoftwareStudioModelRenderer::CameraPreset;
+
+		static const std::pair<const char*, CameraPreset> names[] =
+		{
+			{ "auto", CameraPreset::Auto },
+			{ "front", CameraPreset::Front },
+			{ "three-quarter", CameraPreset::ThreeQuarter },
+			{ "side", CameraPreset::Side },
+			{ "back", CameraPreset::Back },
+			{ "gun", CameraPreset::Gun },
+		};
+
+		for (const auto& name : names)
+		{
+			if (text == name.first)
+			{
+				camera = name.second;
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+
+	// key=value fields of one manifest line
+	static std::vector<std::pair<std::string, std::string>> SplitFields(const std::string& line, const std::function<void(const std::string&)>& fail)
+	{
+		std::vector<std::pair<std::string, std::string>> fields;
+
+		auto isSpace = [](char c) { return c == ' ' || c == '\t' || c == '\r'; };
+
+		size_t i = 0;
+
+		while (true)
+		{
+			while (i < line.size() && isSpace(line[i]))
+				i++;
+
+			if (i == line.size() || line[i] == '#')
+				return fields;
+
+			size_t start = i;
+
+			while (i < line.size() && line[i] != '=' && !isSpace(line[i]))
+				i++;
+
+			if (i == line.size() || line[i] != '=' || i == start)
+				fail("expected key=value");
+
+			std::string key = line.substr(start, i - start);
+			std::string value;
+
+			if (++i < line.size() && line[i] == '"')
+			{
+				auto end = line.find('"', i + 1);
+
+				if (end == std::string::npos)
+					fail("unterminated quote");
+
+				value = line.substr(i + 1, end - i - 1);
+				i = end + 1;
+			}
+			else
+			{
+				start = i;
+
+				while (i < line.size() && !isSpace(line[i]))
+					i++;
+
+				value = line.substr(start, i - start);
+			}
+
+			fields.emplace_back(std::move(key), std::move(value));
+		}
+	}
+
+
+	// A name, compared without case, or an index
+	static int FindSequence(const studiohdr_t* header, const std::string& sequence)
+	{
+		int index;
+
+		if (ParseInt(sequence, index))
+			return index >= 0 && index < header->numseq ? index : -1;
+
+		auto pseqdesc = reinterpret_cast<const mstudioseqdesc_t*>(reinterpret_cast<const byte*>(header) + header->seqindex);
+
+		for (int i = 0; i < header->numseq; i++)
+		{
+			std::string label(pseqdesc[i].label, strnlen(pseqdesc[i].label, sizeof(pseqdesc[i].label)));
+
+			if (std::equal(label.begin(), label.end(), sequence.begin(), sequence.end(), [](char a, char b) { return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b)); }))
+				return i;
+		}
+
+		return -1;
+	}
+
+
+	// Frames wrap after numframes - 1, as in AdvanceFrame, so a looping sequence
+	// is spread over one loop and any other one ends on its last frame
+	static float GetFrame(const mstudioseqdesc_t* pseqdesc, int frame, int frames)
+	{
+		if (pseqdesc->numframes <= 1 || frames <= 1)
+			return 0.0f;
+
+		float last = static_cast<float>(pseqdesc->numframes - 1);
+
+		if (pseqdesc->flags & STUDIO_LOOPING)
+			return last * frame / frames;
+
+		return last * frame / (frames - 1);
+	}
+
+
+	// "walk.tga" becomes "walk_003.tga"
+	static std::filesystem::path GetFramePath(const std::filesystem::path& output, int frame)
+	{
+		auto number = std::to_wstring(frame);
+
+		if (number.size() < 3)
+			number.insert(0, 3 - number.size(), L'0');
+
+		auto path = output;
+		path.replace_filename(output.stem().wstring() + L"_" + number + output.extension().wstring());
+
+		return path;
+	}
+
+
+	// Queued on encoder if set, which then reports failures itself; written here otherwise
+	static void WriteImage(ImageEncodeQueue* encoder, const std::filesystem::path& path, std::vector<uint32_t>&& pixels, int width, int height)
+	{
+		if (encoder)
+			encoder->Push(path, std::move(pixels), width, height);
+		else if (!ImageWriter::Write(path, pixels.data(), width, height))
+			throw std::runtime_error("cannot write " + path.string());
+	}
+
+
+	static JobResult CaptureJob(SoftwareStudioModelRenderer& renderer, StudioModel& studioModel, int sequence, const Job& job, const float clearColor[4], ThreadPool* workers)
+	{
+		VideoStream stream;
+
+		if (job.Pipe.empty())
+			stream.OpenFile(job.Output, job.VideoFormat, job.Width, job.Height, job.Fps);
+		else
+			stream.OpenPipe(job.Pipe, job.VideoFormat, job.Width, job.Height, job.Fps);
+
+		AnimationCapture::Settings settings{ sequence, job.Frames, job.Fps, job.TurntableSeconds, 0 };
+
+		auto capture = AnimationCapture::Capture(renderer, studioModel, settings, clearColor, stream, workers);
+
+		stream.Close();
+
+		JobResult result{};
+		result.Videos = 1;
+		result.Frames = capture.Frames;
+
+		return result;
+	}
+
+
+	static JobResult RenderJob(Lane& lane, SoftwareStudioModel& model, const Job& job, ImageEncodeQueue* encoder, ThreadPool* workers)
+	{
+		static constexpr float clearColor[4] = { 0.2f, 0.5f, 0.698f, 1.0f };
+
+		auto studioModel = model.GetStudioModel();
+		auto header = studioModel->GetStudioHeader();
+
+		int sequence = FindSequence(header, job.Sequence);
+
+		if (sequence < 0)
+			throw std::runtime_error("no sequence " + job.Sequence);
+
+		auto pseqdesc = reinterpret_cast<const mstudioseqdesc_t*>(reinterpret_cast<const byte*>(header) + header->seqindex) + sequence;
+
+		auto& renderer = lane.Renderer;
+		renderer.SetModel(&model);
+		renderer.SetCameraPreset(job.Camera);
+		renderer.SetViewport(job.Width, job.Height);
+
+		if (renderer.GetWidth() == 0)
+			throw std::runtime_error("image size out of range");
+
+		if (job.Video)
+			return CaptureJob(renderer, *studioModel, sequence, job, clearColor, workers);
+
+		int columns = job.SheetColumns > 0 ? (std::min)(job.SheetColumns, job.Frames) : 0;
+		int rows = columns > 0 ? (job.Frames + columns - 1) / columns : 0;
+		size_t sheetWidth = static_cast<size_t>(columns) * job.Width;
+
+		// Cells past the last frame are left as the clear color
+		if (columns > 0)
+		{
+			renderer.Clear(clearColor);
+			lane.Image.assign(sheetWidth * rows * job.Height, renderer.GetPixels()[0]);
+		}
+
+		JobResult result{};
+
+		for (int frame = 0; frame < job.Frames; frame++)
+		{
+			StudioModelAnimating::PoseParameters pose{ sequence, GetFrame(pseqdesc, frame, job.Frames), {}, {}, 0 };
+
+			int numBones = StudioModelAnimating::EvaluatePose(*studioModel, pose, lane.BoneTransforms, MAXSTUDIOBONES, *lane.Scratch);
+
+			if (numBones == 0)
+				throw std::runtime_error("cannot evaluate sequence " + job.Sequence);
+
+			renderer.Clear(clearColor);
+			renderer.Draw(lane.BoneTransforms, numBones, workers);
+			result.Frames++;
+
+			if (columns == 0)
+			{
+				auto path = job.Frames > 1 ? GetFramePath(job.Output, frame) : job.Output;
+
+				auto pixels = renderer.GetPixels();
+
+				WriteImage(encoder, path, std::vector<uint32_t>(pixels, pixels + static_cast<size_t>(job.Width) * job.Height), job.Width, job.Height);
+
+				result.Images++;
+				continue;
+			}
+
+			size_t cellX = static_cast<size_t>(frame % columns) * job.Width;
+			size_t cellY = static_cast<size_t>(frame / columns) * job.Height;
+
+			for (int y = 0; y < job.Height; y++)
+				std::copy_n(renderer.GetPixels() + static_cast<size_t>(y) * job.Width, job.Width, lane.Image.data() + (cellY + y) * sheetWidth + cellX);
+		}
+
+		if (columns > 0)
+		{
+			// The next sheet of this lane allocates its own
+			WriteImage(encoder, job.Output, std::move(lane.Image), static_cast<int>(sheetWidth), rows * job.Height);
+
+			result.Images++;
+		}
+
+		return result;
+	}
+
+
+	static void RenderModel(Lane& lane, const std::vector<Job>& jobs, const std::vector<size_t>& modelJobs, std::vector<JobResult>& results, bool& failed, ImageEncodeQueue* encoder, ThreadPool* workers)
+	{
+		const auto& path = jobs[modelJobs.front()].Model;
+
+		SoftwareStudioModel model;
+		std::string error;
+
+		try
+		{
+			// Also on this lane's thread, the other lanes are loading models of their own
+			model.Load(path.wstring());
+
+			if (!model.GetStudioModel()->GetStudioHeader())
+				error = "cannot load " + path.string();
+		}
+		catch (const std::exception& e)
+		{
+			error = e.what();
+		}
+
+		failed = !error.empty();
+
+		for (auto job : modelJobs)
+		{
+			if (failed)
+			{
+				results[job].Error = error;
+				continue;
+			}
+
+			try
+			{
+				results[job] = RenderJob(lane, model, jobs[job], encoder, workers);
+			}
+			catch (const std::exception& e)
+			{
+				results[job].Error = e.what();
+			}
+		}
+	}
+
+
+public:
+
+	// Throws std::runtime_error naming the line of the first malformed job
+	static std::vector<Job> ParseManifest(std::istream& manifest, const std::filesystem::path& baseDirectory, const std::string& name)
+	{
+		std::vector<Job> jobs;
+		std::string line;
+		int lineNumber = 0;
+
+		while (std::getline(manifest, line))
+		{
+			lineNumber++;
+
+			auto fail = [&name, lineNumber](const std::string& message)
+			{
+				throw std::runtime_error(name + ":" + std::to_string(lineNumber) + ": " + message);
+			};
+
+			auto fields = SplitFields(line, fail);
+
+			if (fields.empty())
+				continue;
+
+			Job job{ {}, "0", 0, SoftwareStudioModelRenderer::CameraPreset::Auto, DefaultSize, DefaultSize, 0, DefaultFps, 0.0f, {}, {}, false, VideoStream::Format::Y4m, lineNumber };
+			bool hasFormat = false;
+
+			for (const auto& [key, value] : fields)
+			{
+				if (key == "model")
+					job.Model = baseDirectory / ToPath(value);
+				else if (key == "output")
+				{
+					if (value.starts_with('|'))
+						job.Pipe = value.substr(1);
+					else
+						job.Output = baseDirectory / ToPath(value);
+				}
+				else if (key == "sequence")
+					job.Sequence = value;
+				else if (key == "frames")
+				{
+					if (!ParseInt(value, job.Frames) || job.Frames < 1)
+						fail("bad frames " + value);
+				}
+				else if (key == "camera")
+				{
+					if (!ParseCamera(value, job.Camera))
+						fail("unknown camera " + value);
+				}
+				else if (key == "size")
+				{
+					auto x = value.find('x');
+
+					if (x == std::string::npos || !ParseInt(value.substr(0, x), job.Width) || !ParseInt(value.substr(x + 1), job.Height) ||
+						job.Width < 1 || job.Height < 1 || job.Width > SoftwareStudioModelRenderer::MaxViewportSize || job.Height > SoftwareStudioModelRenderer::MaxViewportSize)
+						fail("bad size " + value);
+				}
+				else if (key == "sheet")
+				{
+					if (!ParseInt(value, job.SheetColumns) || job.SheetColumns < 1)
+						fail("bad sheet " + value);
+				}
+				else if (key == "fps")
+				{
+					if (!ParseInt(value, job.Fps) || job.Fps < AnimationCapture::MinFps || job.Fps > 1000)
+						fail("bad fps " + value);
+				}
+				else if (key == "turntable")
+				{
+					if (!ParseFloat(value, job.TurntableSeconds) || !(job.TurntableSeconds > 0.0f))
+						fail("bad turntable " + value);
+				}
+				else if (key == "format")
+				{
+					if (!VideoStream::ParseFormat(value, job.VideoFormat))
+						fail("unknown format " + value);
+
+					hasFormat = true;
+				}
+				else
+					fail("unknown key " + key);
+			}
+
+			ImageWriter::Format format;
+
+			if (job.Model.empty())
+				fail("no model");
+
+			if (job.Output.empty() && job.Pipe.empty())
+				fail("no output");
+
+			if (!job.Pipe.empty())
+			{
+				if (!hasFormat)
+					fail("no format for the pipe");
+
+				job.Video = true;
+			}
+			else if (hasFormat)
+				fail("format is only for pipes");
+			else if (VideoStream::GetFormat(job.Output, job.VideoFormat))
+				job.Video = true;
+			else if (!ImageWriter::GetFormat(job.Output, format))
+				fail("unsupported image format " + job.Output.extension().string());
+
+			if (job.Video && job.SheetColumns > 0)
+				fail("sheet is only for images");
+
+			// 0 frames is the whole sequence or turn for a video, a single image otherwise
+			if (!job.Video && job.Frames == 0)
+				job.Frames = 1;
+
+			jobs.push_back(std::move(job));
+		}
+
+		return jobs;
+	}
+
+
+	static std::vector<Job> LoadManifest(const std::filesystem::path& path)
+	{
+		std::ifstream manifest(path);
+
+		if (!manifest)
+			throw std::runtime_error("Cannot open file: " + path.string());
+
+		return ParseManifest(manifest, path.parent_path(), path.filename().string());
+	}
+
+
+	// Renders every job, on workers if set, and carries on past the ones that fail.
+	// With an encoder, the images are encoded and written in the background while the
+	// lanes render on, and Run waits for them before it returns.
+	static Report Run(const std::vector<Job>& jobs, ThreadPool* workers, ImageEncodeQueue* encoder = nullptr)
+	{
+		auto start = std::chrono::steady_clock::now();
+		auto encodingStart = encoder ? encoder->GetStats() : ImageEncodeQueue::Stats{};
+
+		// Jobs grouped by model, models in the order they first appear
+		std::vector<std::vector<size_t>> models;
+		std::unordered_map<std::wstring, size_t> modelIndices;
+
+		for (size_t i = 0; i < jobs.size(); i++)
+		{
+			auto found = modelIndices.emplace(jobs[i].Model.lexically_normal().wstring(), models.size());
+
+			if (found.second)
+				models.emplace_back();
+
+			models[found.first->second].push_back(i);
+		}
+
+		std::vector<JobResult> results(jobs.size());
+		std::unique_ptr<bool[]> failedModels(new bool[models.size()]{});
+
+		size_t numLanes = (std::min)(workers ? workers->GetThreadCount() + 1 : 1, models.size());
+		std::vector<std::unique_ptr<Lane>> lanes;
+
+		for (size_t i = 0; i < numLanes; i++)
+			lanes.push_back(std::make_unique<Lane>());
+
+		std::atomic<size_t> nextModel{};
+
+		// Several lanes already keep every thread busy, a single one draws on workers
+		ThreadPool* drawWorkers = numLanes == 1 ? workers : nullptr;
+
+		auto runLane = [&](size_t lane)
+		{
+			for (size_t model; (model = nextModel.fetch_add(1)) < models.size();)
+				RenderModel(*lanes[lane], jobs, models[model], results, failedModels[model], encoder, drawWorkers);
+		};
+
+		if (workers && numLanes > 1)
+			workers->ParallelFor(numLanes, runLane);
+		else if (numLanes > 0)
+			runLane(0);
+
+		Report report{};
+		report.Models = models.size();
+		report.FailedModels = std::count(failedModels.get(), failedModels.get() + models.size(), true);
+		report.Jobs = jobs.size();
+
+		for (size_t i = 0; i < jobs.size(); i++)
+		{
+			report.Images += results[i].Images;
+			report.Videos += results[i].Videos;
+			report.Frames += results[i].Frames;
+
+			if (!results[i].Error.empty())
+			{
+				report.FailedJobs++;
+				report.Errors.push_back("line " + std::to_string(jobs[i].Line) + ": " + results[i].Error);
+			}
+		}
+
+		if (encoder)
+		{
+			encoder->Wait();
+
+			auto encoding = encoder->GetStats();
+			encoding.Images -= encodingStart.Images;
+			encoding.Failed -= encodingStart.Failed;
+			encoding.Bytes -= encodingStart.Bytes;
+			encoding.EncodeSeconds -= encodingStart.EncodeSeconds;
+			encoding.WriteSeconds -= encodingStart.WriteSeconds;
+			encoding.StallSeconds -= encodingStart.StallSeconds;
+
+			report.Encoding = encoding;
+			report.Images -= encoding.Failed;
+
+			for (auto& error : encoder->TakeErrors())
+				report.Errors.push_back(std::move(error));
+		}
+
+		report.Seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+		return report;
+	}
+};
@@ -0,0 +1,700 @@
+#pragma once
+
+#include "StudioModelRenderer.hpp"
+#include "CrowdAnimation.hpp"
+#include "SoftwareRenderer.hpp"
+#include "ThreadPool.hpp"
+
+#include <cstdio>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <random>
+#include <chrono>
+#include <string>
+#include <vector>
+#include <memory>
+#include <filesystem>
+#include <stdexcept>
+#include <algorithm>
+
+
+// Timings of the load, animation and drawing paths as plain text tables, for
+// comparing builds and machines:
+//
+//   GoldSrcModelViewerDirectX11.exe --bench models/barney.mdl [suite ...]
+//
+// runs the named suites, or all of them, with the model where a suite needs one:
+//
+//   load        milliseconds per StudioModel::LoadFromFile of generated models of
+//               1k, 10k and 50k vertices
+//   palette     microseconds per PaletteExpand of 64x64 to 512x512 textures with
+//               each kernel the CPU runs
+//   bones       nanoseconds per bone per frame of each BoneKernels kernel the CPU
+//               runs, for skeletons of 30, 64 and 128 bones
+//   crowd       CrowdAnimation instances per millisecond at 1, 2, 4 and 8 threads
+//   evaluators  microseconds per pose of the specialized pose evaluators against
+//               the generic one, for each blend count the model's sequences use
+//   raster      SoftwareStudioModelRenderer frames per second at 400x400 and
+//               1024x1024, at 1, 2, 4 and 8 threads
+//
+// Every figure is the best of repeated runs over at least MinSeconds. Thread counts
+// include the calling thread, which takes part in ThreadPool::ParallelFor; counts
+// above the number of cores show the pool's overhead rather than any scaling.
+class Benchmark
+{
+public:
+
+	struct Settings
+	{
+		std::filesystem::path Model;
+		std::vector<std::string> Suites; // empty for all of them
+		double MinSeconds = 0.5; // per figure
+		FILE* Output = stdout;
+	};
+
+
+	static constexpr size_t CrowdInstances = 4000;
+
+	// Generated models are grids of this many columns, at most GridRows rows per
+	// mstudiomodel_t so that vertex indices fit the tricmds' 16 bits
+	static constexpr int GridColumns = 100;
+	static constexpr int GridRows = 250;
+
+
+private:
+
+	// Best milliseconds per call of body. Calls are timed in runs long enough for the
+	// clock's resolution not to matter, after one call to warm the caches.
+	template<typename Body>
+	static double MeasureMilliseconds(double minSeconds, Body&& body)
+	{
+		using Clock = std::chrono::steady_clock;
+
+		body();
+
+		size_t calls = 1;
+
+		for (;;)
+		{
+			auto start = Clock::now();
+
+			for (size_t i = 0; i < calls; i++)
+				body();
+
+			if (std::chrono::duration<double, std::milli>(Clock::now() - start).count() >= 1.0 || calls >= (1u << 24))
+				break;
+
+			calls *= 2;
+		}
+
+		double best = DBL_MAX;
+		auto end = Clock::now() + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(minSeconds));
+
+		do
+		{
+			auto start = Clock::now();
+
+			for (size_t i = 0; i < calls; i++)
+				body();
+
+			best = (std::min)(best, std::chrono::duration<double, std::milli>(Clock::now() - start).count() / calls);
+		} while (Clock::now() < end);
+
+		return best;
+	}
+
+
+	// The calling thread and threads - 1 workers; null for one thread
+	static std::unique_ptr<ThreadPool> MakeWorkers(unsigned threads)
+	{
+		return threads > 1 ? std::make_unique<ThreadPool>(threads - 1) : nullptr;
+	}
+
+
+	static std::unique_ptr<StudioModel> LoadModel(const Settings& settings)
+	{
+		auto studioModel = std::make_unique<StudioModel>();
+
+		if (!settings.Model.empty())
+			studioModel->LoadFromFile(settings.Model.wstring());
+
+		if (!studioModel->GetStudioHeader())
+			throw std::runtime_error("Cannot open file: " + settings.Model.string());
+
+		return studioModel;
+	}
+
+
+	// A studio file with one bone, one 64x64 texture and numVertices distinct vertices
+	// in grids of strips, one body part per grid. Every vertex is used by two strips.
+	static std::vector<uint8_t> BuildGridModel(int numVertices)
+	{
+		std::vector<uint8_t> data(sizeof(studiohdr_t));
+
+		auto append = [&data](const void* source, size_t size)
+		{
+			data.resize((data.size() + 3) & ~static_cast<size_t>(3));
+
+			auto offset = data.size();
+			data.insert(data.end(), static_cast<const uint8_t*>(source), static_cast<const uint8_t*>(source) + size);
+
+			return static_cast<int>(offset);
+		};
+
+		studiohdr_t header{};
+
+		header.id = 0x54534449; // "IDST"
+		header.version = 10;
+		strcpy(header.name, "grid.mdl");
+
+		mstudiobone_t bone{};
+		strcpy(bone.name, "root");
+		bone.parent = -1;
+
+		for (int i = 0; i < 6; i++)
+		{
+			bone.bonecontroller[i] = -1;
+			bone.scale[i] = 1.0f;
+		}
+
+		header.numbones = 1;
+		header.boneindex = append(&bone, sizeof(bone));
+
+		std::vector<uint8_t> texels(64 * 64 + 768);
+
+		for (size_t i = 0; i < texels.size(); i++)
+			texels[i] = static_cast<uint8_t>(i * 7);
+
+		mstudiotexture_t texture{};
+		strcpy(texture.name, "grid.bmp");
+		texture.width = 64;
+		texture.height = 64;
+		texture.index = append(texels.data(), texels.size());
+
+		int16_t skinRef = 0;
+
+		header.numtextures = 1;
+		header.textureindex = append(&texture, sizeof(texture));
+		header.numskinref = 1;
+		header.numskinfamilies = 1;
+		header.skinindex = append(&skinRef, sizeof(skinRef));
+
+		std::vector<mstudiomodel_t> models;
+
+		for (int first = 0; first < numVertices; first += GridColumns * GridRows)
+		{
+			int rows = (std::min)(numVertices - first, GridColumns * GridRows) / GridColumns;
+			int count = rows * GridColumns;
+
+			std::vector<vec3_t> positions(count);
+			std::vector<vec3_t> normals(count);
+
+			for (int i = 0; i < count; i++)
+			{
+				float x = static_cast<float>(i % GridColumns);
+				float y = static_cast<float>(i / GridColumns);
+
+				// A wavy sheet, so every normal differs too
+				positions[i][0] = x;
+				positions[i][1] = y;
+				positions[i][2] = 4.0f * sinf(x * 0.3f) * cosf(y * 0.3f);
+
+				float dx = 1.2f * cosf(x * 0.3f) * cosf(y * 0.3f);
+				float dy = -1.2f * sinf(x * 0.3f) * sinf(y * 0.3f);
+				float length = sqrtf(dx * dx + dy * dy + 1.0f);
+
+				normals[i][0] = -dx / length;
+				normals[i][1] = -dy / length;
+				normals[i][2] = 1.0f / length;
+			}
+
+			// A strip along each pair of rows: vertex, normal, s, t per point
+			std::vector<int16_t> tricmds;
+
+			for (int row = 0; row + 1 < rows; row++)
+			{
+				tricmds.push_back(static_cast<int16_t>(GridColumns * 2));
+
+				for (int column = 0; column < GridColumns; column++)
+				{
+					for (int r = row; r < row + 2; r++)
+					{
+						auto index = static_cast<int16_t>(r * GridColumns + column);
+						tricmds.insert(tricmds.end(), { index, index, static_cast<int16_t>(column), static_cast<int16_t>(r) });
+					}
+				}
+			}
+
+			tricmds.push_back(0);
+
+			std::vector<uint8_t> boneIndices(count, 0);
+
+			mstudiomesh_t mesh{};
+			mesh.numtris = (rows - 1) * (GridColumns - 1) * 2;
+			mesh.triindex = append(tricmds.data(), tricmds.size() * sizeof(int16_t));
+			mesh.numnorms = count;
+
+			mstudiomodel_t model{};
+			snprintf(model.name, sizeof(model.name), "grid%zu", models.size());
+			model.nummesh = 1;
+			model.meshindex = append(&mesh, sizeof(mesh));
+			model.numverts = count;
+			model.vertinfoindex = append(boneIndices.data(), boneIndices.size());
+			model.vertindex = append(positions.data(), positions.size() * sizeof(vec3_t));
+			model.numnorms = count;
+			model.norminfoindex = append(boneIndices.data(), boneIndices.size());
+			model.normindex = append(normals.data(), normals.size() * sizeof(vec3_t));
+
+			models.push_back(model);
+		}
+
+		std::vector<mstudiobodyparts_t> bodyParts(models.size());
+
+		for (size_t i = 0; i < models.size(); i++)
+		{
+			snprintf(bodyParts[i].name, sizeof(bodyParts[i].name), "grid%zu", i);
+			bodyParts[i].nummodels = 1;
+			bodyParts[i].base = 1;
+			bodyParts[i].modelindex = append(&models[i], sizeof(models[i]));
+		}
+
+		header.numbodyparts = static_cast<int>(bodyParts.size());
+		header.bodypartindex = append(bodyParts.data(), bodyParts.size() * sizeof(mstudiobodyparts_t));
+		header.length = static_cast<int>(data.size());
+
+		memcpy(data.data(), &header, sizeof(header));
+
+		return data;
+	}
+
+
+	// Builds the welded vertices, indices and texture views of each model from the
+	// mapped file, on the calling thread
+	static void RunLoad(const Settings& settings)
+	{
+		static const int vertexCounts[] = { 1000, 10000, 50000 };
+
+		fprintf(settings.Output, "load: generated models, one thread\n");
+		fprintf(settings.Output, "  %9s %9s %9s %12s\n", "vertices", "triangles", "ms/load", "vertices/ms");
+
+		auto directory = std::filesystem::temp_directory_path();
+		auto tag = std::to_string(std::random_device{}());
+
+		for (auto numVertices : vertexCounts)
+		{
+			auto path = directory / ("benchmark-" + tag + "-" + std::to_string(numVertices) + ".mdl");
+
+			{
+				auto data = BuildGridModel(numVertices);
+
+				std::ofstream file(path, std::ios::binary | std::ios::trunc);
+				file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+
+				if (!file)
+					throw std::runtime_error("cannot write " + path.string());
+			}
+
+			StudioModel::LoadReport report{};
+
+			auto ms = MeasureMilliseconds(settings.MinSeconds, [&path, &report]()
+			{
+				StudioModel studioModel;
+				studioModel.LoadFromFile(path.wstring());
+
+				report = studioModel.GetLoadReport();
+			});
+
+			std::error_code error;
+			std::filesystem::remove(path, error);
+
+			fprintf(settings.Output, "  %9zu %9zu %9.3f %12.0f\n", report.NumVertices, report.NumTriangles, ms, report.NumVertices / ms);
+		}
+	}
+
+
+	// Random indices through a masked table, as LoadTexture builds it
+	static void RunPalette(const Settings& settings)
+	{
+		using Kernel = PaletteExpand::Kernel;
+
+		static const int sizes[] = { 64, 128, 256, 512 };
+		static const Kernel kernels[] = { Kernel::Scalar, Kernel::AVX2 };
+		static const char* const kernelNames[] = { "Scalar", "AVX2" };
+
+		auto numKernels = static_cast<size_t>(PaletteExpand::DetectKernel()) + 1;
+
+		fprintf(settings.Output, "palette: us per texture (ns per texel)\n");
+		fprintf(settings.Output, "  size     ");
+
+		for (size_t k = 0; k < numKernels; k++)
+			fprintf(settings.Output, k + 1 < numKernels ? " %-16s" : " %s", kernelNames[k]);
+
+		fprintf(settings.Output, "\n");
+
+		std::mt19937 random(1);
+
+		uint8_t palette[768];
+
+		for (auto& value : palette)
+			value = static_cast<uint8_t>(random());
+
+		uint32_t table[256];
+		PaletteExpand::BuildTable(palette, true, table);
+
+		for (auto size : sizes)
+		{
+			auto count = static_cast<size_t>(size) * size;
+
+			std::vector<uint8_t> indices(count);
+			std::vector<uint8_t> pixels(count * 4);
+
+			for (auto& index : indices)
+				index = static_cast<uint8_t>(random());
+
+			char label[32];
+			snprintf(label, sizeof(label), "%dx%d", size, size);
+
+			fprintf(settings.Output, "  %-9s", label);
+
+			for (size_t k = 0; k < numKernels; k++)
+			{
+				auto kernel = kernels[k];
+
+				auto ms = MeasureMilliseconds(settings.MinSeconds, [&]()
+				{
+					PaletteExpand::Expand(kernel, indices.data(), count, table, pixels.data());
+				});
+
+				char cell[32];
+				snprintf(cell, sizeof(cell), "%.2f (%.3f)", ms * 1000.0, ms * 1e6 / count);
+
+				fprintf(settings.Output, k + 1 < numKernels ? " %-16s" : " %s", cell);
+			}
+
+			fprintf(settings.Output, "\n");
+		}
+	}
+
+
+	// What a two-blend pose does per bone once the angles are sampled: interpolated
+	// angles to quaternions for each blend, the blend slerp, the local matrices and
+	// their concatenation down a binary tree of bones
+	static void RunBones(const Settings& settings)
+	{
+		using Kernel = BoneKernels::Kernel;
+
+		static const int boneCounts[] = { 30, 64, 128 };
+		static const Kernel kernels[] = { Kernel::Scalar, Kernel::SSE2, Kernel::AVX2 };
+		static const char* const kernelNames[] = { "Scalar", "SSE2", "AVX2" };
+
+		// The enumerators are ordered, so the CPU runs every kernel up to the one it detects
+		auto numKernels = static_cast<size_t>(BoneKernels::DetectKernel()) + 1;
+
+		fprintf(settings.Output, "bones: ns per bone per frame\n");
+		fprintf(settings.Output, "  bones  ");
+
+		for (size_t k = 0; k < numKernels; k++)
+			fprintf(settings.Output, " %9s", kernelNames[k]);
+
+		fprintf(settings.Output, "\n");
+
+		auto scratch = std::make_unique<StudioModelAnimating::Scratch>();
+		float boneTransforms[MAXSTUDIOBONES][3][4];
+
+		std::mt19937 random(1);
+		std::uniform_real_distribution<float> angle(-3.14159265f, 3.14159265f);
+
+		for (auto& component : scratch->Angle1)
+		{
+			for (auto& value : component)
+				value = angle(random);
+		}
+
+		for (auto& component : scratch->Angle2)
+		{
+			for (auto& value : component)
+				value = angle(random);
+		}
+
+		for (auto& pos : scratch->Pos[0])
+		{
+			for (auto& value : pos)
+				value = angle(random);
+		}
+
+		for (auto numBones : boneCounts)
+		{
+			fprintf(settings.Output, "  %-7d", numBones);
+
+			for (size_t k = 0; k < numKernels; k++)
+			{
+				auto kernel = kernels[k];
+				auto& q = scratch->Q;
+
+				auto ms = MeasureMilliseconds(settings.MinSeconds, [&]()
+				{
+					BoneKernels::AnglesToQuaternions(kernel, scratch->Angle1[0], scratch->Angle2[0], 0.25f, q[0][0], numBones, MAXSTUDIOBONES);
+					BoneKernels::AnglesToQuaternions(kernel, scratch->Angle2[0], scratch->Angle1[0], 0.75f, q[1][0], numBones, MAXSTUDIOBONES);
+					BoneKernels::Slerp(kernel, q[0][0], q[1][0], 0.5f, numBones, MAXSTUDIOBONES);
+					BoneKernels::QuaternionsToMatrices(kernel, q[0][0], scratch->Pos[0], scratch->BoneMatrix, numBones, MAXSTUDIOBONES);
+
+					memcpy(boneTransforms[0], scratch->BoneMatrix[0], sizeof(float) * 12);
+
+					for (int i = 1; i < numBones; i++)
+						R_ConcatTransforms(boneTransforms[(i - 1) / 2], scratch->BoneMatrix[i], boneTransforms[i]);
+				});
+
+				fprintf(settings.Output, " %9.1f", ms * 1e6 / numBones);
+			}
+
+			fprintf(settings.Output, "\n");
+		}
+	}
+
+
+	// Instances spread over every sequence, frame and blend, with the RLE spans
+	// and then with the decoded-key cache
+	static void RunCrowd(const Settings& settings, StudioModel& studioModel)
+	{
+		static const unsigned threadCounts[] = { 1, 2, 4, 8 };
+
+		auto header = studioModel.GetStudioHeader();
+
+		fprintf(settings.Output, "crowd: %zu instances of %s, %d bones, instances/ms\n",
+			CrowdInstances, settings.Model.filename().string().c_str(), header->numbones);
+
+		fprintf(settings.Output, "  threads ");
+
+		for (auto threads : threadCounts)
+			fprintf(settings.Output, " %9u", threads);
+
+		fprintf(settings.Output, "\n");
+
+		for (int decoded = 0; decoded < 2; decoded++)
+		{
+			studioModel.SetDecodedSequenceCacheBudget(decoded ? static_cast<size_t>(256) << 20 : 0);
+
+			fprintf(settings.Output, "  %-8s", decoded ? "decoded" : "spans");
+
+			for (auto threads : threadCounts)
+			{
+				auto workers = MakeWorkers(threads);
+
+				CrowdAnimation crowd;
+				crowd.SetModel(&studioModel);
+
+				for (size_t i = 0; i < CrowdInstances; i++)
+				{
+					CrowdAnimation::Instance instance{};
+
+					instance.Sequence = static_cast<int>(i % header->numseq);
+					instance.Frame = static_cast<float>((i * 7) % 10);
+					instance.PlaybackRate = 1.0f;
+					instance.Blendings[0] = static_cast<byte>(i);
+					instance.Controllers[0] = static_cast<byte>(i * 3);
+
+					crowd.AddInstance(instance);
+				}
+
+				auto ms = MeasureMilliseconds(settings.MinSeconds, [&crowd, &workers]() { crowd.Update(1.0 / 60.0, workers.get()); });
+
+				fprintf(settings.Output, " %9.1f", CrowdInstances / ms);
+			}
+
+			fprintf(settings.Output, "\n");
+		}
+
+		studioModel.SetDecodedSequenceCacheBudget(0);
+	}
+
+
+	// The first sequence of each blend count the evaluators tell apart (any other
+	// count above one samples two blends), posed at every frame in turn with the
+	// blends half way, on the spans and then on decoded keys
+	static void RunEvaluators(const Settings& settings, StudioModel& studioModel)
+	{
+		auto header = studioModel.GetStudioHeader();
+		auto pseqdesc = (const mstudioseqdesc_t*)((const byte*)header + header->seqindex);
+
+		fprintf(settings.Output, "evaluators: %s, %d bones, %d controllers, us/pose generic -> specialized\n",
+			settings.Model.filename().string().c_str(), header->numbones, header->numbonecontrollers);
+
+		fprintf(settings.Output, "  blends sequence  %-28s %s\n", "spans", "decoded");
+
+		auto& scratch = StudioModelAnimating::GetThreadScratch();
+		float boneTransforms[MAXSTUDIOBONES][3][4];
+
+		for (int blends : { 1, 2, 4 })
+		{
+			int sequence = 0;
+
+			auto evaluatedBlends = [](int numblends) { return numblends == 4 ? 4 : (numblends > 1 ? 2 : 1); };
+
+			while (sequence < header->numseq && evaluatedBlends(pseqdesc[sequence].numblends) != blends)
+				sequence++;
+
+			if (sequence == header->numseq)
+				continue;
+
+			StudioModelAnimating::PoseParameters pose{};
+
+			pose.Sequence = sequence;
+			pose.Blendings[0] = 128;
+			pose.Blendings[1] = 128;
+
+			auto numFrames = (std::max)(pseqdesc[sequence].numframes, 1);
+
+			fprintf(settings.Output, "  %-6d %-9d", blends, sequence);
+
+			for (int decoded = 0; decoded < 2; decoded++)
+			{
+				studioModel.SetDecodedSequenceCacheBudget(decoded ? static_cast<size_t>(256) << 20 : 0);
+
+				double ms[2];
+
+				for (int generic = 0; generic < 2; generic++)
+				{
+					int frame = 0;
+
+					ms[generic] = MeasureMilliseconds(settings.MinSeconds, [&]()
+					{
+						pose.Frame = static_cast<float>(frame);
+						frame = (frame + 1) % numFrames;
+
+						if (generic)
+							StudioModelAnimating::EvaluateGenericPose(studioModel, pose, boneTransforms, MAXSTUDIOBONES, scratch);
+						else
+							StudioModelAnimating::EvaluatePose(studioModel, pose, boneTransforms, MAXSTUDIOBONES, scratch);
+					});
+				}
+
+				char cell[64];
+				snprintf(cell, sizeof(cell), "%.2f -> %.2f (%.2fx)", ms[1] * 1000.0, ms[0] * 1000.0, ms[1] / ms[0]);
+
+				fprintf(settings.Output, decoded ? " %s" : " %-28s", cell);
+			}
+
+			fprintf(settings.Output, "\n");
+		}
+
+		studioModel.SetDecodedSequenceCacheBudget(0);
+	}
+
+
+	// Clears and draws sequence 0, a new frame of it each time
+	static void RunRaster(const Settings& settings)
+	{
+		static const unsigned threadCounts[] = { 1, 2, 4, 8 };
+		static const int sizes[] = { 400, 1024 };
+
+		SoftwareStudioModel softwareModel;
+		softwareModel.Load(settings.Model.wstring());
+
+		auto studioModel = softwareModel.GetStudioModel();
+		auto header = studioModel->GetStudioHeader();
+
+		if (!header)
+			throw std::runtime_error("Cannot open file: " + settings.Model.string());
+
+		auto numFrames = (std::max)(((const mstudioseqdesc_t*)((const byte*)header + header->seqindex))->numframes, 1);
+
+		fprintf(settings.Output, "raster: %s, frames per second\n", settings.Model.filename().string().c_str());
+		fprintf(settings.Output, "  threads  ");
+
+		for (auto threads : threadCounts)
+			fprintf(settings.Output, " %9u", threads);
+
+		fprintf(settings.Output, "\n");
+
+		static const float clearColor[4] = { 0.0f, 0.0f, 0.0f, 1.0f };
+
+		auto& scratch = StudioModelAnimating::GetThreadScratch();
+		float boneTransforms[MAXSTUDIOBONES][3][4];
+
+		SoftwareStudioModelRenderer renderer;
+		renderer.SetModel(&softwareModel);
+
+		for (auto size : sizes)
+		{
+			renderer.SetViewport(size, size);
+
+			char label[32];
+			snprintf(label, sizeof(label), "%dx%d", size, size);
+
+			fprintf(settings.Output, "  %-9s", label);
+
+			for (auto threads : threadCounts)
+			{
+				auto workers = MakeWorkers(threads);
+				int frame = 0;
+
+				auto ms = MeasureMilliseconds(settings.MinSeconds, [&]()
+				{
+					StudioModelAnimating::PoseParameters pose{};
+					pose.Frame = static_cast<float>(frame);
+					frame = (frame + 1) % numFrames;
+
+					auto numBones = StudioModelAnimating::EvaluatePose(*studioModel, pose, boneTransforms, MAXSTUDIOBONES, scratch);
+
+					renderer.Clear(clearColor);
+					renderer.Draw(boneTransforms, numBones, workers.get());
+				});
+
+				fprintf(settings.Output, " %9.1f", 1000.0 / ms);
+			}
+
+			fprintf(settings.Output, "\n");
+		}
+	}
+
+
+public:
+
+	// Throws std::runtime_error for an unknown suite or a model that cannot be loaded
+	static void Run(const Settings& settings)
+	{
+		static const char* const suites[] = { "load", "palette", "bones", "crowd", "evaluators", "raster" };
+
+		for (const auto& suite : settings.Suites)
+		{
+			if (std::find_if(std::begin(suites), std::end(suites), [&suite](const char* name) { return suite == name; }) == std::end(suites))
+				throw std::runtime_error("unknown benchmark suite " + suite);
+		}
+
+		auto selected = [&settings](const char* name)
+		{
+			return settings.Suites.empty() || std::find(settings.Suites.begin(), settings.Suites.end(), name) != settings.Suites.end();
+		};
+
+		// Loaded once, for the first suite that needs it
+		std::unique_ptr<StudioModel> studioModel;
+
+		auto model = [&settings, &studioModel]() -> StudioModel&
+		{
+			if (!studioModel)
+				studioModel = LoadModel(settings);
+
+			return *studioModel;
+		};
+
+		if (selected("load"))
+			RunLoad(settings);
+
+		if (selected("palette"))
+			RunPalette(settings);
+
+		if (selected("bones"))
+			RunBones(settings);
+
+		if (selected("crowd"))
+			RunCrowd(settings, model());
+
+		if (selected("evaluators"))
+			RunEvaluators(settings, model());
+
+		if (selected("raster"))
+			RunRaster(settings);
+	}
+};
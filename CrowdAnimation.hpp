@@ -0,0 +1,461 @@
+#pragma once
+
+#include "StudioModelRenderer.hpp"
+#include "ThreadPool.hpp"
+#include "PoseCache.hpp"
+
+#include <chrono>
+#include <cfloat>
+
+
+// Many instances of one studio model, animated together. Every instance keeps
+// only its own playback state; the instances are split into batches that the
+// pool's workers take in turn, each pose evaluated with
+// StudioModelAnimating::EvaluatePose straight into one contiguous bone palette.
+//
+// Instances further away can use a cheaper level of detail: they are evaluated
+// only every few updates, with their leaf bones held at the rest pose, and the
+// updates in between blend the last two evaluated poses. Those blended poses run
+// one interval behind the evaluated ones.
+class CrowdAnimation
+{
+public:
+
+	struct Instance
+	{
+		int Sequence;
+		float Frame;
+		float PlaybackRate;
+		byte Controllers[4];
+		byte Blendings[2];
+		byte Mouth;
+		float Distance; // picks the level of detail, see LodLevel
+	};
+
+
+	struct LodLevel
+	{
+		float MaxDistance; // the first level whose MaxDistance is not below Instance::Distance is used
+		int UpdateInterval; // 1 evaluates every update
+		int DroppedBoneLayers; // 1 holds the leaf bones at rest, 2 also bones whose children are all held, ...
+	};
+
+
+	static constexpr int MaxLodLevels = 4;
+
+
+	struct LodStats
+	{
+		size_t Instances;
+		size_t Evaluations;
+		size_t Interpolations;
+		size_t RigidBones; // held at rest in every evaluation
+	};
+
+
+	struct Stats
+	{
+		size_t Instances;
+		size_t Batches;
+		size_t Threads;
+		double UpdateMilliseconds;
+		double InstancesPerMillisecond;
+		LodStats Lods[MaxLodLevels];
+	};
+
+
+	// Small enough to balance across workers, large enough that taking a batch stays cheap
+	static constexpr size_t BatchSize = 32;
+
+
+private:
+
+	struct LodState
+	{
+		int Level; // -1 until the first update
+		int Phase; // updates since the last evaluation
+		int KeyPoses; // evaluated poses held, up to 2
+	};
+
+
+	// A bone of a key pose: rotation and translation in model space
+	using KeyBone = StudioModelAnimating::PaletteBone;
+
+
+	KeyBone* GetKeyPose(size_t instance, int key)
+	{
+		return m_KeyPoses.data() + (instance * 2 + key) * m_NumBones;
+	}
+
+
+	// The pose just evaluated into the palette becomes the newer key pose
+	void PushKeyPose(size_t instance, LodState& lod)
+	{
+		auto transforms = GetBoneTransforms(instance);
+		auto previous = GetKeyPose(instance, 0);
+		auto latest = GetKeyPose(instance, 1);
+
+		if (lod.KeyPoses > 0)
+			std::copy(latest, latest + m_NumBones, previous);
+
+		StudioModelAnimating::WriteBonePalette(transforms, StudioModelAnimating::BoneRange{ 0, m_NumBones },
+			StudioModelAnimating::BonePaletteLayout::QuaternionTranslation, latest);
+
+		lod.KeyPoses = (std::min)(lod.KeyPoses + 1, 2);
+	}
+
+
+	// Normalized lerp between the key poses into the palette; t = 0 is the older one
+	void BlendKeyPoses(size_t instance, float t)
+	{
+		auto transforms = GetBoneTransforms(instance);
+		auto previous = GetKeyPose(instance, 0);
+		auto latest = GetKeyPose(instance, 1);
+
+		for (int i = 0; i < m_NumBones; i++)
+		{
+			const auto& p = previous[i];
+			const auto& q = latest[i];
+
+			// Take the shorter way round
+			float dot = p.Rotation[0] * q.Rotation[0] + p.Rotation[1] * q.Rotation[1] + p.Rotation[2] * q.Rotation[2] + p.Rotation[3] * q.Rotation[3];
+			float tq = dot < 0.0f ? -t : t;
+
+			float x = p.Rotation[0] * (1.0f - t) + q.Rotation[0] * tq;
+			float y = p.Rotation[1] * (1.0f - t) + q.Rotation[1] * tq;
+			float z = p.Rotation[2] * (1.0f - t) + q.Rotation[2] * tq;
+			float w = p.Rotation[3] * (1.0f - t) + q.Rotation[3] * tq;
+
+			// Folding the normalization into the matrix scale saves the square root
+			float scale = 2.0f / (x * x + y * y + z * z + w * w);
+
+			auto matrix = transforms[i];
+
+			// Same layout as QuaternionMatrix, in single precision
+			matrix[0][0] = 1.0f - scale * (y * y + z * z);
+			matrix[1][0] = scale * (x * y + w * z);
+			matrix[2][0] = scale * (x * z - w * y);
+
+			matrix[0][1] = scale * (x * y - w * z);
+			matrix[1][1] = 1.0f - scale * (x * x + z * z);
+			matrix[2][1] = scale * (y * z + w * x);
+
+			matrix[0][2] = scale * (x * z + w * y);
+			matrix[1][2] = scale * (y * z - w * x);
+			matrix[2][2] = 1.0f - scale * (x * x + y * y);
+
+			for (int j = 0; j < 3; j++)
+				matrix[j][3] = p.Position[j] * (1.0f - t) + q.Position[j] * t;
+		}
+	}
+
+
+	int SelectLod(float distance) const
+	{
+		for (int level = 0; level < m_NumLodLevels - 1; level++)
+		{
+			if (distance <= m_LodLevels[level].MaxDistance)
+				return level;
+		}
+
+		return m_NumLodLevels - 1;
+	}
+
+
+	// A bone's height is 0 for leaves and one more than its highest child otherwise
+	void BuildRigidBones()
+	{
+		m_RigidBones.assign(static_cast<size_t>(MaxLodLevels) * m_NumBones, 0);
+
+		for (auto& count : m_RigidBoneCounts)
+			count = 0;
+
+		if (!m_StudioModel || !m_StudioModel->GetStudioHeader())
+			return;
+
+		auto header = m_StudioModel->GetStudioHeader();
+		auto pbones = (const mstudiobone_t*)((const byte*)header + header->boneindex);
+
+		std::vector<int> heights(m_NumBones, 0);
+
+		// Children come after their parents
+		for (int i = m_NumBones - 1; i >= 0; i--)
+		{
+			if (pbones[i].parent >= 0)
+				heights[pbones[i].parent] = (std::max)(heights[pbones[i].parent], heights[i] + 1);
+		}
+
+		for (int level = 0; level < m_NumLodLevels; level++)
+		{
+			for (int i = 0; i < m_NumBones; i++)
+			{
+				bool rigid = heights[i] < m_LodLevels[level].DroppedBoneLayers;
+
+				m_RigidBones[level * m_NumBones + i] = rigid;
+				m_RigidBoneCounts[level] += rigid;
+			}
+		}
+	}
+
+
+	void UpdateBatch(size_t batch, double dt)
+	{
+		auto header = m_StudioModel->GetStudioHeader();
+		auto& scratch = StudioModelAnimating::GetThreadScratch();
+
+		size_t begin = batch * BatchSize;
+		size_t end = (std::min)(begin + BatchSize, m_Instances.size());
+
+		size_t counters[MaxLodLevels][3]{};
+
+		for (size_t i = begin; i < end; i++)
+		{
+			auto& instance = m_Instances[i];
+			auto& lod = m_LodStates[i];
+
+			// AdvanceFrame reads the sequence before EvaluatePose gets to check it
+			if (instance.Sequence < 0 || instance.Sequence >= header->numseq)
+				instance.Sequence = 0;
+
+			instance.Frame = StudioModelAnimating::AdvanceFrame(header, instance.Sequence, instance.Frame, dt * instance.PlaybackRate);
+
+			int level = SelectLod(instance.Distance);
+			int interval = (std::max)(m_LodLevels[level].UpdateInterval, 1);
+
+			// A new level starts over from a fresh pose. The phases are staggered so
+			// that the instances of a level do not all evaluate on the same update.
+			bool evaluate = lod.Phase == 0 || lod.Level != level;
+
+			if (lod.Level != level)
+			{
+				lod.Level = level;
+				lod.Phase = static_cast<int>(i % interval);
+				lod.KeyPoses = 0;
+			}
+
+			counters[level][0]++;
+
+			if (evaluate)
+			{
+				StudioModelAnimating::PoseParameters pose{};
+
+				pose.Sequence = instance.Sequence;
+				pose.Frame = instance.Frame;
+				memcpy(pose.Controllers, instance.Controllers, sizeof(pose.Controllers));
+				memcpy(pose.Blendings, instance.Blendings, sizeof(pose.Blendings));
+				pose.Mouth = instance.Mouth;
+
+				auto rigidBones = m_RigidBoneCounts[level] > 0 ? m_RigidBones.data() + level * m_NumBones : nullptr;
+
+				if (m_PoseCache)
+					m_PoseCache->EvaluatePose(*m_StudioModel, pose, GetBoneTransforms(i), m_NumBones, scratch, m_BoneKernel, m_LodLevels[level].DroppedBoneLayers, rigidBones);
+				else
+					StudioModelAnimating::EvaluatePose(*m_StudioModel, pose, GetBoneTransforms(i), m_NumBones, scratch, m_BoneKernel, rigidBones);
+
+				counters[level][1]++;
+
+				if (interval > 1)
+					PushKeyPose(i, lod);
+			}
+			else
+				counters[level][2]++;
+
+			// Until two poses are held the palette keeps the newest one
+			if (interval > 1 && lod.KeyPoses == 2)
+				BlendKeyPoses(i, static_cast<float>(lod.Phase) / interval);
+
+			lod.Phase = (lod.Phase + 1) % interval;
+		}
+
+		for (int level = 0; level < m_NumLodLevels; level++)
+		{
+			for (int j = 0; j < 3; j++)
+				m_LodCounters[level][j].fetch_add(counters[level][j], std::memory_order_relaxed);
+		}
+	}
+
+
+public:
+
+	// Drops every instance
+	void SetModel(StudioModel* studioModel)
+	{
+		Clear();
+
+		m_StudioModel = studioModel;
+		m_NumBones = (studioModel && studioModel->GetStudioHeader()) ? studioModel->GetStudioHeader()->numbones : 0;
+
+		BuildRigidBones();
+	}
+
+
+	// Up to MaxLodLevels levels, nearest first. The default is a single level that
+	// evaluates every bone on every update.
+	void SetLodLevels(const LodLevel* levels, int count)
+	{
+		m_NumLodLevels = (std::max)(1, (std::min)(count, MaxLodLevels));
+		std::copy(levels, levels + m_NumLodLevels, m_LodLevels);
+
+		BuildRigidBones();
+
+		for (auto& lod : m_LodStates)
+			lod = LodState{ -1, 0, 0 };
+	}
+
+
+	void SetBoneKernel(BoneKernels::Kernel kernel)
+	{
+		m_BoneKernel = kernel;
+	}
+
+
+	// Instances in step then share evaluated poses; null evaluates every pose
+	void SetPoseCache(PoseCache* poseCache)
+	{
+		m_PoseCache = poseCache;
+	}
+
+
+	// Returns the index of the new instance. Palettes returned earlier may move.
+	size_t AddInstance(const Instance& instance)
+	{
+		m_Instances.push_back(instance);
+		m_LodStates.push_back(LodState{ -1, 0, 0 });
+		m_BonePalette.resize(m_Instances.size() * m_NumBones * 12);
+		m_KeyPoses.resize(m_Instances.size() * 2 * m_NumBones);
+
+		return m_Instances.size() - 1;
+	}
+
+
+	void Clear()
+	{
+		m_Instances.clear();
+		m_LodStates.clear();
+		m_BonePalette.clear();
+		m_KeyPoses.clear();
+	}
+
+
+	size_t GetInstanceCount() const
+	{
+		return m_Instances.size();
+	}
+
+
+	Instance& GetInstance(size_t instance)
+	{
+		return m_Instances[instance];
+	}
+
+
+	const Instance& GetInstance(size_t instance) const
+	{
+		return m_Instances[instance];
+	}
+
+
+	int GetBoneCount() const
+	{
+		return m_NumBones;
+	}
+
+
+	// The numbones transforms of one instance; the instances follow each other in one array
+	float (*GetBoneTransforms(size_t instance))[3][4]
+	{
+		return reinterpret_cast<float(*)[3][4]>(m_BonePalette.data() + instance * m_NumBones * 12);
+	}
+
+
+	const float (*GetBoneTransforms(size_t instance) const)[3][4]
+	{
+		return reinterpret_cast<const float(*)[3][4]>(m_BonePalette.data() + instance * m_NumBones * 12);
+	}
+
+
+	// Advances every instance by dt seconds times its playback rate and sets up its bones.
+	// Without workers the calling thread does all of it.
+	void Update(double dt, ThreadPool* workers)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		for (auto& level : m_LodCounters)
+		{
+			for (auto& counter : level)
+				counter.store(0, std::memory_order_relaxed);
+		}
+
+		size_t batches = (m_Instances.size() + BatchSize - 1) / BatchSize;
+
+		if (m_StudioModel && m_StudioModel->GetStudioHeader() && batches > 0)
+		{
+			if (workers)
+				workers->ParallelFor(batches, [this, dt](size_t batch) { UpdateBatch(batch, dt); });
+			else
+			{
+				for (size_t batch = 0; batch < batches; batch++)
+					UpdateBatch(batch, dt);
+			}
+		}
+
+		auto ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		m_Stats.Instances = m_Instances.size();
+		m_Stats.Batches = batches;
+		m_Stats.Threads = workers ? workers->GetThreadCount() + 1 : 1;
+		m_Stats.UpdateMilliseconds = ms;
+		m_Stats.InstancesPerMillisecond = ms > 0.0 ? m_Instances.size() / ms : 0.0;
+
+		for (int level = 0; level < MaxLodLevels; level++)
+		{
+			m_Stats.Lods[level].Instances = m_LodCounters[level][0].load(std::memory_order_relaxed);
+			m_Stats.Lods[level].Evaluations = m_LodCounters[level][1].load(std::memory_order_relaxed);
+			m_Stats.Lods[level].Interpolations = m_LodCounters[level][2].load(std::memory_order_relaxed);
+			m_Stats.Lods[level].RigidBones = m_RigidBoneCounts[level];
+		}
+	}
+
+
+	// Measured by the last Update
+	const Stats& GetStats() const
+	{
+		return m_Stats;
+	}
+
+
+	CrowdAnimation()
+		: m_StudioModel{}
+		, m_NumBones{}
+		, m_BoneKernel{ BoneKernels::GetDefaultKernel() }
+		, m_PoseCache{}
+		, m_LodLevels{}
+		, m_NumLodLevels{ 1 }
+		, m_RigidBoneCounts{}
+		, m_Stats{}
+	{
+		m_LodLevels[0] = LodLevel{ FLT_MAX, 1, 0 };
+	}
+
+
+	CrowdAnimation(const CrowdAnimation&) = delete;
+	CrowdAnimation& operator=(const CrowdAnimation&) = delete;
+
+
+private:
+
+	StudioModel* m_StudioModel;
+	int m_NumBones;
+	BoneKernels::Kernel m_BoneKernel;
+	PoseCache* m_PoseCache;
+	std::vector<Instance> m_Instances;
+	std::vector<LodState> m_LodStates;
+	std::vector<float> m_BonePalette; // m_NumBones * 3 * 4 floats per instance
+	std::vector<KeyBone> m_KeyPoses; // 2 * m_NumBones per instance, older first
+	LodLevel m_LodLevels[MaxLodLevels];
+	int m_NumLodLevels;
+	std::vector<uint8_t> m_RigidBones; // m_NumBones per level
+	size_t m_RigidBoneCounts[MaxLodLevels];
+	std::atomic<size_t> m_LodCounters[MaxLodLevels][3]; // instances, evaluations, interpolations
+	Stats m_Stats;
+};
@@ -0,0 +1,698 @@
+#pragma once
+
+#include "ThreadPool.hpp"
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <vector>
+#include <queue>
+#include <bit>
+#include <algorithm>
+
+
+// zlib streams (RFC 1950 and 1951) for the PNG writer. The input is cut into
+// chunks that are compressed on the pool, each ending on a byte boundary with an
+// empty stored block so the pieces can simply be joined, as pigz does. Matches
+// still reach back into the previous chunk, so splitting costs little ratio.
+// Matching is greedy on a short hash chain, with a dynamic Huffman code per
+// block, or a stored block where that is smaller.
+class Deflate
+{
+public:
+
+	static constexpr size_t DefaultChunkSize = 128 * 1024;
+
+
+private:
+
+	static constexpr size_t WindowSize = 32768;
+	static constexpr int HashBits = 15;
+	static constexpr int MaxChain = 8;
+	static constexpr int MinMatch = 4;
+	static constexpr int MaxMatch = 258;
+	static constexpr size_t BlockSymbols = 32768;
+	static constexpr int NumLiteralLengths = 286;
+	static constexpr int NumDistances = 30;
+	static constexpr int NumCodeLengths = 19;
+
+
+	struct Tables
+	{
+		uint16_t LengthBase[29];
+		uint8_t LengthExtra[29];
+		uint16_t DistanceBase[30];
+		uint8_t DistanceExtra[30];
+		uint8_t LengthCode[MaxMatch + 1]; // match length to its index in LengthBase
+		uint8_t DistanceCode[512]; // distance - 1 below 256, else 256 + ((distance - 1) >> 7), as in zlib
+		uint32_t Crc[256];
+	};
+
+
+	// A literal when Distance is 0, otherwise a match of Length bytes
+	struct Symbol
+	{
+		uint16_t Length;
+		uint16_t Distance;
+	};
+
+
+	// Bits go out least significant first
+	struct BitWriter
+	{
+		std::vector<uint8_t>& Out;
+		uint64_t Bits;
+		int Count;
+
+		void Put(uint32_t value, int bits)
+		{
+			Bits |= static_cast<uint64_t>(value) << Count;
+			Count += bits;
+
+			while (Count >= 8)
+			{
+				Out.push_back(static_cast<uint8_t>(Bits));
+				Bits >>= 8;
+				Count -= 8;
+			}
+		}
+
+		void Align()
+		{
+			if (Count > 0)
+				Out.push_back(static_cast<uint8_t>(Bits));
+
+			Bits = 0;
+			Count = 0;
+		}
+	};
+
+
+	static const Tables& GetTables()
+	{
+		static const Tables tables = []()
+		{
+			Tables t{};
+
+			static const uint16_t lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+			static const uint8_t lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+			static const uint16_t distanceBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+			static const uint8_t distanceExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+			memcpy(t.LengthBase, lengthBase, sizeof(lengthBase));
+			memcpy(t.LengthExtra, lengthExtra, sizeof(lengthExtra));
+			memcpy(t.DistanceBase, distanceBase, sizeof(distanceBase));
+			memcpy(t.DistanceExtra, distanceExtra, sizeof(distanceExtra));
+
+			for (int code = 0; code < 29; code++)
+			{
+				for (int length = lengthBase[code]; length < lengthBase[code] + (1 << lengthExtra[code]) && length <= MaxMatch; length++)
+					t.LengthCode[length] = static_cast<uint8_t>(code);
+			}
+
+			for (int code = 0; code < 30; code++)
+			{
+				for (int distance = distanceBase[code]; distance < distanceBase[code] + (1 << distanceExtra[code]); distance++)
+				{
+					int index = distance - 1 < 256 ? distance - 1 : 256 + ((distance - 1) >> 7);
+					t.DistanceCode[index] = static_cast<uint8_t>(code);
+				}
+			}
+
+			for (uint32_t i = 0; i < 256; i++)
+			{
+				uint32_t crc = i;
+
+				for (int k = 0; k < 8; k++)
+					crc = crc & 1 ? 0xEDB88320u ^ (crc >> 1) : crc >> 1;
+
+				t.Crc[i] = crc;
+			}
+
+			return t;
+		}();
+
+		return tables;
+	}
+
+
+	static int GetDistanceCode(const Tables& tables, int distance)
+	{
+		return tables.DistanceCode[distance - 1 < 256 ? distance - 1 : 256 + ((distance - 1) >> 7)];
+	}
+
+
+	// Huffman code lengths of at most maxBits. Frequencies are flattened until the
+	// tree fits, which only ever happens for very skewed blocks.
+	static void BuildLengths(const uint32_t* frequencies, int count, int maxBits, uint8_t* lengths)
+	{
+		std::vector<uint32_t> weights(frequencies, frequencies + count);
+		std::vector<uint64_t> nodeWeights(2 * count);
+		std::vector<int> parents(2 * count);
+		std::vector<int> depths(2 * count);
+
+		memset(lengths, 0, count);
+
+		while (true)
+		{
+			using Entry = std::pair<uint64_t, int>;
+			std::priority_queue<Entry, std::vector<Entry>, std::greater<Entry>> heap;
+
+			for (int i = 0; i < count; i++)
+			{
+				if (weights[i])
+					heap.emplace(weights[i], i);
+			}
+
+			if (heap.empty())
+				return;
+
+			// A lone symbol still needs a complete code of two one-bit codes
+			if (heap.size() == 1)
+			{
+				int symbol = heap.top().second;
+				lengths[symbol] = 1;
+				lengths[symbol == 0 ? 1 : 0] = 1;
+				return;
+			}
+
+			int next = count;
+
+			while (heap.size() > 1)
+			{
+				auto a = heap.top();
+				heap.pop();
+				auto b = heap.top();
+				heap.pop();
+
+				parents[a.second] = next;
+				parents[b.second] = next;
+				heap.emplace(a.first + b.first, next);
+				next++;
+			}
+
+			int root = next - 1;
+			int maxDepth = 0;
+
+			// Parents are created after their children, so walking down from the root
+			// sees every parent's depth before its children need it
+			for (int node = root; node >= 0; node--)
+			{
+				if (node >= count || weights[node])
+				{
+					depths[node] = node == root ? 0 : depths[parents[node]] + 1;
+
+					if (node < count)
+						maxDepth = (std::max)(maxDepth, depths[node]);
+				}
+			}
+
+			if (maxDepth <= maxBits)
+			{
+				for (int i = 0; i < count; i++)
+					lengths[i] = weights[i] ? static_cast<uint8_t>(depths[i]) : 0;
+
+				return;
+			}
+
+			for (auto& weight : weights)
+			{
+				if (weight)
+					weight = (weight >> 1) | 1;
+			}
+		}
+	}
+
+
+	// Canonical codes, bit reversed for the least significant first writer
+	static void BuildCodes(const uint8_t* lengths, int count, uint16_t* codes)
+	{
+		int lengthCounts[16]{};
+
+		for (int i = 0; i < count; i++)
+			lengthCounts[lengths[i]]++;
+
+		lengthCounts[0] = 0;
+
+		int nextCode[16]{};
+
+		for (int bits = 1, code = 0; bits < 16; bits++)
+		{
+			code = (code + lengthCounts[bits - 1]) << 1;
+			nextCode[bits] = code;
+		}
+
+		for (int i = 0; i < count; i++)
+		{
+			int length = lengths[i];
+
+			if (!length)
+				continue;
+
+			uint32_t code = nextCode[length]++;
+			uint32_t reversed = 0;
+
+			for (int bit = 0; bit < length; bit++)
+				reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+
+			codes[i] = static_cast<uint16_t>(reversed);
+		}
+	}
+
+
+	static void WriteStoredBlocks(BitWriter& out, const uint8_t* raw, size_t size, bool final)
+	{
+		do
+		{
+			size_t length = (std::min)(size, size_t{ 0xFFFF });
+			size -= length;
+
+			out.Put(final && size == 0 ? 1 : 0, 1);
+			out.Put(0, 2);
+			out.Align();
+			out.Put(static_cast<uint32_t>(length), 16);
+			out.Put(static_cast<uint32_t>(~length & 0xFFFF), 16);
+			out.Out.insert(out.Out.end(), raw, raw + length);
+
+			raw += length;
+		} while (size > 0);
+	}
+
+
+	// One block of symbols covering the raw bytes
+	static void WriteBlock(BitWriter& out, const std::vector<Symbol>& symbols, const uint8_t* raw, size_t rawSize, bool final)
+	{
+		const auto& tables = GetTables();
+
+		uint32_t literalFrequencies[NumLiteralLengths]{};
+		uint32_t distanceFrequencies[NumDistances]{};
+
+		for (const auto& symbol : symbols)
+		{
+			if (symbol.Distance == 0)
+				literalFrequencies[symbol.Length]++;
+			else
+			{
+				literalFrequencies[257 + tables.LengthCode[symbol.Length]]++;
+				distanceFrequencies[GetDistanceCode(tables, symbol.Distance)]++;
+			}
+		}
+
+		literalFrequencies[256] = 1;
+
+		uint8_t literalLengths[NumLiteralLengths];
+		uint8_t distanceLengths[NumDistances];
+		BuildLengths(literalFrequencies, NumLiteralLengths, 15, literalLengths);
+		BuildLengths(distanceFrequencies, NumDistances, 15, distanceLengths);
+
+		int numLiterals = NumLiteralLengths;
+		int numDistances = NumDistances;
+
+		while (numLiterals > 257 && literalLengths[numLiterals - 1] == 0)
+			numLiterals--;
+
+		while (numDistances > 1 && distanceLengths[numDistances - 1] == 0)
+			numDistances--;
+
+		// Both length lists, run length coded with 16 (repeat), 17 and 18 (zeros)
+		uint8_t allLengths[NumLiteralLengths + NumDistances];
+		memcpy(allLengths, literalLengths, numLiterals);
+		memcpy(allLengths + numLiterals, distanceLengths, numDistances);
+
+		int numLengths = numLiterals + numDistances;
+		std::vector<std::pair<uint8_t, uint8_t>> runs; // code length symbol, extra bits value
+		uint32_t codeLengthFrequencies[NumCodeLengths]{};
+
+		for (int i = 0; i < numLengths;)
+		{
+			int length = allLengths[i];
+			int run = 1;
+
+			while (i + run < numLengths && allLengths[i + run] == length)
+				run++;
+
+			i += run;
+
+			if (length == 0)
+			{
+				while (run >= 11)
+				{
+					int n = (std::min)(run, 138);
+					runs.emplace_back(18, static_cast<uint8_t>(n - 11));
+					run -= n;
+				}
+
+				if (run >= 3)
+				{
+					runs.emplace_back(17, static_cast<uint8_t>(run - 3));
+					run = 0;
+				}
+			}
+			else
+			{
+				runs.emplace_back(static_cast<uint8_t>(length), 0);
+				run--;
+
+				while (run >= 3)
+				{
+					int n = (std::min)(run, 6);
+					runs.emplace_back(16, static_cast<uint8_t>(n - 3));
+					run -= n;
+				}
+			}
+
+			for (; run > 0; run--)
+				runs.emplace_back(static_cast<uint8_t>(length), 0);
+		}
+
+		for (const auto& run : runs)
+			codeLengthFrequencies[run.first]++;
+
+		uint8_t codeLengthLengths[NumCodeLengths];
+		BuildLengths(codeLengthFrequencies, NumCodeLengths, 7, codeLengthLengths);
+
+		static const uint8_t codeLengthOrder[NumCodeLengths] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+		static const uint8_t runExtraBits[3] = { 2, 3, 7 };
+
+		int numCodeLengths = NumCodeLengths;
+
+		while (numCodeLengths > 4 && codeLengthLengths[codeLengthOrder[numCodeLengths - 1]] == 0)
+			numCodeLengths--;
+
+		uint64_t dynamicBits = 3 + 14 + 3 * numCodeLengths;
+
+		for (const auto& run : runs)
+			dynamicBits += codeLengthLengths[run.first] + (run.first >= 16 ? runExtraBits[run.first - 16] : 0);
+
+		for (int i = 0; i < NumLiteralLengths; i++)
+			dynamicBits += static_cast<uint64_t>(literalFrequencies[i]) * (literalLengths[i] + (i > 256 ? tables.LengthExtra[i - 257] : 0));
+
+		for (int i = 0; i < NumDistances; i++)
+			dynamicBits += static_cast<uint64_t>(distanceFrequencies[i]) * (distanceLengths[i] + tables.DistanceExtra[i]);
+
+		uint64_t storedBits = ((rawSize + 0xFFFE) / 0xFFFF + (rawSize == 0)) * (3 + 7 + 32) + rawSize * 8;
+
+		if (storedBits < dynamicBits)
+		{
+			WriteStoredBlocks(out, raw, rawSize, final);
+			return;
+		}
+
+		uint16_t literalCodes[NumLiteralLengths]{};
+		uint16_t distanceCodes[NumDistances]{};
+		uint16_t codeLengthCodes[NumCodeLengths]{};
+		BuildCodes(literalLengths, NumLiteralLengths, literalCodes);
+		BuildCodes(distanceLengths, NumDistances, distanceCodes);
+		BuildCodes(codeLengthLengths, NumCodeLengths, codeLengthCodes);
+
+		out.Put(final ? 1 : 0, 1);
+		out.Put(2, 2);
+		out.Put(numLiterals - 257, 5);
+		out.Put(numDistances - 1, 5);
+		out.Put(numCodeLengths - 4, 4);
+
+		for (int i = 0; i < numCodeLengths; i++)
+			out.Put(codeLengthLengths[codeLengthOrder[i]], 3);
+
+		for (const auto& run : runs)
+		{
+			out.Put(codeLengthCodes[run.first], codeLengthLengths[run.first]);
+
+			if (run.first >= 16)
+				out.Put(run.second, runExtraBits[run.first - 16]);
+		}
+
+		for (const auto& symbol : symbols)
+		{
+			if (symbol.Distance == 0)
+			{
+				out.Put(literalCodes[symbol.Length], literalLengths[symbol.Length]);
+				continue;
+			}
+
+			int lengthCode = tables.LengthCode[symbol.Length];
+			int distanceCode = GetDistanceCode(tables, symbol.Distance);
+
+			out.Put(literalCodes[257 + lengthCode], literalLengths[257 + lengthCode]);
+			out.Put(symbol.Length - tables.LengthBase[lengthCode], tables.LengthExtra[lengthCode]);
+			out.Put(distanceCodes[distanceCode], distanceLengths[distanceCode]);
+			out.Put(symbol.Distance - tables.DistanceBase[distanceCode], tables.DistanceExtra[distanceCode]);
+		}
+
+		out.Put(literalCodes[256], literalLengths[256]);
+	}
+
+
+	static uint32_t Hash(const uint8_t* p)
+	{
+		uint32_t value;
+		memcpy(&value, p, sizeof(value));
+
+		return (value * 2654435761u) >> (32 - HashBits);
+	}
+
+
+	static int MatchLength(const uint8_t* a, const uint8_t* b, int maxLength)
+	{
+		int length = 0;
+
+		while (length + 8 <= maxLength)
+		{
+			uint64_t x, y;
+			memcpy(&x, a + length, sizeof(x));
+			memcpy(&y, b + length, sizeof(y));
+
+			if (x != y)
+			{
+				if constexpr (std::endian::native == std::endian::little)
+					return length + std::countr_zero(x ^ y) / 8;
+				else
+					return length + std::countl_zero(x ^ y) / 8;
+			}
+
+			length += 8;
+		}
+
+		while (length < maxLength && a[length] == b[length])
+			length++;
+
+		return length;
+	}
+
+
+	// Compresses data[start, end) into out, ending on a byte boundary. Matches may
+	// reach back to windowStart. Unless final, ends with an empty stored block so
+	// the next chunk's output can follow directly.
+	static void CompressChunk(const uint8_t* data, size_t windowStart, size_t start, size_t end, bool final, std::vector<uint8_t>& out)
+	{
+		std::vector<int32_t> head(size_t{ 1 } << HashBits, -1);
+		std::vector<int32_t> previous(WindowSize);
+
+		// Positions relative to windowStart, previous as a ring over the window
+		auto insert = [&](size_t position)
+		{
+			auto hash = Hash(data + position);
+			auto relative = static_cast<int32_t>(position - windowStart);
+
+			previous[relative & (WindowSize - 1)] = head[hash];
+			head[hash] = relative;
+		};
+
+		for (size_t position = windowStart; position < start && position + MinMatch <= end; position++)
+			insert(position);
+
+		BitWriter writer{ out, 0, 0 };
+		std::vector<Symbol> symbols;
+		symbols.reserve(BlockSymbols);
+
+		size_t blockStart = start;
+		size_t position = start;
+
+		while (position < end)
+		{
+			int bestLength = 0;
+			int bestDistance = 0;
+
+			if (position + MinMatch <= end)
+			{
+				int maxLength = static_cast<int>((std::min)(end - position, size_t{ MaxMatch }));
+				int32_t candidate = head[Hash(data + position)];
+
+				for (int chain = 0; candidate >= 0 && chain < MaxChain; chain++)
+				{
+					size_t match = windowStart + candidate;
+					size_t distance = position - match;
+
+					if (distance > WindowSize)
+						break;
+
+					if (data[match + bestLength] == data[position + bestLength])
+					{
+						int length = MatchLength(data + match, data + position, maxLength);
+
+						if (length > bestLength)
+						{
+							bestLength = length;
+							bestDistance = static_cast<int>(distance);
+
+							if (length == maxLength)
+								break;
+						}
+					}
+
+					candidate = previous[candidate & (WindowSize - 1)];
+				}
+			}
+
+			if (bestLength >= MinMatch)
+			{
+				symbols.push_back(Symbol{ static_cast<uint16_t>(bestLength), static_cast<uint16_t>(bestDistance) });
+
+				for (size_t last = position + bestLength; position < last; position++)
+				{
+					if (position + MinMatch <= end)
+						insert(position);
+				}
+			}
+			else
+			{
+				symbols.push_back(Symbol{ data[position], 0 });
+
+				if (position + MinMatch <= end)
+					insert(position);
+
+				position++;
+			}
+
+			if (symbols.size() == BlockSymbols)
+			{
+				WriteBlock(writer, symbols, data + blockStart, position - blockStart, final && position == end);
+				symbols.clear();
+				blockStart = position;
+			}
+		}
+
+		// A final chunk ending exactly on a full block has already written its final block
+		if (!symbols.empty() || (final && start == end))
+			WriteBlock(writer, symbols, data + blockStart, position - blockStart, final);
+
+		if (!final)
+		{
+			writer.Put(0, 1);
+			writer.Put(0, 2);
+			writer.Align();
+			writer.Put(0, 16);
+			writer.Put(0xFFFF, 16);
+		}
+
+		writer.Align();
+	}
+
+
+public:
+
+	static uint32_t Adler32(const uint8_t* data, size_t size, uint32_t adler = 1)
+	{
+		uint32_t a = adler & 0xFFFF;
+		uint32_t b = adler >> 16;
+
+		while (size > 0)
+		{
+			// The largest run before b could overflow
+			size_t run = (std::min)(size, size_t{ 5552 });
+			size -= run;
+
+			for (size_t i = 0; i < run; i++)
+			{
+				a += data[i];
+				b += a;
+			}
+
+			data += run;
+			a %= 65521;
+			b %= 65521;
+		}
+
+		return a | (b << 16);
+	}
+
+
+	// Adler-32 of two pieces joined, from each piece's checksum and the second's length (zlib's adler32_combine)
+	static uint32_t Adler32Combine(uint32_t adler1, uint32_t adler2, size_t length2)
+	{
+		const uint32_t base = 65521;
+
+		uint32_t remainder = static_cast<uint32_t>(length2 % base);
+		uint32_t sum1 = adler1 & 0xFFFF;
+		uint32_t sum2 = static_cast<uint32_t>((static_cast<uint64_t>(remainder) * sum1) % base);
+
+		sum1 += (adler2 & 0xFFFF) + base - 1;
+		sum2 += ((adler1 >> 16) & 0xFFFF) + ((adler2 >> 16) & 0xFFFF) + base - remainder;
+
+		if (sum1 >= base)
+			sum1 -= base;
+		if (sum1 >= base)
+			sum1 -= base;
+		if (sum2 >= base << 1)
+			sum2 -= base << 1;
+		if (sum2 >= base)
+			sum2 -= base;
+
+		return sum1 | (sum2 << 16);
+	}
+
+
+	static uint32_t Crc32(const uint8_t* data, size_t size, uint32_t crc = 0)
+	{
+		const auto& table = GetTables().Crc;
+
+		crc = ~crc;
+
+		for (size_t i = 0; i < size; i++)
+			crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+
+		return ~crc;
+	}
+
+
+	// A complete zlib stream of data, its chunks compressed on workers if set
+	static std::vector<uint8_t> CompressZlib(const uint8_t* data, size_t size, ThreadPool* workers, size_t chunkSize = DefaultChunkSize)
+	{
+		chunkSize = (std::max)(chunkSize, size_t{ 1 });
+
+		size_t numChunks = (std::max)((size + chunkSize - 1) / chunkSize, size_t{ 1 });
+		std::vector<std::vector<uint8_t>> chunks(numChunks);
+		std::vector<uint32_t> checksums(numChunks);
+
+		auto compress = [&](size_t chunk)
+		{
+			size_t start = chunk * chunkSize;
+			size_t end = (std::min)(start + chunkSize, size);
+
+			CompressChunk(data, start > WindowSize ? start - WindowSize : 0, start, end, chunk + 1 == numChunks, chunks[chunk]);
+			checksums[chunk] = Adler32(data + start, end - start);
+		};
+
+		if (workers)
+			workers->ParallelFor(numChunks, compress);
+		else
+		{
+			for (size_t i = 0; i < numChunks; i++)
+				compress(i);
+		}
+
+		std::vector<uint8_t> stream = { 0x78, 0x01 };
+		uint32_t adler = 1;
+
+		for (size_t i = 0; i < numChunks; i++)
+		{
+			stream.insert(stream.end(), chunks[i].begin(), chunks[i].end());
+			adler = Adler32Combine(adler, checksums[i], (std::min)(chunkSize, size - i * chunkSize));
+		}
+
+		for (int shift = 24; shift >= 0; shift -= 8)
+			stream.push_back(static_cast<uint8_t>(adler >> shift));
+
+		return stream;
+	}
+};
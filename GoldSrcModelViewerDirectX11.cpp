@@ -1,7 +1,5 @@
 #include <Windows.h>
 #include <wrl/client.h>
-#include <atlbase.h>
-#include <wincodec.h> // For WIC
 #include <d3d11_1.h>
 #include <dxgi1_2.h>
 #include <DirectXMath.h>
@@ -10,6 +8,10 @@
 using Microsoft::WRL::ComPtr;
 
 #include "StudioModelRenderer.hpp"
+#include "BatchRenderer.hpp"
+#include "Benchmark.hpp"
+
+#include <cstdio>
 
 
 #ifdef _MSC_VER
@@ -283,8 +285,90 @@ static int RenderToBitmap()
 #endif
 
 
+// Report to the console we were started from, if any
+static void AttachParentConsole()
+{
+	if (AttachConsole(ATTACH_PARENT_PROCESS))
+	{
+		FILE* stream;
+		freopen_s(&stream, "CONOUT$", "w", stdout);
+		freopen_s(&stream, "CONOUT$", "w", stderr);
+	}
+}
+
+
+// GoldSrcModelViewerDirectX11.exe --batch manifest.txt, see BatchRenderer for the manifest
+static int RunBatch(const std::wstring& manifestPath)
+{
+	AttachParentConsole();
+
+	try
+	{
+		auto jobs = BatchRenderer::LoadManifest(manifestPath);
+
+		// Encoding the previous images while the lanes render the next, each PNG also
+		// spread over the pool
+		ImageEncodeQueue encoder((std::max)(1u, std::thread::hardware_concurrency() / 2), &ThreadPool::GetDefault());
+
+		auto report = BatchRenderer::Run(jobs, &ThreadPool::GetDefault(), &encoder);
+
+		for (const auto& error : report.Errors)
+			fprintf(stderr, "%s\n", error.c_str());
+
+		printf("%zu models (%zu failed), %zu jobs (%zu failed), %zu images and %zu videos of %zu frames in %.2f s, %.1f models/s\n",
+			report.Models, report.FailedModels, report.Jobs, report.FailedJobs, report.Images, report.Videos, report.Frames, report.Seconds, report.GetModelsPerSecond());
+
+		const auto& encoding = report.Encoding;
+
+		printf("encoded %zu images (%zu failed), %zu bytes: %.2f s encoding, %.2f s writing, %.2f s waiting for the encoder\n",
+			encoding.Images, encoding.Failed, encoding.Bytes, encoding.EncodeSeconds, encoding.WriteSeconds, encoding.StallSeconds);
+
+		return report.Errors.empty() ? 0 : EXIT_FAILURE;
+	}
+	catch (const std::exception& e)
+	{
+		fprintf(stderr, "%s\n", e.what());
+		return EXIT_FAILURE;
+	}
+}
+
+
+// GoldSrcModelViewerDirectX11.exe --bench model.mdl [suite ...], see Benchmark for the suites
+static int RunBenchmark(const std::vector<std::wstring>& args)
+{
+	AttachParentConsole();
+
+	try
+	{
+		Benchmark::Settings settings;
+
+		settings.Model = args[2];
+
+		for (size_t i = 3; i < args.size(); i++)
+			settings.Suites.push_back(UnicodeToAnsi(args[i]));
+
+		Benchmark::Run(settings);
+
+		return 0;
+	}
+	catch (const std::exception& e)
+	{
+		fprintf(stderr, "%s\n", e.what());
+		return EXIT_FAILURE;
+	}
+}
+
+
 int WINAPI wWinMain(_In_ HINSTANCE hInstance, _In_opt_ HINSTANCE hPrevInstance, _In_ LPWSTR lpCmdLine, _In_ int nShowCmd)
 {
+	auto args = ParseCommandLine();
+
+	if (args.size() == 3 && args[1] == L"--batch")
+		return RunBatch(args[2]);
+
+	if (args.size() >= 3 && args[1] == L"--bench")
+		return RunBenchmark(args);
+
 #ifndef RENDER_TO_BITMAP
 	return CreateRendererWindow(hInstance, nShowCmd);
 #else
@@ -716,69 +800,15 @@ void SaveImage()
 	if (FAILED(hr))
 		return;
 
-	hr = CoInitialize(NULL);
-	if (FAILED(hr))
-		return;
+	// R8G8B8A8, which is the byte order ImageWriter reads, but rows may be padded
+	std::vector<uint32_t> pixels(static_cast<size_t>(SCREEN_WIDTH) * SCREEN_HEIGHT);
 
-	CComPtr<IWICImagingFactory> factory;
-	hr = factory.CoCreateInstance(CLSID_WICImagingFactory, NULL, CLSCTX_INPROC_SERVER);
-	if (FAILED(hr))
-		return;
-
-	CComPtr<IWICBitmap> wicBitmap;
-	hr = factory->CreateBitmapFromMemory(
-		SCREEN_WIDTH,
-		SCREEN_HEIGHT,
-		GUID_WICPixelFormat32bppRGBA,
-		mappedResource.RowPitch,
-		mappedResource.DepthPitch,
-		reinterpret_cast<BYTE*>(mappedResource.pData),
-		&wicBitmap);
-
-	if (FAILED(hr))
-		return;
+	for (UINT y = 0; y < SCREEN_HEIGHT; y++)
+		memcpy(pixels.data() + static_cast<size_t>(y) * SCREEN_WIDTH, reinterpret_cast<const BYTE*>(mappedResource.pData) + static_cast<size_t>(y) * mappedResource.RowPitch, SCREEN_WIDTH * sizeof(uint32_t));
 
 	g_D3DDeviceContext->Unmap(g_BufferTexture.Get(), resourceId);
 
-	CComPtr<IWICStream> wicStream;
-	CComPtr<IWICBitmapEncoder> wicBitmapEncoder;
-	CComPtr<IWICBitmapFrameEncode> wicBitmapFrameEncode;
-
-	hr = factory->CreateStream(&wicStream);
-	if (FAILED(hr))
-		return;
-
-	hr = wicStream->InitializeFromFilename(L"output.png", GENERIC_WRITE);
-	if (FAILED(hr))
-		return;
-
-	hr = factory->CreateEncoder(GUID_ContainerFormatPng, nullptr, &wicBitmapEncoder);
-	if (FAILED(hr))
-		return;
-
-	hr = wicBitmapEncoder->Initialize(wicStream, WICBitmapEncoderNoCache);
-	if (FAILED(hr))
-		return;
-
-	hr = wicBitmapEncoder->CreateNewFrame(&wicBitmapFrameEncode, NULL);
-	if (FAILED(hr))
-		return;
-
-	hr = wicBitmapFrameEncode->Initialize(NULL);
-	if (FAILED(hr))
-		return;
-
-	hr = wicBitmapFrameEncode->WriteSource(wicBitmap, NULL);
-	if (FAILED(hr))
-		return;
-
-	hr = wicBitmapFrameEncode->Commit();
-	if (FAILED(hr))
-		return;
-
-	hr = wicBitmapEncoder->Commit();
-	if (FAILED(hr))
-		return;
+	ImageWriter::Write(L"output.png", pixels.data(), static_cast<int>(SCREEN_WIDTH), static_cast<int>(SCREEN_HEIGHT), &ThreadPool::GetDefault());
 }
 
 #endif
@@ -789,6 +819,14 @@ void LoadModel()
 	g_d3dStudioModelRenderer = std::make_unique<D3DStudioModelRenderer>();
 	g_d3dStudioModelRenderer->Init(g_D3DDevice.Get(), g_D3DDeviceContext.Get());
 
+	StudioModel::LoadOptions options{};
+	options.Workers = &ThreadPool::GetDefault();
+	options.OptimizeVertexCache = true;
+	options.OptimizeOverdraw = true;
+
 	g_d3dStudioModel = std::make_unique<D3DStudioModel>();
-	g_d3dStudioModel->Load(g_D3DDevice.Get(), L"topol1.mdl");
+	g_d3dStudioModel->Load(g_D3DDevice.Get(), L"topol1.mdl", options);
+
+	if (g_d3dStudioModel->GetStudioModel())
+		g_d3dStudioModel->GetStudioModel()->SetDecodedSequenceCacheBudget(16 * 1024 * 1024);
 }
@@ -0,0 +1,637 @@
+#pragma once
+
+#include "Deflate.hpp"
+#include "ThreadPool.hpp"
+
+#include <cstdint>
+#include <cstddef>
+#include <cstdlib>
+#include <cctype>
+#include <string>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <chrono>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define IMAGE_WRITER_X86
+#include <emmintrin.h>
+#endif
+
+
+// Saves RGBA8 pixels as the renderers produce them, R in the lowest byte, top row
+// first. Alpha is not written: the blend state leaves zero alpha wherever the model
+// was drawn, so it says nothing about coverage.
+class ImageWriter
+{
+public:
+
+	enum class Format
+	{
+		Tga,
+		Png,
+		Qoi, // lossless and several times faster to write than PNG, for intermediate frames
+	};
+
+
+private:
+
+	static void AppendBigEndian(std::vector<uint8_t>& out, uint32_t value)
+	{
+		for (int shift = 24; shift >= 0; shift -= 8)
+			out.push_back(static_cast<uint8_t>(value >> shift));
+	}
+
+
+	static void AppendPngChunk(std::vector<uint8_t>& out, const char* type, const uint8_t* data, size_t size)
+	{
+		AppendBigEndian(out, static_cast<uint32_t>(size));
+
+		size_t start = out.size();
+		out.insert(out.end(), type, type + 4);
+		out.insert(out.end(), data, data + size);
+
+		AppendBigEndian(out, Deflate::Crc32(out.data() + start, out.size() - start));
+	}
+
+
+	// Without branches, which mispredict on most images
+	static int Paeth(int a, int b, int c)
+	{
+		int pa = abs(b - c);
+		int pb = abs(a - c);
+		int pc = abs(a + b - 2 * c);
+
+		int bc = pb <= pc ? b : c;
+
+		return pa <= pb && pa <= pc ? a : bc;
+	}
+
+
+	template<int Filter>
+	static int PredictPng(int left, int up, int upLeft)
+	{
+		if constexpr (Filter == 1)
+			return left;
+		else if constexpr (Filter == 2)
+			return up;
+		else if constexpr (Filter == 3)
+			return (left + up) >> 1;
+		else if constexpr (Filter == 4)
+			return Paeth(left, up, upLeft);
+		else
+			return 0;
+	}
+
+
+	// Filters a row of 3-byte pixels and returns the sum of the absolute values of
+	// the results as signed bytes
+	template<int Filter>
+	static uint32_t FilterPngRow(const uint8_t* row, const uint8_t* prior, size_t size, uint8_t* out)
+	{
+		uint32_t sum = 0;
+
+		auto put = [&](size_t i, int predicted)
+		{
+			auto value = static_cast<uint8_t>(row[i] - predicted);
+
+			out[i] = value;
+			sum += value < 128 ? value : 256 - value;
+		};
+
+		for (size_t i = 0; i < (std::min)(size, size_t{ 3 }); i++)
+			put(i, PredictPng<Filter>(0, prior[i], 0));
+
+		size_t i = 3;
+
+#ifdef IMAGE_WRITER_X86
+		// Eight bytes at a time in 16-bit lanes
+		__m128i zero = _mm_setzero_si128();
+		__m128i sums = zero;
+
+		auto load = [zero](const uint8_t* bytes)
+		{
+			return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(bytes)), zero);
+		};
+
+		auto absolute = [zero](__m128i x)
+		{
+			return _mm_max_epi16(x, _mm_sub_epi16(zero, x));
+		};
+
+		for (; i + 8 <= size; i += 8)
+		{
+			__m128i left = load(row + i - 3);
+			__m128i up = load(prior + i);
+			__m128i upLeft = load(prior + i - 3);
+			__m128i predicted = zero;
+
+			if constexpr (Filter == 1)
+				predicted = left;
+			else if constexpr (Filter == 2)
+				predicted = up;
+			else if constexpr (Filter == 3)
+				predicted = _mm_srli_epi16(_mm_add_epi16(left, up), 1);
+			else if constexpr (Filter == 4)
+			{
+				__m128i pa = absolute(_mm_sub_epi16(up, upLeft));
+				__m128i pb = absolute(_mm_sub_epi16(left, upLeft));
+				__m128i pc = absolute(_mm_sub_epi16(_mm_add_epi16(left, up), _mm_add_epi16(upLeft, upLeft)));
+
+				__m128i useC = _mm_cmpgt_epi16(pb, pc);
+				__m128i bc = _mm_or_si128(_mm_and_si128(useC, upLeft), _mm_andnot_si128(useC, up));
+				__m128i notA = _mm_or_si128(_mm_cmpgt_epi16(pa, pb), _mm_cmpgt_epi16(pa, pc));
+
+				predicted = _mm_or_si128(_mm_and_si128(notA, bc), _mm_andnot_si128(notA, left));
+			}
+
+			__m128i difference = _mm_and_si128(_mm_sub_epi16(load(row + i), predicted), _mm_set1_epi16(0xFF));
+			__m128i values = _mm_packus_epi16(difference, difference);
+
+			_mm_storel_epi64(reinterpret_cast<__m128i*>(out + i), values);
+
+			// As signed bytes, |v| is the smaller of v and 256 - v
+			__m128i magnitudes = _mm_min_epu8(values, _mm_sub_epi8(zero, values));
+			sums = _mm_add_epi64(sums, _mm_sad_epu8(_mm_unpacklo_epi64(magnitudes, zero), zero));
+		}
+
+		sum += static_cast<uint32_t>(_mm_cvtsi128_si32(sums));
+#endif
+
+		for (; i < size; i++)
+			put(i, PredictPng<Filter>(row[i - 3], prior[i], prior[i - 3]));
+
+		return sum;
+	}
+
+
+	// Writes the filter type byte and the filtered row, choosing the filter with the
+	// smallest sum of absolute differences as libpng does. prior is all zeros for the
+	// top row; candidate has room for a row.
+	static void FilterPngRow(const uint8_t* row, const uint8_t* prior, size_t size, uint8_t* out, uint8_t* candidate)
+	{
+		static constexpr uint32_t (*filters[])(const uint8_t*, const uint8_t*, size_t, uint8_t*) =
+		{
+			FilterPngRow<0>, FilterPngRow<1>, FilterPngRow<2>, FilterPngRow<3>, FilterPngRow<4>,
+		};
+
+		uint32_t bestSum = filters[0](row, prior, size, out + 1);
+		out[0] = 0;
+
+		for (uint8_t filter = 1; filter < 5; filter++)
+		{
+			uint32_t sum = filters[filter](row, prior, size, candidate);
+
+			if (sum < bestSum)
+			{
+				bestSum = sum;
+				out[0] = filter;
+				std::copy_n(candidate, size, out + 1);
+			}
+		}
+	}
+
+
+	template<typename Body>
+	static void ForEach(ThreadPool* workers, size_t count, Body&& body)
+	{
+		if (workers)
+			workers->ParallelFor(count, body);
+		else
+		{
+			for (size_t i = 0; i < count; i++)
+				body(i);
+		}
+	}
+
+
+public:
+
+	// From the file extension; false if it is not one we write
+	static bool GetFormat(const std::filesystem::path& path, Format& format)
+	{
+		auto extension = path.extension().wstring();
+
+		std::transform(extension.begin(), extension.end(), extension.begin(), [](int c) { return std::tolower(c); });
+
+		if (extension == L".tga")
+			format = Format::Tga;
+		else if (extension == L".png")
+			format = Format::Png;
+		else if (extension == L".qoi")
+			format = Format::Qoi;
+		else
+			return false;
+
+		return true;
+	}
+
+
+	// Uncompressed 24-bit true color, top-left origin
+	static std::vector<uint8_t> EncodeTga(const uint32_t* pixels, int width, int height)
+	{
+		if (width <= 0 || height <= 0 || width > 0xFFFF || height > 0xFFFF)
+			return {};
+
+		std::vector<uint8_t> file(18 + static_cast<size_t>(width) * height * 3);
+
+		file[2] = 2; // uncompressed true color
+		file[12] = static_cast<uint8_t>(width);
+		file[13] = static_cast<uint8_t>(width >> 8);
+		file[14] = static_cast<uint8_t>(height);
+		file[15] = static_cast<uint8_t>(height >> 8);
+		file[16] = 24;
+		file[17] = 0x20; // top row first
+
+		auto out = file.data() + 18;
+
+		for (size_t i = 0; i < static_cast<size_t>(width) * height; i++)
+		{
+			*out++ = static_cast<uint8_t>(pixels[i] >> 16);
+			*out++ = static_cast<uint8_t>(pixels[i] >> 8);
+			*out++ = static_cast<uint8_t>(pixels[i]);
+		}
+
+		return file;
+	}
+
+
+	// 8-bit RGB. Rows are filtered in bands and the filtered image is deflated in
+	// chunks, both on workers if set.
+	static std::vector<uint8_t> EncodePng(const uint32_t* pixels, int width, int height, ThreadPool* workers = nullptr)
+	{
+		if (width <= 0 || height <= 0)
+			return {};
+
+		size_t rowSize = static_cast<size_t>(width) * 3;
+		size_t numRows = static_cast<size_t>(height);
+
+		std::vector<uint8_t> rgb(rowSize * numRows);
+		std::vector<uint8_t> filtered((rowSize + 1) * numRows);
+
+		// Bands of roughly 64 KB
+		size_t bandRows = (std::max)(size_t{ 65536 } / rowSize, size_t{ 1 });
+		size_t numBands = (numRows + bandRows - 1) / bandRows;
+
+		ForEach(workers, numBands, [&](size_t band)
+		{
+			size_t last = (std::min)((band + 1) * bandRows, numRows);
+
+			for (size_t i = band * bandRows * width; i < last * width; i++)
+			{
+				rgb[i * 3 + 0] = static_cast<uint8_t>(pixels[i]);
+				rgb[i * 3 + 1] = static_cast<uint8_t>(pixels[i] >> 8);
+				rgb[i * 3 + 2] = static_cast<uint8_t>(pixels[i] >> 16);
+			}
+		});
+
+		std::vector<uint8_t> zeros(rowSize);
+
+		ForEach(workers, numBands, [&](size_t band)
+		{
+			std::vector<uint8_t> candidate(rowSize);
+
+			for (size_t y = band * bandRows; y < (std::min)((band + 1) * bandRows, numRows); y++)
+				FilterPngRow(rgb.data() + y * rowSize, y > 0 ? rgb.data() + (y - 1) * rowSize : zeros.data(), rowSize, filtered.data() + y * (rowSize + 1), candidate.data());
+		});
+
+		auto stream = Deflate::CompressZlib(filtered.data(), filtered.size(), workers);
+
+		static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+
+		std::vector<uint8_t> file(signature, signature + 8);
+		file.reserve(stream.size() + 64);
+
+		std::vector<uint8_t> header;
+		AppendBigEndian(header, static_cast<uint32_t>(width));
+		AppendBigEndian(header, static_cast<uint32_t>(height));
+		header.insert(header.end(), { 8, 2, 0, 0, 0 }); // 8 bits, RGB, deflate, adaptive filters, not interlaced
+
+		AppendPngChunk(file, "IHDR", header.data(), header.size());
+		AppendPngChunk(file, "IDAT", stream.data(), stream.size());
+		AppendPngChunk(file, "IEND", nullptr, 0);
+
+		return file;
+	}
+
+
+	// "Quite OK Image" format, RGB channels, https://qoiformat.org
+	static std::vector<uint8_t> EncodeQoi(const uint32_t* pixels, int width, int height)
+	{
+		if (width <= 0 || height <= 0)
+			return {};
+
+		std::vector<uint8_t> file = { 'q', 'o', 'i', 'f' };
+		AppendBigEndian(file, static_cast<uint32_t>(width));
+		AppendBigEndian(file, static_cast<uint32_t>(height));
+		file.push_back(3); // RGB
+		file.push_back(0); // sRGB
+
+		size_t count = static_cast<size_t>(width) * height;
+		file.reserve(file.size() + count * 4 + 8);
+
+		// Alpha is always opaque, as in the previous pixel the format starts from
+		uint32_t index[64]{};
+		uint32_t previous = 0xFF000000;
+		int run = 0;
+
+		for (size_t i = 0; i < count; i++)
+		{
+			uint32_t pixel = pixels[i] | 0xFF000000;
+
+			if (pixel == previous)
+			{
+				if (++run == 62 || i + 1 == count)
+				{
+					file.push_back(static_cast<uint8_t>(0xC0 | (run - 1)));
+					run = 0;
+				}
+
+				continue;
+			}
+
+			if (run > 0)
+			{
+				file.push_back(static_cast<uint8_t>(0xC0 | (run - 1)));
+				run = 0;
+			}
+
+			int r = pixel & 0xFF;
+			int g = (pixel >> 8) & 0xFF;
+			int b = (pixel >> 16) & 0xFF;
+			int hash = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+
+			if (index[hash] == pixel)
+				file.push_back(static_cast<uint8_t>(hash));
+			else
+			{
+				index[hash] = pixel;
+
+				auto dr = static_cast<int8_t>(r - static_cast<int>(previous & 0xFF));
+				auto dg = static_cast<int8_t>(g - static_cast<int>((previous >> 8) & 0xFF));
+				auto db = static_cast<int8_t>(b - static_cast<int>((previous >> 16) & 0xFF));
+				int drg = dr - dg;
+				int dbg = db - dg;
+
+				if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1)
+					file.push_back(static_cast<uint8_t>(0x40 | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+				else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7)
+				{
+					file.push_back(static_cast<uint8_t>(0x80 | (dg + 32)));
+					file.push_back(static_cast<uint8_t>((drg + 8) << 4 | (dbg + 8)));
+				}
+				else
+					file.insert(file.end(), { 0xFE, static_cast<uint8_t>(r), static_cast<uint8_t>(g), static_cast<uint8_t>(b) });
+			}
+
+			previous = pixel;
+		}
+
+		file.insert(file.end(), { 0, 0, 0, 0, 0, 0, 0, 1 });
+
+		return file;
+	}
+
+
+	static std::vector<uint8_t> Encode(Format format, const uint32_t* pixels, int width, int height, ThreadPool* workers = nullptr)
+	{
+		switch (format)
+		{
+			case Format::Tga: return EncodeTga(pixels, width, height);
+			case Format::Png: return EncodePng(pixels, width, height, workers);
+			case Format::Qoi: return EncodeQoi(pixels, width, height);
+		}
+
+		return {};
+	}
+
+
+	// Creates the parent directories as needed
+	static bool WriteFile(const std::filesystem::path& path, const std::vector<uint8_t>& data)
+	{
+		std::error_code error;
+
+		if (path.has_parent_path())
+			std::filesystem::create_directories(path.parent_path(), error);
+
+		std::ofstream file(path, std::ios::binary | std::ios::trunc);
+
+		if (!file)
+			return false;
+
+		file.write(reinterpret_cast<const char*>(data.data()), static_cast<std::streamsize>(data.size()));
+
+		return static_cast<bool>(file);
+	}
+
+
+	// In the format the extension names; false if it names none or the file cannot be written
+	static bool Write(const std::filesystem::path& path, const uint32_t* pixels, int width, int height, ThreadPool* workers = nullptr)
+	{
+		Format format;
+
+		if (!GetFormat(path, format))
+			return false;
+
+		auto data = Encode(format, pixels, width, height, workers);
+
+		return !data.empty() && WriteFile(path, data);
+	}
+};
+
+
+// Encodes and writes images on background threads, so that whoever produces them
+// can render the next one meanwhile. Push blocks while the queue is full, which
+// bounds the pixels held in memory.
+class ImageEncodeQueue
+{
+public:
+
+	struct Stats
+	{
+		size_t Images; // written
+		size_t Failed;
+		size_t Bytes; // of the files written
+		double EncodeSeconds; // summed over the images, so may exceed the wall time
+		double WriteSeconds;
+		double StallSeconds; // Push waited for room, summed over the threads pushing
+		size_t MaxQueued; // most images waiting at once
+	};
+
+
+private:
+
+	struct Item
+	{
+		std::filesystem::path Path;
+		std::vector<uint32_t> Pixels;
+		int Width;
+		int Height;
+	};
+
+
+	void ThreadMain()
+	{
+		while (true)
+		{
+			Item item;
+
+			{
+				std::unique_lock<std::mutex> lock(m_Mutex);
+
+				m_ItemAvailable.wait(lock, [this]() { return m_Stopping || !m_Items.empty(); });
+
+				// Stopping only once the queue is drained
+				if (m_Items.empty())
+					return;
+
+				item = std::move(m_Items.front());
+				m_Items.pop_front();
+				m_Active++;
+			}
+
+			m_SpaceAvailable.notify_one();
+
+			auto start = std::chrono::steady_clock::now();
+
+			ImageWriter::Format format;
+			std::vector<uint8_t> data;
+
+			if (ImageWriter::GetFormat(item.Path, format))
+				data = ImageWriter::Encode(format, item.Pixels.data(), item.Width, item.Height, m_Workers);
+
+			auto encoded = std::chrono::steady_clock::now();
+			bool written = !data.empty() && ImageWriter::WriteFile(item.Path, data);
+			auto end = std::chrono::steady_clock::now();
+
+			{
+				std::lock_guard<std::mutex> lock(m_Mutex);
+
+				m_Stats.EncodeSeconds += std::chrono::duration<double>(encoded - start).count();
+				m_Stats.WriteSeconds += std::chrono::duration<double>(end - encoded).count();
+
+				if (written)
+				{
+					m_Stats.Images++;
+					m_Stats.Bytes += data.size();
+				}
+				else
+				{
+					m_Stats.Failed++;
+					m_Errors.push_back("cannot write " + item.Path.string());
+				}
+
+				m_Active--;
+			}
+
+			m_Idle.notify_all();
+		}
+	}
+
+
+public:
+
+	// Takes over pixels, width * height of them as ImageWriter reads them
+	void Push(std::filesystem::path path, std::vector<uint32_t> pixels, int width, int height)
+	{
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+
+			if (m_Items.size() >= m_MaxQueued)
+			{
+				auto start = std::chrono::steady_clock::now();
+
+				m_SpaceAvailable.wait(lock, [this]() { return m_Items.size() < m_MaxQueued; });
+
+				m_Stats.StallSeconds += std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			}
+
+			m_Items.push_back(Item{ std::move(path), std::move(pixels), width, height });
+			m_Stats.MaxQueued = (std::max)(m_Stats.MaxQueued, m_Items.size());
+		}
+
+		m_ItemAvailable.notify_one();
+	}
+
+
+	// Returns when every image pushed so far has been written or has failed
+	void Wait()
+	{
+		std::unique_lock<std::mutex> lock(m_Mutex);
+
+		m_Idle.wait(lock, [this]() { return m_Items.empty() && m_Active == 0; });
+	}
+
+
+	Stats GetStats()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		return m_Stats;
+	}
+
+
+	// Messages about the images that failed since the last call
+	std::vector<std::string> TakeErrors()
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+
+		std::vector<std::string> errors;
+		errors.swap(m_Errors);
+
+		return errors;
+	}
+
+
+	// threads encode whole images; workers, if set, also take bands and chunks of
+	// each PNG. maxQueued of 0 allows two waiting images per thread.
+	explicit ImageEncodeQueue(unsigned threads, ThreadPool* workers = nullptr, size_t maxQueued = 0)
+		: m_Workers{ workers }
+		, m_MaxQueued{ maxQueued ? maxQueued : 2 * static_cast<size_t>((std::max)(threads, 1u)) }
+		, m_Active{}
+		, m_Stopping{}
+		, m_Stats{}
+	{
+		for (unsigned i = 0; i < (std::max)(threads, 1u); i++)
+			m_Threads.emplace_back(&ImageEncodeQueue::ThreadMain, this);
+	}
+
+
+	ImageEncodeQueue(const ImageEncodeQueue&) = delete;
+	ImageEncodeQueue& operator=(const ImageEncodeQueue&) = delete;
+
+
+	// Finishes the images still queued
+	~ImageEncodeQueue()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stopping = true;
+		}
+
+		m_ItemAvailable.notify_all();
+
+		for (auto& thread : m_Threads)
+			thread.join();
+	}
+
+
+private:
+
+	ThreadPool* m_Workers;
+	size_t m_MaxQueued;
+	std::vector<std::thread> m_Threads;
+	std::deque<Item> m_Items;
+	size_t m_Active; // taken off the queue, not finished
+	bool m_Stopping;
+	Stats m_Stats;
+	std::vector<std::string> m_Errors;
+	std::mutex m_Mutex;
+	std::condition_variable m_ItemAvailable;
+	std::condition_variable m_SpaceAvailable;
+	std::condition_variable m_Idle;
+};
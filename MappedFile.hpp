@@ -0,0 +1,229 @@
+#pragma once
+
+#ifdef _WIN32
+#include <Windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <filesystem>
+
+
+// The whole contents of a file. The file is mapped copy-on-write when the
+// platform allows it, so the bytes come straight from the OS page cache;
+// otherwise it is read into a private buffer as before.
+class MappedFile
+{
+private:
+
+	bool Map(const std::wstring& filePath)
+	{
+#ifdef _WIN32
+		HANDLE file = CreateFileW(filePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+
+		if (file == INVALID_HANDLE_VALUE)
+			return false;
+
+		LARGE_INTEGER fileSize{};
+
+		if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart <= 0 || static_cast<uint64_t>(fileSize.QuadPart) > SIZE_MAX)
+		{
+			CloseHandle(file);
+			return false;
+		}
+
+		HANDLE mapping = CreateFileMappingW(file, nullptr, PAGE_WRITECOPY, 0, 0, nullptr);
+
+		CloseHandle(file);
+
+		if (!mapping)
+			return false;
+
+		// The view keeps the mapping alive on its own
+		void* view = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, 0);
+
+		CloseHandle(mapping);
+
+		if (!view)
+			return false;
+
+		m_Data = static_cast<uint8_t*>(view);
+		m_Size = static_cast<size_t>(fileSize.QuadPart);
+#else
+		int file = open(std::filesystem::path(filePath).c_str(), O_RDONLY);
+
+		if (file < 0)
+			return false;
+
+		struct stat fileStat{};
+
+		if (fstat(file, &fileStat) != 0 || fileStat.st_size <= 0)
+		{
+			close(file);
+			return false;
+		}
+
+		void* view = mmap(nullptr, static_cast<size_t>(fileStat.st_size), PROT_READ | PROT_WRITE, MAP_PRIVATE, file, 0);
+
+		close(file);
+
+		if (view == MAP_FAILED)
+			return false;
+
+		m_Data = static_cast<uint8_t*>(view);
+		m_Size = static_cast<size_t>(fileStat.st_size);
+#endif
+
+		m_Mapped = true;
+
+		return true;
+	}
+
+
+	bool Read(const std::wstring& filePath)
+	{
+		std::ifstream file(std::filesystem::path(filePath), std::ios::binary);
+
+		if (!file)
+			return false;
+
+		file.seekg(0, std::ios::end);
+		size_t file_size = file.tellg();
+		file.seekg(0, std::ios::beg);
+
+		m_Buffer.resize(file_size);
+		file.read(reinterpret_cast<char*>(m_Buffer.data()), file_size);
+
+		if (!file)
+		{
+			m_Buffer.clear();
+			return false;
+		}
+
+		m_Data = m_Buffer.data();
+		m_Size = m_Buffer.size();
+
+		return true;
+	}
+
+
+public:
+
+	// Returns false if the file could not be opened or is empty
+	bool Open(const std::wstring& filePath, bool allowMapping = true)
+	{
+		Close();
+
+		if (allowMapping && Map(filePath))
+			return true;
+
+		return Read(filePath) && m_Size > 0;
+	}
+
+
+	void Close()
+	{
+		if (m_Mapped)
+		{
+#ifdef _WIN32
+			UnmapViewOfFile(m_Data);
+#else
+			munmap(m_Data, m_Size);
+#endif
+		}
+
+		m_Buffer.clear();
+		m_Buffer.shrink_to_fit();
+
+		m_Data = nullptr;
+		m_Size = 0;
+		m_Mapped = false;
+	}
+
+
+	uint8_t* GetData() const
+	{
+		return m_Data;
+	}
+
+
+	size_t GetSize() const
+	{
+		return m_Size;
+	}
+
+
+	bool IsEmpty() const
+	{
+		return m_Size == 0;
+	}
+
+
+	bool IsMapped() const
+	{
+		return m_Mapped;
+	}
+
+
+	MappedFile()
+		: m_Data{}
+		, m_Size{}
+		, m_Mapped{}
+	{
+	}
+
+
+	MappedFile(MappedFile&& other) noexcept
+		: m_Data{}
+		, m_Size{}
+		, m_Mapped{}
+	{
+		*this = std::move(other);
+	}
+
+
+	MappedFile& operator=(MappedFile&& other) noexcept
+	{
+		if (this != &other)
+		{
+			Close();
+
+			// Moving the vector keeps its storage, so m_Data stays valid
+			this->m_Buffer = std::move(other.m_Buffer);
+			this->m_Data = other.m_Data;
+			this->m_Size = other.m_Size;
+			this->m_Mapped = other.m_Mapped;
+
+			other.m_Data = nullptr;
+			other.m_Size = 0;
+			other.m_Mapped = false;
+		}
+
+		return *this;
+	}
+
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+
+	~MappedFile()
+	{
+		Close();
+	}
+
+
+private:
+
+	uint8_t* m_Data;
+	size_t m_Size;
+	bool m_Mapped;
+	std::vector<uint8_t> m_Buffer;
+};
@@ -0,0 +1,396 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cmath>
+#include <vector>
+#include <algorithm>
+
+
+// Index and vertex reordering for indexed triangles. The cache pass follows
+// Tom Forsyth's "Linear-Speed Vertex Cache Optimisation": triangles are emitted
+// greedily by a score that favours vertices recently used and vertices with few
+// triangles left. OptimizeOverdraw then reorders whole runs of that output.
+class MeshOptimizer
+{
+public:
+
+	// Also the strip restart index, which the remap and measuring functions skip
+	static constexpr uint32_t InvalidIndex = 0xFFFFFFFF;
+
+	// FIFO size used to measure ACMR/ATVR, close to the post-transform cache of common GPUs
+	static constexpr size_t DefaultCacheSize = 16;
+
+
+	// Reorders the triangles of indices (a triangle list) in place
+	static void OptimizeVertexCache(uint32_t* indices, size_t indexCount, size_t vertexCount)
+	{
+		size_t triangleCount = indexCount / 3;
+
+		if (triangleCount < 2)
+			return;
+
+		std::vector<uint32_t> remaining(vertexCount);
+
+		for (size_t i = 0; i < triangleCount * 3; i++)
+			remaining[indices[i]]++;
+
+		// Triangles of every vertex, still to be emitted, packed into one array
+		std::vector<uint32_t> offsets(vertexCount + 1);
+
+		for (size_t v = 0; v < vertexCount; v++)
+			offsets[v + 1] = offsets[v] + remaining[v];
+
+		std::vector<uint32_t> adjacency(triangleCount * 3);
+		std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+
+		for (size_t i = 0; i < triangleCount * 3; i++)
+			adjacency[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+
+		std::vector<int> cachePosition(vertexCount, -1);
+		std::vector<float> vertexScore(vertexCount);
+
+		for (size_t v = 0; v < vertexCount; v++)
+			vertexScore[v] = ScoreVertex(-1, remaining[v]);
+
+		std::vector<float> triangleScore(triangleCount);
+		std::vector<bool> emitted(triangleCount);
+
+		for (size_t t = 0; t < triangleCount; t++)
+			triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+		std::vector<uint32_t> output;
+		output.reserve(triangleCount * 3);
+
+		uint32_t cache[MaxCacheSize + 3];
+		uint32_t newCache[MaxCacheSize + 3];
+		size_t cacheCount = 0;
+		size_t scanCursor = 0;
+
+		size_t best = std::max_element(triangleScore.begin(), triangleScore.end()) - triangleScore.begin();
+
+		while (best != InvalidIndex)
+		{
+			const uint32_t* triangle = indices + best * 3;
+
+			emitted[best] = true;
+			output.insert(output.end(), triangle, triangle + 3);
+
+			for (int k = 0; k < 3; k++)
+			{
+				auto v = triangle[k];
+				auto begin = adjacency.begin() + offsets[v];
+				auto end = begin + remaining[v];
+
+				std::iter_swap(std::find(begin, end, static_cast<uint32_t>(best)), end - 1);
+				remaining[v]--;
+			}
+
+			// The triangle's vertices move to the front, the rest of the cache shifts back
+			size_t newCount = 0;
+
+			for (int k = 0; k < 3; k++)
+			{
+				if (std::find(newCache, newCache + newCount, triangle[k]) == newCache + newCount)
+					newCache[newCount++] = triangle[k];
+			}
+
+			for (size_t i = 0; i < cacheCount; i++)
+			{
+				if (std::find(newCache, newCache + newCount, cache[i]) == newCache + newCount)
+					newCache[newCount++] = cache[i];
+			}
+
+			for (size_t i = 0; i < newCount; i++)
+			{
+				auto v = newCache[i];
+
+				cachePosition[v] = (i < MaxCacheSize) ? static_cast<int>(i) : -1;
+				vertexScore[v] = ScoreVertex(cachePosition[v], remaining[v]);
+			}
+
+			best = InvalidIndex;
+			float bestScore = -1.0f;
+
+			for (size_t i = 0; i < newCount; i++)
+			{
+				auto v = newCache[i];
+
+				for (uint32_t j = offsets[v]; j < offsets[v] + remaining[v]; j++)
+				{
+					auto t = adjacency[j];
+					triangleScore[t] = vertexScore[indices[t * 3]] + vertexScore[indices[t * 3 + 1]] + vertexScore[indices[t * 3 + 2]];
+
+					if (triangleScore[t] > bestScore)
+					{
+						bestScore = triangleScore[t];
+						best = t;
+					}
+				}
+			}
+
+			cacheCount = (std::min)(newCount, MaxCacheSize);
+			std::copy(newCache, newCache + cacheCount, cache);
+
+			// Nothing adjacent to the cache is left, continue with any remaining triangle
+			if (best == InvalidIndex)
+			{
+				while (scanCursor < triangleCount && emitted[scanCursor])
+					scanCursor++;
+
+				if (scanCursor < triangleCount)
+					best = scanCursor;
+			}
+		}
+
+		std::copy(output.begin(), output.end(), indices);
+	}
+
+
+	// Reorders the triangles of indices (a triangle list) in place so that parts of the mesh
+	// likely to hide others are drawn first, after Sander, Nehab and Barczak, "Fast Triangle
+	// Reordering for Vertex Locality and Reduced Overdraw". The current order, normally from
+	// OptimizeVertexCache, is cut into clusters wherever the cache runs cold and again wherever
+	// a cluster reaches threshold times its own ACMR. The clusters are then sorted by how far
+	// out they face from the mesh centroid. ACMR grows by about threshold at most.
+	// positions holds x, y, z of every vertex; front faces are clockwise seen from outside.
+	static void OptimizeOverdraw(uint32_t* indices, size_t indexCount, const float* positions, size_t vertexCount, float threshold = 1.2f, size_t cacheSize = DefaultCacheSize)
+	{
+		size_t triangleCount = indexCount / 3;
+
+		if (triangleCount < 2)
+			return;
+
+		// Hard boundaries: triangles that miss the cache on all three vertices
+		std::vector<size_t> missTime(vertexCount, 0);
+		size_t transforms = 0;
+
+		std::vector<uint32_t> hardClusters;
+
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			auto misses = CountTriangleMisses(indices + t * 3, missTime, transforms, cacheSize);
+
+			if (t == 0 || misses == 3)
+				hardClusters.push_back(static_cast<uint32_t>(t));
+		}
+
+		// Soft boundaries: cut again as soon as a cold-started cluster is cache efficient enough
+		std::vector<uint32_t> clusters;
+
+		for (size_t c = 0; c < hardClusters.size(); c++)
+		{
+			size_t begin = hardClusters[c];
+			size_t end = (c + 1 < hardClusters.size()) ? hardClusters[c + 1] : triangleCount;
+
+			transforms += cacheSize + 1;
+			size_t clusterMisses = 0;
+
+			for (size_t t = begin; t < end; t++)
+				clusterMisses += CountTriangleMisses(indices + t * 3, missTime, transforms, cacheSize);
+
+			float clusterThreshold = threshold * clusterMisses / (end - begin);
+
+			clusters.push_back(static_cast<uint32_t>(begin));
+
+			transforms += cacheSize + 1;
+			size_t runningMisses = 0;
+			size_t runningTriangles = 0;
+
+			for (size_t t = begin; t < end; t++)
+			{
+				runningMisses += CountTriangleMisses(indices + t * 3, missTime, transforms, cacheSize);
+				runningTriangles++;
+
+				if (runningMisses <= clusterThreshold * runningTriangles)
+				{
+					clusters.push_back(static_cast<uint32_t>(t + 1));
+
+					transforms += cacheSize + 1;
+					runningMisses = 0;
+					runningTriangles = 0;
+				}
+			}
+
+			// The last cut leaves too few triangles to be worth a cluster, or none at all
+			if (clusters.back() != begin)
+				clusters.pop_back();
+		}
+
+		float meshCentroid[3] = {};
+
+		for (size_t i = 0; i < triangleCount * 3; i++)
+		{
+			for (int k = 0; k < 3; k++)
+				meshCentroid[k] += positions[indices[i] * 3 + k];
+		}
+
+		for (int k = 0; k < 3; k++)
+			meshCentroid[k] /= static_cast<float>(triangleCount * 3);
+
+		// Distance from the mesh centroid along the area weighted cluster normal, largest first
+		std::vector<std::pair<float, uint32_t>> order(clusters.size());
+
+		for (size_t cluster = 0; cluster < clusters.size(); cluster++)
+		{
+			size_t begin = clusters[cluster];
+			size_t end = (cluster + 1 < clusters.size()) ? clusters[cluster + 1] : triangleCount;
+
+			float centroid[3] = {};
+			float normal[3] = {};
+			float area = 0.0f;
+
+			for (size_t t = begin; t < end; t++)
+			{
+				const float* a = positions + indices[t * 3] * 3;
+				const float* b = positions + indices[t * 3 + 1] * 3;
+				const float* c = positions + indices[t * 3 + 2] * 3;
+
+				float ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+				float ac[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+
+				// Twice the area, facing out for clockwise triangles
+				float n[3] = { ac[1] * ab[2] - ac[2] * ab[1], ac[2] * ab[0] - ac[0] * ab[2], ac[0] * ab[1] - ac[1] * ab[0] };
+				float triangleArea = sqrtf(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+				for (int k = 0; k < 3; k++)
+				{
+					centroid[k] += (a[k] + b[k] + c[k]) * triangleArea / 3.0f;
+					normal[k] += n[k];
+				}
+
+				area += triangleArea;
+			}
+
+			float key = 0.0f;
+			float normalLength = sqrtf(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+
+			if (area > 0.0f && normalLength > 0.0f)
+			{
+				for (int k = 0; k < 3; k++)
+					key += (centroid[k] / area - meshCentroid[k]) * normal[k] / normalLength;
+			}
+
+			order[cluster] = { key, static_cast<uint32_t>(cluster) };
+		}
+
+		std::stable_sort(order.begin(), order.end(), [](const auto& a, const auto& b) { return a.first > b.first; });
+
+		std::vector<uint32_t> output;
+		output.reserve(triangleCount * 3);
+
+		for (const auto& [key, cluster] : order)
+		{
+			size_t begin = clusters[cluster];
+			size_t end = (cluster + 1 < clusters.size()) ? clusters[cluster + 1] : triangleCount;
+
+			output.insert(output.end(), indices + begin * 3, indices + end * 3);
+		}
+
+		std::copy(output.begin(), output.end(), indices);
+	}
+
+
+	// Numbers the vertices of indices in order of first use, continuing from nextVertex.
+	// remap[old] receives the new number of every vertex not numbered yet. Returns
+	// the next free number, so several index lists can share one vertex buffer.
+	static uint32_t AppendFetchRemap(const uint32_t* indices, size_t indexCount, uint32_t* remap, uint32_t nextVertex)
+	{
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			if (indices[i] != InvalidIndex && remap[indices[i]] == InvalidIndex)
+				remap[indices[i]] = nextVertex++;
+		}
+
+		return nextVertex;
+	}
+
+
+	static void RemapIndices(uint32_t* indices, size_t indexCount, const uint32_t* remap)
+	{
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			if (indices[i] != InvalidIndex)
+				indices[i] = remap[indices[i]];
+		}
+	}
+
+
+	// remap must be a permutation of 0 .. vertices.size() - 1
+	template<typename T>
+	static void RemapVertices(std::vector<T>& vertices, const uint32_t* remap)
+	{
+		std::vector<T> reordered(vertices.size());
+
+		for (size_t i = 0; i < vertices.size(); i++)
+			reordered[remap[i]] = vertices[i];
+
+		vertices = std::move(reordered);
+	}
+
+
+	// Vertex shader invocations for indices drawn through a FIFO post-transform cache.
+	// ACMR is this over the triangle count, ATVR is this over the vertex count.
+	static size_t CountVertexTransforms(const uint32_t* indices, size_t indexCount, size_t vertexCount, size_t cacheSize = DefaultCacheSize)
+	{
+		// A vertex is cached while fewer than cacheSize misses happened after its own
+		std::vector<size_t> missTime(vertexCount, 0);
+		size_t transforms = 0;
+
+		for (size_t i = 0; i < indexCount; i++)
+		{
+			auto v = indices[i];
+
+			if (v == InvalidIndex)
+				continue;
+
+			if (missTime[v] == 0 || transforms + 1 - missTime[v] > cacheSize)
+				missTime[v] = ++transforms;
+		}
+
+		return transforms;
+	}
+
+
+private:
+
+	static constexpr size_t MaxCacheSize = 32;
+
+
+	// One triangle through the FIFO of CountVertexTransforms. Adding cacheSize + 1 to
+	// transforms between calls empties the cache.
+	static int CountTriangleMisses(const uint32_t* triangle, std::vector<size_t>& missTime, size_t& transforms, size_t cacheSize)
+	{
+		int misses = 0;
+
+		for (int k = 0; k < 3; k++)
+		{
+			auto v = triangle[k];
+
+			if (missTime[v] == 0 || transforms + 1 - missTime[v] > cacheSize)
+			{
+				missTime[v] = ++transforms;
+				misses++;
+			}
+		}
+
+		return misses;
+	}
+
+
+	static float ScoreVertex(int cachePosition, uint32_t remainingTriangles)
+	{
+		if (remainingTriangles == 0)
+			return -1.0f;
+
+		float score = 0.0f;
+
+		// The last triangle's vertices get a fixed score so its neighbours are not always preferred
+		if (cachePosition >= 3)
+			score = powf(1.0f - static_cast<float>(cachePosition - 3) / (MaxCacheSize - 3), 1.5f);
+		else if (cachePosition >= 0)
+			score = 0.75f;
+
+		return score + 2.0f / sqrtf(static_cast<float>(remainingTriangles));
+	}
+};
@@ -0,0 +1,165 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define PALETTE_EXPAND_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+// AVX2 code is only emitted where the compiler accepts the intrinsics without
+// per-function target flags (MSVC always does, GCC/Clang need -mavx2)
+#if defined(PALETTE_EXPAND_X86) && (defined(_MSC_VER) || defined(__AVX2__))
+#define PALETTE_EXPAND_AVX2
+#endif
+
+
+// Expands 8-bit palette indices to RGBA8 texels. The palette is turned into a
+// 256-entry RGBA table once, so the per-texel work is a single lookup and the
+// transparent index of masked textures is just another table entry.
+class PaletteExpand
+{
+public:
+
+	// SSE2 has no gather, and the scalar loop already stores four texels at a time,
+	// so there is no SSE2 kernel
+	enum class Kernel
+	{
+		Scalar,
+		AVX2,
+	};
+
+
+	struct CpuFeatures
+	{
+		bool SSE2;
+		bool AVX2; // and the OS saves the AVX registers
+	};
+
+
+	// palette: 256 RGB triplets as stored after the texture indices
+	static void BuildTable(const uint8_t* palette, bool masked, uint32_t table[256])
+	{
+		for (int i = 0; i < 256; i++)
+		{
+			const uint8_t rgba[4] = { palette[i * 3 + 0], palette[i * 3 + 1], palette[i * 3 + 2], 0xff };
+			memcpy(&table[i], rgba, sizeof(rgba));
+		}
+
+		if (masked)
+			table[255] = 0;
+	}
+
+
+	static void ExpandScalar(const uint8_t* indices, size_t count, const uint32_t table[256], uint8_t* pixels)
+	{
+		size_t i = 0;
+
+		// One 16-byte copy per four lookups, which compilers turn into a single vector store
+		for (; i + 4 <= count; i += 4)
+		{
+			const uint32_t texels[4] = { table[indices[i + 0]], table[indices[i + 1]], table[indices[i + 2]], table[indices[i + 3]] };
+			memcpy(pixels + i * 4, texels, sizeof(texels));
+		}
+
+		for (; i < count; i++)
+			memcpy(pixels + i * 4, &table[indices[i]], 4);
+	}
+
+
+#ifdef PALETTE_EXPAND_AVX2
+
+	static void ExpandAVX2(const uint8_t* indices, size_t count, const uint32_t table[256], uint8_t* pixels)
+	{
+		size_t i = 0;
+
+		for (; i + 8 <= count; i += 8)
+		{
+			auto packed = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(indices + i));
+			auto offsets = _mm256_cvtepu8_epi32(packed);
+			auto texels = _mm256_i32gather_epi32(reinterpret_cast<const int*>(table), offsets, 4);
+
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(pixels + i * 4), texels);
+		}
+
+		ExpandScalar(indices + i, count - i, table, pixels + i * 4);
+	}
+
+#endif
+
+
+	static void Expand(Kernel kernel, const uint8_t* indices, size_t count, const uint32_t table[256], uint8_t* pixels)
+	{
+		switch (kernel)
+		{
+#ifdef PALETTE_EXPAND_AVX2
+			case Kernel::AVX2:
+				ExpandAVX2(indices, count, table, pixels);
+				return;
+#endif
+			default:
+				ExpandScalar(indices, count, table, pixels);
+				return;
+		}
+	}
+
+
+	static void Expand(const uint8_t* indices, size_t count, const uint32_t table[256], uint8_t* pixels)
+	{
+		static const Kernel kernel = DetectKernel();
+
+		Expand(kernel, indices, count, table, pixels);
+	}
+
+
+	static CpuFeatures DetectCpuFeatures()
+	{
+		CpuFeatures features{};
+
+#ifdef PALETTE_EXPAND_X86
+#ifdef _MSC_VER
+		int info[4]{};
+		__cpuid(info, 0);
+
+		int maxLeaf = info[0];
+
+		__cpuid(info, 1);
+
+		bool osxsave = (info[2] & (1 << 27)) != 0;
+		bool avx = (info[2] & (1 << 28)) != 0;
+
+		features.SSE2 = (info[3] & (1 << 26)) != 0;
+
+		if (maxLeaf >= 7 && osxsave && avx && (_xgetbv(0) & 0x6) == 0x6)
+		{
+			__cpuidex(info, 7, 0);
+			features.AVX2 = (info[1] & (1 << 5)) != 0;
+		}
+#else
+		__builtin_cpu_init();
+
+		features.SSE2 = __builtin_cpu_supports("sse2");
+		features.AVX2 = __builtin_cpu_supports("avx2");
+#endif
+#endif
+
+		return features;
+	}
+
+
+	// Best kernel the running CPU supports
+	static Kernel DetectKernel()
+	{
+#ifdef PALETTE_EXPAND_AVX2
+		if (DetectCpuFeatures().AVX2)
+			return Kernel::AVX2;
+#endif
+
+		return Kernel::Scalar;
+	}
+};
@@ -0,0 +1,294 @@
+#pragma once
+
+#include "StudioModelRenderer.hpp"
+
+#include <list>
+#include <unordered_map>
+
+
+// Finished bone transforms of poses already evaluated, shared between animators,
+// crowds and thumbnail jobs. Frames are quantized before lookup, so instances
+// playing the same sequence at nearly the same time share one entry. The cache is
+// split into shards, each with its own lock and least recently used list, and
+// holds at most its budget of transforms.
+class PoseCache
+{
+public:
+
+	struct Stats
+	{
+		size_t Hits;
+		size_t Misses;
+		size_t Evictions;
+		size_t Entries;
+		size_t Bytes;
+		size_t Budget;
+	};
+
+
+	static constexpr int DefaultFrameSteps = 4;
+	static constexpr size_t NumShards = 16;
+
+
+private:
+
+	struct PoseKey
+	{
+		const StudioModel* Model;
+		uint64_t Generation; // StudioModel::GetGeneration, as the address alone can be reused
+		int Sequence;
+		int Frame; // in 1 / m_FrameSteps of a frame
+		byte Controllers[4];
+		byte Blendings[2];
+		byte Mouth;
+		BoneKernels::Kernel Kernel;
+		int Variant;
+
+		bool operator==(const PoseKey& other) const
+		{
+			return Model == other.Model && Generation == other.Generation && Sequence == other.Sequence && Frame == other.Frame &&
+				memcmp(Controllers, other.Controllers, sizeof(Controllers)) == 0 &&
+				memcmp(Blendings, other.Blendings, sizeof(Blendings)) == 0 &&
+				Mouth == other.Mouth && Kernel == other.Kernel && Variant == other.Variant;
+		}
+	};
+
+
+	struct KeyHash
+	{
+		size_t operator()(const PoseKey& key) const
+		{
+			uint64_t hash = 1469598103934665603ull;
+
+			auto add = [&hash](uint64_t value)
+			{
+				hash ^= value;
+				hash *= 1099511628211ull;
+			};
+
+			add(reinterpret_cast<uintptr_t>(key.Model));
+			add(key.Generation);
+			add(static_cast<uint32_t>(key.Sequence));
+			add(static_cast<uint32_t>(key.Frame));
+			add(key.Controllers[0] | key.Controllers[1] << 8 | key.Controllers[2] << 16 | static_cast<uint32_t>(key.Controllers[3]) << 24);
+			add(key.Blendings[0] | key.Blendings[1] << 8 | key.Mouth << 16);
+			add(static_cast<uint32_t>(key.Kernel) | static_cast<uint64_t>(static_cast<uint32_t>(key.Variant)) << 32);
+
+			return static_cast<size_t>(hash ^ (hash >> 32));
+		}
+	};
+
+
+	struct Entry
+	{
+		PoseKey Key;
+		std::vector<float> Transforms;
+	};
+
+
+	struct Shard
+	{
+		std::mutex Mutex;
+		std::list<Entry> Entries; // most recently used first
+		std::unordered_map<PoseKey, std::list<Entry>::iterator, KeyHash> Index;
+		size_t Bytes = 0;
+	};
+
+
+	static size_t GetEntryBytes(size_t numFloats)
+	{
+		// The list node and index slot are a rough but fixed share of every entry
+		return sizeof(Entry) + numFloats * sizeof(float) + 4 * sizeof(void*);
+	}
+
+
+	Shard& GetShard(const PoseKey& key)
+	{
+		return m_Shards[KeyHash()(key) % NumShards];
+	}
+
+
+	bool Find(const PoseKey& key, float (*boneTransforms)[3][4], size_t numFloats)
+	{
+		auto& shard = GetShard(key);
+
+		std::lock_guard<std::mutex> lock(shard.Mutex);
+
+		auto found = shard.Index.find(key);
+
+		if (found == shard.Index.end() || found->second->Transforms.size() != numFloats)
+			return false;
+
+		shard.Entries.splice(shard.Entries.begin(), shard.Entries, found->second);
+		memcpy(boneTransforms, found->second->Transforms.data(), numFloats * sizeof(float));
+
+		return true;
+	}
+
+
+	void Insert(const PoseKey& key, const float (*boneTransforms)[3][4], size_t numFloats)
+	{
+		auto& shard = GetShard(key);
+		auto bytes = GetEntryBytes(numFloats);
+		auto budget = m_Budget.load(std::memory_order_relaxed) / NumShards;
+
+		if (bytes > budget)
+			return;
+
+		std::lock_guard<std::mutex> lock(shard.Mutex);
+
+		// Another thread may have evaluated the same pose meanwhile
+		if (shard.Index.count(key))
+			return;
+
+		while (shard.Bytes + bytes > budget && !shard.Entries.empty())
+		{
+			auto& oldest = shard.Entries.back();
+
+			shard.Bytes -= GetEntryBytes(oldest.Transforms.size());
+			shard.Index.erase(oldest.Key);
+			shard.Entries.pop_back();
+
+			m_Evictions.fetch_add(1, std::memory_order_relaxed);
+		}
+
+		auto first = reinterpret_cast<const float*>(boneTransforms);
+
+		shard.Entries.push_front(Entry{ key, std::vector<float>(first, first + numFloats) });
+		shard.Index.emplace(key, shard.Entries.begin());
+		shard.Bytes += bytes;
+	}
+
+
+public:
+
+	// Same contract as StudioModelAnimating::EvaluatePose, except that the pose is
+	// evaluated at its frame rounded to the quantization. variant tells apart poses
+	// evaluated with different rigidBones masks.
+	int EvaluatePose(StudioModel& studioModel, const StudioModelAnimating::PoseParameters& pose, float (*boneTransforms)[3][4], size_t maxBones,
+		StudioModelAnimating::Scratch& scratch, BoneKernels::Kernel kernel = BoneKernels::GetDefaultKernel(), int variant = 0, const uint8_t* rigidBones = nullptr)
+	{
+		auto header = studioModel.GetStudioHeader();
+
+		if (!header || maxBones < static_cast<size_t>(header->numbones))
+			return 0;
+
+		int frameSteps = m_FrameSteps.load(std::memory_order_relaxed);
+
+		PoseKey key{};
+
+		key.Model = &studioModel;
+		key.Generation = studioModel.GetGeneration();
+		key.Sequence = pose.Sequence;
+		key.Frame = static_cast<int>(floorf(pose.Frame * frameSteps + 0.5f));
+		memcpy(key.Controllers, pose.Controllers, sizeof(key.Controllers));
+		memcpy(key.Blendings, pose.Blendings, sizeof(key.Blendings));
+		key.Mouth = pose.Mouth;
+		key.Kernel = kernel;
+		key.Variant = variant;
+
+		size_t numFloats = static_cast<size_t>(header->numbones) * 12;
+
+		if (Find(key, boneTransforms, numFloats))
+		{
+			m_Hits.fetch_add(1, std::memory_order_relaxed);
+			return header->numbones;
+		}
+
+		m_Misses.fetch_add(1, std::memory_order_relaxed);
+
+		auto quantized = pose;
+		quantized.Frame = static_cast<float>(key.Frame) / frameSteps;
+
+		int numBones = StudioModelAnimating::EvaluatePose(studioModel, quantized, boneTransforms, maxBones, scratch, kernel, rigidBones);
+
+		if (numBones > 0)
+			Insert(key, boneTransforms, numFloats);
+
+		return numBones;
+	}
+
+
+	// Entries per frame of animation; larger values follow the animation more closely
+	// but share fewer poses. Drops every entry, so call it while no poses are evaluated.
+	void SetFrameQuantization(int frameSteps)
+	{
+		m_FrameSteps = (std::max)(frameSteps, 1);
+		Clear();
+	}
+
+
+	// Shrinking the budget takes effect as new poses come in
+	void SetBudget(size_t bytes)
+	{
+		m_Budget = bytes;
+	}
+
+
+	// Entries of models reloaded or destroyed are never hit again and age out on their own;
+	// this frees them at once
+	void Clear()
+	{
+		for (auto& shard : m_Shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.Mutex);
+
+			shard.Entries.clear();
+			shard.Index.clear();
+			shard.Bytes = 0;
+		}
+	}
+
+
+	Stats GetStats()
+	{
+		Stats stats{};
+
+		stats.Hits = m_Hits.load(std::memory_order_relaxed);
+		stats.Misses = m_Misses.load(std::memory_order_relaxed);
+		stats.Evictions = m_Evictions.load(std::memory_order_relaxed);
+		stats.Budget = m_Budget.load(std::memory_order_relaxed);
+
+		for (auto& shard : m_Shards)
+		{
+			std::lock_guard<std::mutex> lock(shard.Mutex);
+
+			stats.Entries += shard.Entries.size();
+			stats.Bytes += shard.Bytes;
+		}
+
+		return stats;
+	}
+
+
+	void ResetStats()
+	{
+		m_Hits = 0;
+		m_Misses = 0;
+		m_Evictions = 0;
+	}
+
+
+	explicit PoseCache(size_t budget, int frameSteps = DefaultFrameSteps)
+		: m_Budget{ budget }
+		, m_FrameSteps{ (std::max)(frameSteps, 1) }
+		, m_Hits{}
+		, m_Misses{}
+		, m_Evictions{}
+	{
+	}
+
+
+	PoseCache(const PoseCache&) = delete;
+	PoseCache& operator=(const PoseCache&) = delete;
+
+
+private:
+
+	Shard m_Shards[NumShards];
+	std::atomic<size_t> m_Budget;
+	std::atomic<int> m_FrameSteps;
+	std::atomic<size_t> m_Hits;
+	std::atomic<size_t> m_Misses;
+	std::atomic<size_t> m_Evictions;
+};
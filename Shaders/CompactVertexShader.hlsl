@@ -0,0 +1,70 @@
+cbuffer MatrixBuffer : register(b0)
+{
+    float4x4 World; // World matrix
+    float4x4 View; // View matrix
+    float4x4 Projection; // Projection matrix
+};
+
+cbuffer BoneBuffer : register(b1)
+{
+    float4 BoneTransforms[128 * 3]; // 128 bone transformation matrices, 3 rows each
+};
+
+cbuffer CompactFormatBuffer : register(b2)
+{
+    float4 PositionMin; // xyz, value = Min + quantized * Scale
+    float4 PositionScale; // xyz
+    float4 TexCoordMinScale; // xy min, zw scale
+};
+
+struct VertexInput
+{
+    uint4 PositionBone : POSITION; // Quantized position, bone in the low byte of w
+    float2 Normal : NORMAL; // Octahedral encoded normal
+    uint2 TexCoord : TEXCOORD; // Quantized texture coordinates
+};
+
+struct VertexOutput
+{
+    float4 Position : SV_POSITION; // Transformed vertex position
+    float3 Normal : NORMAL; // Transformed vertex normal
+    float2 TexCoord : TEXCOORD; // Texture coordinates
+};
+
+float3 DecodeNormal(float2 e)
+{
+    float3 n = float3(e, 1.0 - abs(e.x) - abs(e.y));
+
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(e.yx)) * (e >= 0.0 ? 1.0 : -1.0);
+
+    return normalize(n);
+}
+
+VertexOutput main(VertexInput input)
+{
+    VertexOutput output;
+
+    // Get the corresponding bone transformation matrix
+    uint row = (input.PositionBone.w & 0xFF) * 3;
+    float4 position = float4(PositionMin.xyz + float3(input.PositionBone.xyz) * PositionScale.xyz, 1.0);
+
+    // Transform from model space to world space
+    float4 worldPosition = float4(dot(BoneTransforms[row], position), dot(BoneTransforms[row + 1], position), dot(BoneTransforms[row + 2], position), 1.0);
+
+    // Combine with bone transformation
+    worldPosition = mul(worldPosition, World);
+
+    // Transform from world space to clip space
+    output.Position = mul(worldPosition, View);
+    output.Position = mul(output.Position, Projection);
+
+    // Transform normal
+    float3x3 normalMatrix = (float3x3) World; // Extract normal matrix
+    output.Normal = normalize(mul(DecodeNormal(input.Normal), normalMatrix)); // Transform and normalize the normal
+
+    // Dequantize texture coordinates
+    output.TexCoord = TexCoordMinScale.xy + float2(input.TexCoord) * TexCoordMinScale.zw;
+
+    return output;
+}
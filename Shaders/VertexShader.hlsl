@@ -7,7 +7,7 @@ cbuffer MatrixBuffer : register(b0)
 
 cbuffer BoneBuffer : register(b1)
 {
-    float4x4 BoneTransforms[128]; // 128 bone transformation matrices
+    float4 BoneTransforms[128 * 3]; // 128 bone transformation matrices, 3 rows each
 };
 
 struct VertexInput
@@ -30,10 +30,11 @@ VertexOutput main(VertexInput input)
     VertexOutput output;
 
     // Get the corresponding bone transformation matrix
-    float4x4 boneTransform = BoneTransforms[input.BoneIndex];
+    uint row = input.BoneIndex * 3;
+    float4 position = float4(input.Position, 1.0);
 
     // Transform from model space to world space
-    float4 worldPosition = mul(float4(input.Position, 1.0), boneTransform);
+    float4 worldPosition = float4(dot(BoneTransforms[row], position), dot(BoneTransforms[row + 1], position), dot(BoneTransforms[row + 2], position), 1.0);
     
     // Combine with bone transformation
     worldPosition = mul(worldPosition, World);
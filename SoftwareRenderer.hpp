@@ -0,0 +1,1124 @@
+#pragma once
+
+#include "StudioModelRenderer.hpp"
+#include "ThreadPool.hpp"
+
+#include <cstdint>
+#include <cmath>
+#include <atomic>
+
+#if defined(_M_IX86) || defined(_M_X64) || defined(__i386__) || defined(__x86_64__)
+#define SOFTWARE_RENDERER_X86
+#include <emmintrin.h>
+#endif
+
+
+// What SoftwareStudioModelRenderer draws, as D3DStudioModel is for the D3D11
+// renderer: float vertices, meshes as triangle lists and RGBA8 textures
+class SoftwareStudioModel
+{
+public:
+
+	struct SoftwareMesh
+	{
+		std::vector<uint32_t> Indices; // triangle list
+		int TextureId;
+	};
+
+
+	struct SoftwareModel
+	{
+		std::vector<StudioModel::Vertex> Vertices;
+		std::vector<SoftwareMesh> Meshes;
+	};
+
+
+	struct SoftwareBodyPart
+	{
+		std::vector<SoftwareModel> Models;
+	};
+
+
+	struct SoftwareTexture
+	{
+		int Width;
+		int Height;
+		std::vector<uint32_t> Texels; // RGBA8, R in the lowest byte
+	};
+
+
+private:
+
+	static SoftwareMesh LoadMesh(const StudioModel::Mesh& studioMesh)
+	{
+		SoftwareMesh mesh{};
+		mesh.TextureId = studioMesh.TextureId;
+
+		if (studioMesh.Topology == StudioModel::PrimitiveTopology::TriangleList)
+		{
+			mesh.Indices.assign(studioMesh.Indices.begin(), studioMesh.Indices.end());
+			return mesh;
+		}
+
+		// Strips as the input assembler reads them: every other triangle has its first
+		// two vertices swapped to keep the winding, degenerate ones draw nothing
+		const auto& indices = studioMesh.Indices;
+		size_t length = 0;
+
+		for (size_t i = 0; i < indices.size(); i++)
+		{
+			if (indices[i] == StudioModel::RestartIndex)
+			{
+				length = 0;
+				continue;
+			}
+
+			if (++length < 3)
+				continue;
+
+			uint32_t a = indices[i - 2];
+			uint32_t b = indices[i - 1];
+			uint32_t c = indices[i];
+
+			if (a == b || b == c || a == c)
+				continue;
+
+			if ((length - 3) % 2)
+				mesh.Indices.insert(mesh.Indices.end(), { b, a, c });
+			else
+				mesh.Indices.insert(mesh.Indices.end(), { a, b, c });
+		}
+
+		return mesh;
+	}
+
+
+	static SoftwareModel LoadModel(const StudioModel::Model& studioModel)
+	{
+		SoftwareModel model{};
+		model.Vertices = studioModel.DecodeVertices();
+		model.Meshes.reserve(studioModel.Meshes.size());
+
+		for (const auto& studioMesh : studioModel.Meshes)
+			model.Meshes.push_back(LoadMesh(studioMesh));
+
+		return model;
+	}
+
+
+	static SoftwareTexture LoadTexture(const StudioModel::Texture& studioTexture)
+	{
+		SoftwareTexture texture{};
+		texture.Width = studioTexture.Width;
+		texture.Height = studioTexture.Height;
+		texture.Texels.resize(static_cast<size_t>(studioTexture.Width) * studioTexture.Height);
+
+		// No texels means its meshes are skipped, as with a texture that is missing
+		if (!texture.Texels.empty() && !studioTexture.ExpandTo(reinterpret_cast<uint8_t*>(texture.Texels.data()), static_cast<size_t>(studioTexture.Width) * 4))
+			texture.Texels.clear();
+
+		return texture;
+	}
+
+
+public:
+
+	void Load(const std::wstring& filePath, const StudioModel::LoadOptions& options = {})
+	{
+		m_StudioModel = std::make_unique<StudioModel>();
+
+		m_StudioModel->LoadFromFile(filePath, options);
+
+		m_BodyParts.clear();
+		m_Textures.clear();
+
+		for (const auto& studioBodyPart : m_StudioModel->GetBodyParts())
+		{
+			SoftwareBodyPart bodyPart{};
+			bodyPart.Models.reserve(studioBodyPart.Models.size());
+
+			for (const auto& studioModel : studioBodyPart.Models)
+				bodyPart.Models.push_back(LoadModel(studioModel));
+
+			m_BodyParts.push_back(std::move(bodyPart));
+		}
+
+		for (const auto& studioTexture : m_StudioModel->GetTextures())
+			m_Textures.push_back(LoadTexture(studioTexture));
+	}
+
+
+	StudioModel* GetStudioModel() const
+	{
+		return m_StudioModel.get();
+	}
+
+
+	const std::vector<SoftwareBodyPart>& GetBodyParts() const
+	{
+		return m_BodyParts;
+	}
+
+
+	const std::vector<SoftwareTexture>& GetTextures() const
+	{
+		return m_Textures;
+	}
+
+
+private:
+
+	std::unique_ptr<StudioModel> m_StudioModel;
+	std::vector<SoftwareBodyPart> m_BodyParts;
+	std::vector<SoftwareTexture> m_Textures;
+};
+
+
+// CPU version of D3DStudioModelRenderer and its shaders and states, for machines
+// without a D3D11 device: bone skinning, World/View/Projection, clipping, back face
+// culling, a less-than depth test and source-alpha blending into an RGBA8 target.
+// Triangles are binned into screen tiles, and tiles are rasterized in parallel
+// with integer edge functions, so each pixel still sees its triangles in
+// submission order and the image does not depend on the number of threads.
+class SoftwareStudioModelRenderer
+{
+public:
+
+	static constexpr int TileSize = 64;
+
+	// Larger targets are rejected, see SetViewport
+	static constexpr int MaxViewportSize = 8192;
+
+
+	// Auto is D3DStudioModelRenderer's choice between the gun view for "v_" models
+	// and the front view for the rest. The others orbit the front view around the
+	// model or force the gun view.
+	enum class CameraPreset
+	{
+		Auto,
+		Front,
+		ThreeQuarter,
+		Side,
+		Back,
+		Gun,
+	};
+
+
+	struct Stats
+	{
+		size_t Triangles; // submitted
+		size_t Culled; // back facing, degenerate or outside the view
+		size_t Clipped; // crossed the near, far or guard band planes
+		size_t Binned; // triangle-tile pairs
+		size_t Pixels; // passed the depth test
+		double Milliseconds;
+	};
+
+
+private:
+
+	// Sub-pixel precision of the edge functions. With the guard band keeping
+	// coordinates within MaxViewportSize pixels of the viewport, an edge function
+	// varies by less than 2^30 over one tile, so it is stepped in 32-bit lanes.
+	static constexpr int SubPixelBits = 4;
+	static constexpr int SubPixels = 1 << SubPixelBits;
+
+	// Triangles set up and binned per task
+	static constexpr size_t BatchTriangles = 256;
+
+
+	struct Matrix
+	{
+		float m[4][4];
+	};
+
+
+	struct ClipVertex
+	{
+		float X, Y, Z, W;
+		float U, V;
+	};
+
+
+	struct Triangle
+	{
+		int MinX, MinY, MaxX, MaxY; // covered pixels, inside the viewport
+
+		// Edge i is A * x + B * y + C at sub-pixel x, y; the pixel is inside all three at >= 0
+		int32_t EdgeA[3];
+		int32_t EdgeB[3];
+		int64_t EdgeC[3];
+
+		// z / w, 1 / w, u / w and v / w as a * x + b * y + c at pixel x, y
+		float Planes[4][3];
+	};
+
+
+	// A run of one mesh's triangles, set up by one task
+	struct Batch
+	{
+		const SoftwareStudioModel::SoftwareMesh* Mesh;
+		const SoftwareStudioModel::SoftwareTexture* Texture;
+		size_t FirstVertex; // of the model in m_ClipVertices
+		size_t FirstTriangle;
+		size_t NumTriangles;
+
+		std::vector<Triangle> Triangles;
+		std::vector<std::vector<uint32_t>> Bins; // per tile, indices into Triangles
+		size_t Culled;
+		size_t Clipped;
+	};
+
+
+	static Matrix Multiply(const Matrix& a, const Matrix& b)
+	{
+		Matrix result{};
+
+		for (int i = 0; i < 4; i++)
+		{
+			for (int j = 0; j < 4; j++)
+				result.m[i][j] = a.m[i][0] * b.m[0][j] + a.m[i][1] * b.m[1][j] + a.m[i][2] * b.m[2][j] + a.m[i][3] * b.m[3][j];
+		}
+
+		return result;
+	}
+
+
+	// XMMatrixLookAtLH
+	static Matrix LookAtLH(const float* eye, const float* at, const float* up)
+	{
+		float z[3] = { at[0] - eye[0], at[1] - eye[1], at[2] - eye[2] };
+		float length = sqrtf(z[0] * z[0] + z[1] * z[1] + z[2] * z[2]);
+
+		for (auto& c : z)
+			c /= length;
+
+		float x[3] = { up[1] * z[2] - up[2] * z[1], up[2] * z[0] - up[0] * z[2], up[0] * z[1] - up[1] * z[0] };
+		length = sqrtf(x[0] * x[0] + x[1] * x[1] + x[2] * x[2]);
+
+		for (auto& c : x)
+			c /= length;
+
+		float y[3] = { z[1] * x[2] - z[2] * x[1], z[2] * x[0] - z[0] * x[2], z[0] * x[1] - z[1] * x[0] };
+
+		Matrix view
+		{ {
+			{ x[0], y[0], z[0], 0.0f },
+			{ x[1], y[1], z[1], 0.0f },
+			{ x[2], y[2], z[2], 0.0f },
+			{
+				-(x[0] * eye[0] + x[1] * eye[1] + x[2] * eye[2]),
+				-(y[0] * eye[0] + y[1] * eye[1] + y[2] * eye[2]),
+				-(z[0] * eye[0] + z[1] * eye[1] + z[2] * eye[2]),
+				1.0f
+			},
+		} };
+
+		return view;
+	}
+
+
+	// XMMatrixPerspectiveFovLH
+	static Matrix PerspectiveFovLH(float fovAngleY, float aspectRatio, float nearZ, float farZ)
+	{
+		float height = cosf(fovAngleY * 0.5f) / sinf(fovAngleY * 0.5f);
+		float width = height / aspectRatio;
+		float range = farZ / (farZ - nearZ);
+
+		Matrix projection
+		{ {
+			{ width, 0.0f, 0.0f, 0.0f },
+			{ 0.0f, height, 0.0f, 0.0f },
+			{ 0.0f, 0.0f, range, 1.0f },
+			{ 0.0f, 0.0f, -range * nearZ, 0.0f },
+		} };
+
+		return projection;
+	}
+
+
+	bool IsGunModel() const
+	{
+		std::filesystem::path path(m_SoftwareStudioModel->GetStudioModel()->GetFilePath());
+
+		std::wstring fileName = path.stem().wstring();
+
+		std::transform(fileName.begin(), fileName.end(), fileName.begin(), [](int c) { return std::tolower(c); });
+
+		return fileName.starts_with(L"v_");
+	}
+
+
+	// CameraPreset::Auto is D3DStudioModelRenderer::SetCamera, including its use of
+	// degrees in tanf, so both renderers produce the same picture
+	void SetCamera()
+	{
+		auto header = m_SoftwareStudioModel->GetStudioModel()->GetStudioHeader();
+
+		float mins[3]{};
+		float maxs[3]{};
+
+		if (header->numseq > 0)
+		{
+			auto pseqdesc = reinterpret_cast<const mstudioseqdesc_t*>(reinterpret_cast<const byte*>(header) + header->seqindex);
+
+			for (int i = 0; i < 3; i++)
+			{
+				mins[i] = pseqdesc->bbmin[i];
+				maxs[i] = pseqdesc->bbmax[i];
+			}
+		}
+
+		float width = maxs[0] - mins[0];
+		float height = maxs[2] - mins[2];
+
+		if (width > height)
+			height = width;
+
+		float at[3] = { (mins[0] + maxs[0]) / 2.0f, (mins[1] + maxs[1]) / 2.0f, (mins[2] + maxs[2]) / 2.0f };
+		float up[3] = { 0.0f, 0.0f, 1.0f };
+
+		float fov = 65;
+		float cameraDistance = (height / 2.0f) / tanf(fov / 2.0f) * 4.0f;
+
+		if (cameraDistance < 0)
+			cameraDistance = 50.0f;
+
+		float yaw = 0.0f;
+
+		switch (m_CameraPreset)
+		{
+			case CameraPreset::ThreeQuarter: yaw = 45.0f; break;
+			case CameraPreset::Side: yaw = 90.0f; break;
+			case CameraPreset::Back: yaw = 180.0f; break;
+			default: break;
+		}
+
+		yaw = (yaw + m_CameraYaw) * 3.14159265f / 180.0f;
+
+		// Orbits the origin, which the front view's eye is placed from
+		float eye[3] = { -cameraDistance * cosf(yaw), -cameraDistance * sinf(yaw), cameraDistance * 0.25f };
+
+		if (m_CameraPreset == CameraPreset::Gun || (m_CameraPreset == CameraPreset::Auto && IsGunModel()))
+		{
+			eye[0] = -1.0f;
+			eye[1] = 1.4f;
+			eye[2] = 1.0f;
+			at[0] = -5.0f;
+			at[1] = 1.4f;
+			at[2] = 1.0f;
+			fov = 90;
+		}
+
+		Matrix world
+		{ {
+			{ -1.0f, 0.0f, 0.0f, 0.0f }, // Make Right-Handed Coordinate System
+			{ 0.0f, 1.0f, 0.0f, 0.0f },
+			{ 0.0f, 0.0f, 1.0f, 0.0f },
+			{ 0.0f, 0.0f, 0.0f, 1.0f },
+		} };
+
+		auto view = LookAtLH(eye, at, up);
+		auto projection = PerspectiveFovLH(fov * (3.14159265f / 180.0f), m_Width / (float)m_Height, 0.01f, 1000.0f);
+
+		m_WorldViewProjection = Multiply(Multiply(world, view), projection);
+	}
+
+
+	// The vertex shader: the bone's transform, then World, View and Projection
+	void TransformVertices(const SoftwareStudioModel::SoftwareModel& model, const float (*boneTransforms)[3][4], int numBones, ClipVertex* out) const
+	{
+		const auto& m = m_WorldViewProjection.m;
+
+		for (size_t i = 0; i < model.Vertices.size(); i++)
+		{
+			const auto& vertex = model.Vertices[i];
+			const auto& bone = boneTransforms[vertex.Bone < static_cast<uint32_t>(numBones) ? vertex.Bone : 0];
+
+			float p[3];
+
+			for (int j = 0; j < 3; j++)
+				p[j] = bone[j][0] * vertex.Position.x + bone[j][1] * vertex.Position.y + bone[j][2] * vertex.Position.z + bone[j][3];
+
+			out[i].X = p[0] * m[0][0] + p[1] * m[1][0] + p[2] * m[2][0] + m[3][0];
+			out[i].Y = p[0] * m[0][1] + p[1] * m[1][1] + p[2] * m[2][1] + m[3][1];
+			out[i].Z = p[0] * m[0][2] + p[1] * m[1][2] + p[2] * m[2][2] + m[3][2];
+			out[i].W = p[0] * m[0][3] + p[1] * m[1][3] + p[2] * m[2][3] + m[3][3];
+			out[i].U = vertex.TexCoord.x;
+			out[i].V = vertex.TexCoord.y;
+		}
+	}
+
+
+	// Signed distances to the near and far planes and the guard band; inside at >= 0
+	float ClipDistance(const ClipVertex& v, int plane) const
+	{
+		switch (plane)
+		{
+			case 0: return v.Z;
+			case 1: return v.W - v.Z;
+			case 2: return v.X + m_GuardBand * v.W;
+			case 3: return m_GuardBand * v.W - v.X;
+			case 4: return v.Y + m_GuardBand * v.W;
+			default: return m_GuardBand * v.W - v.Y;
+		}
+	}
+
+
+	// Sutherland-Hodgman against the planes in mask; returns the polygon's vertex count
+	int ClipPolygon(ClipVertex* polygon, int count, int mask, ClipVertex* temp) const
+	{
+		for (int plane = 0; plane < 6 && count > 0; plane++)
+		{
+			if (!(mask & (1 << plane)))
+				continue;
+
+			int clipped = 0;
+
+			for (int i = 0; i < count; i++)
+			{
+				const auto& a = polygon[i];
+				const auto& b = polygon[(i + 1) % count];
+				float da = ClipDistance(a, plane);
+				float db = ClipDistance(b, plane);
+
+				if (da >= 0.0f)
+					temp[clipped++] = a;
+
+				if ((da >= 0.0f) != (db >= 0.0f))
+				{
+					float t = da / (da - db);
+
+					temp[clipped].X = a.X + (b.X - a.X) * t;
+					temp[clipped].Y = a.Y + (b.Y - a.Y) * t;
+					temp[clipped].Z = a.Z + (b.Z - a.Z) * t;
+					temp[clipped].W = a.W + (b.W - a.W) * t;
+					temp[clipped].U = a.U + (b.U - a.U) * t;
+					temp[clipped].V = a.V + (b.V - a.V) * t;
+					clipped++;
+				}
+			}
+
+			std::copy(temp, temp + clipped, polygon);
+			count = clipped;
+		}
+
+		return count;
+	}
+
+
+	// Returns false if the triangle covers no pixel centre or faces away. Front faces
+	// are clockwise on screen, as with D3D11_CULL_BACK and FrontCounterClockwise off.
+	bool SetUpTriangle(const ClipVertex& v0, const ClipVertex& v1, const ClipVertex& v2, Triangle& triangle) const
+	{
+		const ClipVertex* v[3] = { &v0, &v1, &v2 };
+
+		int64_t x[3], y[3];
+		float attributes[3][4];
+
+		for (int i = 0; i < 3; i++)
+		{
+			float invW = 1.0f / v[i]->W;
+
+			x[i] = static_cast<int64_t>(lrintf((v[i]->X * invW * 0.5f + 0.5f) * m_Width * SubPixels));
+			y[i] = static_cast<int64_t>(lrintf((0.5f - v[i]->Y * invW * 0.5f) * m_Height * SubPixels));
+
+			attributes[i][0] = (std::min)((std::max)(v[i]->Z * invW, 0.0f), 1.0f);
+			attributes[i][1] = invW;
+			attributes[i][2] = v[i]->U * invW;
+			attributes[i][3] = v[i]->V * invW;
+		}
+
+		int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+
+		if (area <= 0)
+			return false;
+
+		// Pixel centres are at half a pixel
+		int64_t half = SubPixels / 2;
+
+		triangle.MinX = static_cast<int>((std::max)(((std::min)({ x[0], x[1], x[2] }) - half + SubPixels - 1) >> SubPixelBits, int64_t{ 0 }));
+		triangle.MinY = static_cast<int>((std::max)(((std::min)({ y[0], y[1], y[2] }) - half + SubPixels - 1) >> SubPixelBits, int64_t{ 0 }));
+		triangle.MaxX = static_cast<int>((std::min)(((std::max)({ x[0], x[1], x[2] }) - half) >> SubPixelBits, int64_t{ m_Width - 1 }));
+		triangle.MaxY = static_cast<int>((std::min)(((std::max)({ y[0], y[1], y[2] }) - half) >> SubPixelBits, int64_t{ m_Height - 1 }));
+
+		if (triangle.MinX > triangle.MaxX || triangle.MinY > triangle.MaxY)
+			return false;
+
+		for (int i = 0; i < 3; i++)
+		{
+			// Edge i runs between the other two vertices, so it weighs vertex i
+			int a = (i + 1) % 3;
+			int b = (i + 2) % 3;
+			int64_t dx = x[b] - x[a];
+			int64_t dy = y[b] - y[a];
+
+			// Top-left rule: pixel centres on a top or left edge belong to this triangle
+			bool topLeft = dy < 0 || (dy == 0 && dx > 0);
+
+			triangle.EdgeA[i] = static_cast<int32_t>(-dy);
+			triangle.EdgeB[i] = static_cast<int32_t>(dx);
+			triangle.EdgeC[i] = dy * x[a] - dx * y[a] - (topLeft ? 0 : 1);
+		}
+
+		double x0 = x[0] / double{ SubPixels };
+		double y0 = y[0] / double{ SubPixels };
+		double x1 = x[1] / double{ SubPixels } - x0;
+		double y1 = y[1] / double{ SubPixels } - y0;
+		double x2 = x[2] / double{ SubPixels } - x0;
+		double y2 = y[2] / double{ SubPixels } - y0;
+		double pixelArea = area / double{ SubPixels * SubPixels };
+
+		for (int k = 0; k < 4; k++)
+		{
+			double a1 = attributes[1][k] - attributes[0][k];
+			double a2 = attributes[2][k] - attributes[0][k];
+			double ddx = (a1 * y2 - a2 * y1) / pixelArea;
+			double ddy = (a2 * x1 - a1 * x2) / pixelArea;
+
+			triangle.Planes[k][0] = static_cast<float>(ddx);
+			triangle.Planes[k][1] = static_cast<float>(ddy);
+			triangle.Planes[k][2] = static_cast<float>(attributes[0][k] - ddx * x0 - ddy * y0);
+		}
+
+		return true;
+	}
+
+
+	void SetUpBatch(Batch& batch) const
+	{
+		auto vertices = m_ClipVertices.data() + batch.FirstVertex;
+		const auto& indices = batch.Mesh->Indices;
+
+		batch.Triangles.clear();
+		batch.Bins.resize(static_cast<size_t>(m_TilesX) * m_TilesY);
+		batch.Culled = 0;
+		batch.Clipped = 0;
+
+		for (auto& bin : batch.Bins)
+			bin.clear();
+
+		for (size_t t = batch.FirstTriangle; t < batch.FirstTriangle + batch.NumTriangles; t++)
+		{
+			ClipVertex polygon[9];
+			ClipVertex temp[9];
+
+			for (int k = 0; k < 3; k++)
+				polygon[k] = vertices[indices[t * 3 + k]];
+
+			int outside[6]{};
+			int mask = 0;
+
+			for (int plane = 0; plane < 6; plane++)
+			{
+				for (int k = 0; k < 3; k++)
+				{
+					if (ClipDistance(polygon[k], plane) < 0.0f)
+						outside[plane]++;
+				}
+
+				if (outside[plane] == 3)
+					break;
+
+				if (outside[plane])
+					mask |= 1 << plane;
+			}
+
+			int count = 3;
+
+			if (std::find(outside, outside + 6, 3) != outside + 6)
+				count = 0;
+			else if (mask)
+			{
+				count = ClipPolygon(polygon, 3, mask, temp);
+				batch.Clipped++;
+			}
+
+			bool drawn = false;
+
+			for (int k = 1; k + 1 < count; k++)
+			{
+				Triangle triangle;
+
+				if (!SetUpTriangle(polygon[0], polygon[k], polygon[k + 1], triangle))
+					continue;
+
+				auto index = static_cast<uint32_t>(batch.Triangles.size());
+				batch.Triangles.push_back(triangle);
+				drawn = true;
+
+				for (int ty = triangle.MinY / TileSize; ty <= triangle.MaxY / TileSize; ty++)
+				{
+					for (int tx = triangle.MinX / TileSize; tx <= triangle.MaxX / TileSize; tx++)
+						batch.Bins[static_cast<size_t>(ty) * m_TilesX + tx].push_back(index);
+				}
+			}
+
+			if (!drawn)
+				batch.Culled++;
+		}
+	}
+
+
+	// floorf without the library call, for the sampler's wrapping
+	static float Floor(float value)
+	{
+		float truncated = static_cast<float>(static_cast<int>(value));
+		return truncated > value ? truncated - 1.0f : truncated;
+	}
+
+
+	// The pixel shader and output merger for pixel x, y; false if the depth test failed
+	bool ShadePixel(const Triangle& triangle, const SoftwareStudioModel::SoftwareTexture& texture, int x, int y)
+	{
+		size_t pixel = static_cast<size_t>(y) * m_Width + x;
+		float px = x + 0.5f;
+		float py = y + 0.5f;
+
+		const auto& planes = triangle.Planes;
+		float z = (std::min)((std::max)(planes[0][0] * px + planes[0][1] * py + planes[0][2], 0.0f), 1.0f);
+
+		if (!(z < m_Depth[pixel]))
+			return false;
+
+		m_Depth[pixel] = z;
+
+		float w = 1.0f / (planes[1][0] * px + planes[1][1] * py + planes[1][2]);
+		float u = (planes[2][0] * px + planes[2][1] * py + planes[2][2]) * w;
+		float v = (planes[3][0] * px + planes[3][1] * py + planes[3][2]) * w;
+
+		// Bilinear, wrapping, on the only mip level like the D3D11 sampler. With the
+		// coordinates wrapped to 0 .. 1 first, texel x0 only wraps from -1.
+		u -= Floor(u);
+		v -= Floor(v);
+
+		float tx = u * texture.Width + 0.5f;
+		float ty = v * texture.Height + 0.5f;
+		int x1 = static_cast<int>(tx);
+		int y1 = static_cast<int>(ty);
+		float sx = tx - x1;
+		float sy = ty - y1;
+		int x0 = x1 - 1;
+		int y0 = y1 - 1;
+
+		if (x0 < 0)
+			x0 = texture.Width - 1;
+		if (y0 < 0)
+			y0 = texture.Height - 1;
+		if (x1 >= texture.Width)
+			x1 = 0;
+		if (y1 >= texture.Height)
+			y1 = 0;
+
+		const auto* row0 = texture.Texels.data() + static_cast<size_t>(y0) * texture.Width;
+		const auto* row1 = texture.Texels.data() + static_cast<size_t>(y1) * texture.Width;
+		uint32_t texels[4] = { row0[x0], row0[x1], row1[x0], row1[x1] };
+		float weights[4] = { (1.0f - sx) * (1.0f - sy), sx * (1.0f - sy), (1.0f - sx) * sy, sx * sy };
+
+#ifdef SOFTWARE_RENDERER_X86
+		// Same operations in the same order as the scalar version, one channel per lane
+		__m128i zero = _mm_setzero_si128();
+
+		auto unpack = [zero](uint32_t texel)
+		{
+			return _mm_cvtepi32_ps(_mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(static_cast<int>(texel)), zero), zero));
+		};
+
+		__m128 color = _mm_mul_ps(unpack(texels[0]), _mm_set1_ps(weights[0]));
+
+		for (int k = 1; k < 4; k++)
+			color = _mm_add_ps(color, _mm_mul_ps(unpack(texels[k]), _mm_set1_ps(weights[k])));
+
+		// SRC_ALPHA / INV_SRC_ALPHA on color, ZERO / ZERO on alpha
+		__m128 alpha = _mm_div_ps(_mm_shuffle_ps(color, color, _MM_SHUFFLE(3, 3, 3, 3)), _mm_set1_ps(255.0f));
+		__m128 blended = _mm_add_ps(_mm_mul_ps(color, alpha), _mm_mul_ps(unpack(m_Color[pixel]), _mm_sub_ps(_mm_set1_ps(1.0f), alpha)));
+		__m128i channels = _mm_cvttps_epi32(_mm_add_ps(blended, _mm_set1_ps(0.5f)));
+
+		channels = _mm_packs_epi32(channels, channels);
+		channels = _mm_packus_epi16(channels, channels);
+
+		uint32_t result = static_cast<uint32_t>(_mm_cvtsi128_si32(channels)) & 0x00FFFFFF;
+#else
+		float color[4]{};
+
+		for (int k = 0; k < 4; k++)
+		{
+			for (int c = 0; c < 4; c++)
+				color[c] += ((texels[k] >> (c * 8)) & 0xFF) * weights[k];
+		}
+
+		// SRC_ALPHA / INV_SRC_ALPHA on color, ZERO / ZERO on alpha
+		float alpha = color[3] / 255.0f;
+		uint32_t destination = m_Color[pixel];
+		uint32_t result = 0;
+
+		for (int c = 0; c < 3; c++)
+		{
+			float blended = color[c] * alpha + ((destination >> (c * 8)) & 0xFF) * (1.0f - alpha);
+			result |= static_cast<uint32_t>(blended + 0.5f) << (c * 8);
+		}
+#endif
+
+		m_Color[pixel] = result;
+		return true;
+	}
+
+
+	// Draws the part of triangle inside the tile's pixels x0 .. x1, y0 .. y1; returns the pixels drawn
+	size_t RasterizeTriangle(const Triangle& triangle, const SoftwareStudioModel::SoftwareTexture& texture, int tileX0, int tileY0, int tileX1, int tileY1)
+	{
+		int x0 = (std::max)(triangle.MinX, tileX0);
+		int y0 = (std::max)(triangle.MinY, tileY0);
+		int x1 = (std::min)(triangle.MaxX, tileX1);
+		int y1 = (std::min)(triangle.MaxY, tileY1);
+
+		if (x0 > x1 || y0 > y1)
+			return 0;
+
+		// An edge is only tested where it crosses the rectangle: entirely inside it
+		// is dropped, entirely outside it rejects the triangle. What remains is
+		// small enough for 32 bits.
+		int32_t start[3] = { 0, 0, 0 };
+		int32_t stepX[3] = { 0, 0, 0 };
+		int32_t stepY[3] = { 0, 0, 0 };
+		int edges = 0;
+
+		for (int i = 0; i < 3; i++)
+		{
+			auto edge = [&triangle, i](int x, int y)
+			{
+				return int64_t{ triangle.EdgeA[i] } * (x * SubPixels + SubPixels / 2) + int64_t{ triangle.EdgeB[i] } * (y * SubPixels + SubPixels / 2) + triangle.EdgeC[i];
+			};
+
+			int64_t corners[4] = { edge(x0, y0), edge(x1, y0), edge(x0, y1), edge(x1, y1) };
+
+			if (*std::max_element(corners, corners + 4) < 0)
+				return 0;
+
+			if (*std::min_element(corners, corners + 4) >= 0)
+				continue;
+
+			start[edges] = static_cast<int32_t>(corners[0]);
+			stepX[edges] = triangle.EdgeA[i] * SubPixels;
+			stepY[edges] = triangle.EdgeB[i] * SubPixels;
+			edges++;
+		}
+
+		size_t drawn = 0;
+
+		for (int y = y0; y <= y1; y++)
+		{
+#ifdef SOFTWARE_RENDERER_X86
+			__m128i e0 = _mm_add_epi32(_mm_set1_epi32(start[0]), LaneSteps(stepX[0]));
+			__m128i e1 = _mm_add_epi32(_mm_set1_epi32(start[1]), LaneSteps(stepX[1]));
+			__m128i e2 = _mm_add_epi32(_mm_set1_epi32(start[2]), LaneSteps(stepX[2]));
+			__m128i step0 = _mm_set1_epi32(stepX[0] * 4);
+			__m128i step1 = _mm_set1_epi32(stepX[1] * 4);
+			__m128i step2 = _mm_set1_epi32(stepX[2] * 4);
+
+			for (int x = x0; x <= x1; x += 4)
+			{
+				// The sign bit of any edge marks a pixel outside
+				int outside = _mm_movemask_ps(_mm_castsi128_ps(_mm_or_si128(_mm_or_si128(e0, e1), e2)));
+				int inside = ~outside & (0xF >> (std::max)(0, x + 3 - x1));
+
+				for (int k = 0; inside; k++, inside >>= 1)
+				{
+					if ((inside & 1) && ShadePixel(triangle, texture, x + k, y))
+						drawn++;
+				}
+
+				e0 = _mm_add_epi32(e0, step0);
+				e1 = _mm_add_epi32(e1, step1);
+				e2 = _mm_add_epi32(e2, step2);
+			}
+#else
+			int32_t e[3] = { start[0], start[1], start[2] };
+
+			for (int x = x0; x <= x1; x++)
+			{
+				if ((e[0] | e[1] | e[2]) >= 0 && ShadePixel(triangle, texture, x, y))
+					drawn++;
+
+				for (int i = 0; i < 3; i++)
+					e[i] += stepX[i];
+			}
+#endif
+
+			for (int i = 0; i < edges; i++)
+				start[i] += stepY[i];
+		}
+
+		return drawn;
+	}
+
+
+#ifdef SOFTWARE_RENDERER_X86
+	// 0, step, 2 step, 3 step
+	static __m128i LaneSteps(int32_t step)
+	{
+		return _mm_set_epi32(step * 3, step * 2, step, 0);
+	}
+#endif
+
+
+	void RasterizeTile(size_t tile)
+	{
+		int tileX0 = static_cast<int>(tile % m_TilesX) * TileSize;
+		int tileY0 = static_cast<int>(tile / m_TilesX) * TileSize;
+		int tileX1 = (std::min)(tileX0 + TileSize, m_Width) - 1;
+		int tileY1 = (std::min)(tileY0 + TileSize, m_Height) - 1;
+
+		size_t drawn = 0;
+
+		for (const auto& batch : m_Batches)
+		{
+			for (auto index : batch.Bins[tile])
+				drawn += RasterizeTriangle(batch.Triangles[index], *batch.Texture, tileX0, tileY0, tileX1, tileY1);
+		}
+
+		m_PixelsDrawn.fetch_add(drawn, std::memory_order_relaxed);
+	}
+
+
+	template<typename Body>
+	static void ForEach(ThreadPool* workers, size_t count, Body&& body)
+	{
+		if (workers)
+			workers->ParallelFor(count, body);
+		else
+		{
+			for (size_t i = 0; i < count; i++)
+				body(i);
+		}
+	}
+
+
+public:
+
+	// Draws boneTransforms, numBones of them as set up by StudioModelAnimating, over
+	// the current contents of the target. workers may be null to draw on the calling thread.
+	void Draw(const float (*boneTransforms)[3][4], int numBones, ThreadPool* workers)
+	{
+		auto start = std::chrono::steady_clock::now();
+
+		m_Stats = Stats{};
+
+		if (!m_SoftwareStudioModel || !m_SoftwareStudioModel->GetStudioModel() || m_Color.empty() || numBones <= 0)
+			return;
+
+		const auto& textures = m_SoftwareStudioModel->GetTextures();
+
+		if (textures.empty())
+			return;
+
+		SetCamera();
+
+		// Vertices of every model, then batches of triangles in draw order
+		std::vector<const SoftwareStudioModel::SoftwareModel*> models;
+		std::vector<size_t> firstVertices;
+		size_t numVertices = 0;
+		size_t numBatches = 0;
+
+		for (const auto& bodyPart : m_SoftwareStudioModel->GetBodyParts())
+		{
+			for (const auto& model : bodyPart.Models)
+			{
+				models.push_back(&model);
+				firstVertices.push_back(numVertices);
+				numVertices += model.Vertices.size();
+
+				for (const auto& mesh : model.Meshes)
+				{
+					if (mesh.TextureId < 0 || static_cast<size_t>(mesh.TextureId) >= textures.size() || textures[mesh.TextureId].Texels.empty())
+						continue;
+
+					for (size_t first = 0; first < mesh.Indices.size() / 3; first += BatchTriangles)
+					{
+						if (m_Batches.size() <= numBatches)
+							m_Batches.emplace_back();
+
+						auto& batch = m_Batches[numBatches++];
+						batch.Mesh = &mesh;
+						batch.Texture = &textures[mesh.TextureId];
+						batch.FirstVertex = numVertices - model.Vertices.size();
+						batch.FirstTriangle = first;
+						batch.NumTriangles = (std::min)(BatchTriangles, mesh.Indices.size() / 3 - first);
+					}
+				}
+			}
+		}
+
+		m_Batches.resize(numBatches);
+		m_ClipVertices.resize(numVertices);
+
+		ForEach(workers, models.size(), [this, &models, &firstVertices, boneTransforms, numBones](size_t i)
+		{
+			TransformVertices(*models[i], boneTransforms, numBones, m_ClipVertices.data() + firstVertices[i]);
+		});
+
+		ForEach(workers, m_Batches.size(), [this](size_t i)
+		{
+			SetUpBatch(m_Batches[i]);
+		});
+
+		m_PixelsDrawn = 0;
+
+		ForEach(workers, static_cast<size_t>(m_TilesX) * m_TilesY, [this](size_t tile)
+		{
+			RasterizeTile(tile);
+		});
+
+		for (const auto& batch : m_Batches)
+		{
+			m_Stats.Triangles += batch.NumTriangles;
+			m_Stats.Culled += batch.Culled;
+			m_Stats.Clipped += batch.Clipped;
+
+			for (const auto& bin : batch.Bins)
+				m_Stats.Binned += bin.size();
+		}
+
+		m_Stats.Pixels = m_PixelsDrawn.load(std::memory_order_relaxed);
+		m_Stats.Milliseconds = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+
+	// Animates and draws like D3DStudioModelRenderer::Draw
+	void Draw(ThreadPool* workers)
+	{
+		if (!m_SoftwareStudioModel || !m_SoftwareStudioModel->GetStudioModel())
+			return;
+
+		m_Animating.SetStudioModel(m_SoftwareStudioModel->GetStudioModel());
+		m_Animating.SetUpBones();
+
+		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_LastUpdateTime).count();
+		auto sec = ms / 1000.0;
+		m_LastUpdateTime = std::chrono::steady_clock::now();
+
+		Draw(m_Animating.GetBoneTransforms(), m_Animating.GetBoneCount(), workers);
+
+		m_Animating.AdvanceFrame(sec);
+	}
+
+
+	// Like ClearRenderTargetView and clearing the depth to 1
+	void Clear(const float color[4])
+	{
+		uint32_t value = 0;
+
+		for (int c = 0; c < 4; c++)
+			value |= static_cast<uint32_t>((std::min)((std::max)(color[c], 0.0f), 1.0f) * 255.0f + 0.5f) << (c * 8);
+
+		std::fill(m_Color.begin(), m_Color.end(), value);
+		std::fill(m_Depth.begin(), m_Depth.end(), 1.0f);
+	}
+
+
+	void SetModel(SoftwareStudioModel* softwareStudioModel)
+	{
+		m_SoftwareStudioModel = softwareStudioModel;
+	}
+
+
+	void SetCameraPreset(CameraPreset preset)
+	{
+		m_CameraPreset = preset;
+	}
+
+
+	// Turns the camera further about the model, for turntables; the gun view stays put
+	void SetCameraYaw(float degrees)
+	{
+		m_CameraYaw = degrees;
+	}
+
+
+	// Resizes the target, whose contents are undefined until the next Clear.
+	// Sizes outside 1 .. MaxViewportSize leave no target to draw to.
+	void SetViewport(int viewWidth, int viewHeight)
+	{
+		if (viewWidth < 1 || viewHeight < 1 || viewWidth > MaxViewportSize || viewHeight > MaxViewportSize)
+			viewWidth = viewHeight = 0;
+
+		m_Width = viewWidth;
+		m_Height = viewHeight;
+		m_TilesX = (viewWidth + TileSize - 1) / TileSize;
+		m_TilesY = (viewHeight + TileSize - 1) / TileSize;
+
+		m_Color.resize(static_cast<size_t>(viewWidth) * viewHeight);
+		m_Depth.resize(static_cast<size_t>(viewWidth) * viewHeight);
+
+		// Clip space x and y may go this far past +-w before a triangle is clipped,
+		// which keeps screen coordinates within MaxViewportSize of the viewport
+		m_GuardBand = static_cast<float>(MaxViewportSize) / (std::max)((std::max)(viewWidth, viewHeight), 1);
+	}
+
+
+	int GetWidth() const
+	{
+		return m_Width;
+	}
+
+
+	int GetHeight() const
+	{
+		return m_Height;
+	}
+
+
+	// Width * Height RGBA8 pixels, top row first, as in a R8G8B8A8_UNORM target
+	const uint32_t* GetPixels() const
+	{
+		return m_Color.data();
+	}
+
+
+	const Stats& GetStats() const
+	{
+		return m_Stats;
+	}
+
+
+	SoftwareStudioModelRenderer()
+		: m_SoftwareStudioModel{}
+		, m_Animating{}
+		, m_LastUpdateTime{ std::chrono::steady_clock::now() }
+		, m_CameraPreset{ CameraPreset::Auto }
+		, m_CameraYaw{}
+		, m_Width{}
+		, m_Height{}
+		, m_TilesX{}
+		, m_TilesY{}
+		, m_GuardBand{ 1.0f }
+		, m_WorldViewProjection{}
+		, m_PixelsDrawn{}
+		, m_Stats{}
+	{
+	}
+
+
+private:
+
+	SoftwareStudioModel* m_SoftwareStudioModel;
+
+	StudioModelAnimating m_Animating;
+	std::chrono::steady_clock::time_point m_LastUpdateTime;
+	CameraPreset m_CameraPreset;
+	float m_CameraYaw; // degrees, added to the preset's
+
+	int m_Width;
+	int m_Height;
+	int m_TilesX;
+	int m_TilesY;
+	float m_GuardBand;
+	std::vector<uint32_t> m_Color;
+	std::vector<float> m_Depth;
+
+	Matrix m_WorldViewProjection;
+	std::vector<ClipVertex> m_ClipVertices;
+	std::vector<Batch> m_Batches;
+	std::atomic<size_t> m_PixelsDrawn;
+	Stats m_Stats;
+};
@@ -1,17 +1,27 @@
 #pragma once
 
+#ifdef _WIN32
 #include <Windows.h>
 #include <wrl/client.h>
 #include <d3d11.h>
 #include <DirectXMath.h>
+#endif
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
 #include <algorithm>
 #include <chrono>
 #include <fstream>
 #include <filesystem>
+#include <random>
+#include <thread>
+#include <cwchar>
 
+#ifdef _WIN32
 using Microsoft::WRL::ComPtr;
 
 using DirectX::XMFLOAT3;
@@ -28,16 +38,71 @@ using DirectX::XMMatrixRotationX;
 using DirectX::XMMatrixRotationY;
 using DirectX::XMMatrixRotationZ;
 using DirectX::XMMatrixScaling;
+#else
+// The model and animation classes build anywhere; the D3D11 renderer needs Windows
+typedef unsigned char byte;
+#endif
 
 
 #include "./hlsdk/mathlib.h"
 #include "./hlsdk/studio.h"
 
+#include "MappedFile.hpp"
+#include "PaletteExpand.hpp"
+#include "ThreadPool.hpp"
+#include "MeshOptimizer.hpp"
+#include "BoneKernels.hpp"
+
 
 class StudioModel
 {
 public:
 
+	// Storage for loaded geometry and texels. It either owns its elements, or views
+	// them inside a memory-mapped model cache that the owning StudioModel keeps open.
+	template<typename T>
+	class Array
+	{
+	public:
+
+		Array()
+			: m_Data{}
+			, m_Size{}
+		{ }
+
+		Array(std::vector<T>&& storage)
+			: m_Storage(std::move(storage))
+			, m_Data(m_Storage.data())
+			, m_Size(m_Storage.size())
+		{ }
+
+		// A moved vector keeps its buffer, so m_Data stays valid
+		Array(Array&& other) noexcept = default;
+		Array& operator=(Array&& other) noexcept = default;
+
+		static Array View(const T* data, size_t size)
+		{
+			Array array;
+			array.m_Data = data;
+			array.m_Size = size;
+			return array;
+		}
+
+		const T* data() const { return m_Data; }
+		size_t size() const { return m_Size; }
+		bool empty() const { return m_Size == 0; }
+		const T* begin() const { return m_Data; }
+		const T* end() const { return m_Data + m_Size; }
+		const T& operator[](size_t i) const { return m_Data[i]; }
+
+	private:
+
+		std::vector<T> m_Storage;
+		const T* m_Data;
+		size_t m_Size;
+	};
+
+
 	struct VEC2
 	{
 		float x;
@@ -77,34 +142,114 @@ public:
 	};
 
 
+	// 16-byte form of Vertex. Position and TexCoord are 16-bit fractions of the
+	// owning model's bounds (see CompactVertexFormat), the normal is octahedral
+	// encoded and the bone fits in a byte because it is below MAXSTUDIOBONES.
+	struct CompactVertex
+	{
+		uint16_t Position[3];
+		uint8_t Bone;
+		uint8_t Reserved;
+		int16_t Normal[2];
+		uint16_t TexCoord[2];
+	};
+
+	static_assert(sizeof(CompactVertex) == 16, "CompactVertex must stay 16 bytes");
+
+
+	// Per-model dequantization: value = Min + quantized * Scale
+	struct CompactVertexFormat
+	{
+		VEC3 PositionMin;
+		VEC3 PositionScale;
+		VEC2 TexCoordMin;
+		VEC2 TexCoordScale;
+	};
+
+
+	// Largest absolute difference between a vertex and its compact round trip
+	struct CompactVertexError
+	{
+		float Position;
+		float Normal;
+		float TexCoord;
+	};
+
+
+	enum class PrimitiveTopology
+	{
+		TriangleList,
+		TriangleStrip, // strips are separated by RestartIndex
+	};
+
+
+	static constexpr uint32_t RestartIndex = 0xFFFFFFFF;
+
+
 	struct Mesh
 	{
-		std::vector<uint32_t> Indices;
+		Array<uint32_t> Indices;
 		int TextureId;
+		PrimitiveTopology Topology;
 
 		Mesh()
 			: TextureId{}
+			, Topology{ PrimitiveTopology::TriangleList }
 		{ }
 
 		Mesh(Mesh&& other) noexcept
 		{
 			this->Indices = std::move(other.Indices);
 			this->TextureId = other.TextureId;
+			this->Topology = other.Topology;
 		}
 	};
 
 
+	// A model holds either Vertices or, when loaded with LoadOptions::CompactVertices,
+	// CompactVertices plus the CompactFormat needed to decode them.
 	struct Model
 	{
-		std::vector<Vertex> Vertices;
+		Array<Vertex> Vertices;
+		Array<CompactVertex> CompactVertices;
+		CompactVertexFormat CompactFormat;
 		std::vector<Mesh> Meshes;
 
-		Model() = default;
+		Model()
+			: CompactFormat{}
+		{ }
 
 		Model(Model&& other) noexcept
+		{
+			*this = std::move(other);
+		}
+
+		Model& operator=(Model&& other) noexcept
 		{
 			this->Vertices = std::move(other.Vertices);
+			this->CompactVertices = std::move(other.CompactVertices);
+			this->CompactFormat = other.CompactFormat;
 			this->Meshes = std::move(other.Meshes);
+			return *this;
+		}
+
+		size_t GetVertexCount() const
+		{
+			return CompactVertices.empty() ? Vertices.size() : CompactVertices.size();
+		}
+
+		// Float vertices whichever form is stored
+		std::vector<Vertex> DecodeVertices() const
+		{
+			if (CompactVertices.empty())
+				return std::vector<Vertex>(Vertices.begin(), Vertices.end());
+
+			std::vector<Vertex> vertices(CompactVertices.size());
+
+			for (size_t i = 0; i < CompactVertices.size(); i++)
+				vertices[i] = DecodeVertex(CompactVertices[i], CompactFormat);
+
+			return vertices;
 		}
 	};
 
@@ -122,11 +267,15 @@ public:
 	};
 
 
+	// Textures stay palette-indexed: Indices views the texels inside the studio file
+	// and Palette holds the 256 RGBA colors (masked index already transparent).
+	// RGBA texels only exist for as long as a consumer needs them.
 	struct Texture
 	{
 		int Width;
 		int Height;
-		std::vector<uint8_t> Data;
+		Array<uint8_t> Indices;
+		Array<uint32_t> Palette;
 
 		Texture()
 			: Width{}
@@ -137,11 +286,278 @@ public:
 		{
 			this->Width = other.Width;
 			this->Height = other.Height;
-			this->Data = std::move(other.Data);
+			this->Indices = std::move(other.Indices);
+			this->Palette = std::move(other.Palette);
+		}
+
+		Texture& operator=(Texture&& other) noexcept
+		{
+			this->Width = other.Width;
+			this->Height = other.Height;
+			this->Indices = std::move(other.Indices);
+			this->Palette = std::move(other.Palette);
+			return *this;
+		}
+
+		// Writes Width x Height RGBA8 texels, rowPitch bytes apart. Returns false, writing
+		// nothing, if Indices is too short for the size or Palette has fewer than 256 colors.
+		bool ExpandTo(uint8_t* pixels, size_t rowPitch) const
+		{
+			if (Indices.size() < static_cast<size_t>(Width) * Height || Palette.size() < 256)
+				return false;
+
+			auto rowSize = static_cast<size_t>(Width);
+
+			if (rowPitch == rowSize * 4)
+			{
+				PaletteExpand::Expand(Indices.data(), rowSize * Height, Palette.data(), pixels);
+				return true;
+			}
+
+			for (int y = 0; y < Height; y++)
+				PaletteExpand::Expand(Indices.data() + y * rowSize, rowSize, Palette.data(), pixels + y * rowPitch);
+
+			return true;
+		}
+
+		// Empty when ExpandTo fails
+		std::vector<uint8_t> Expand() const
+		{
+			std::vector<uint8_t> pixels(static_cast<size_t>(Width) * Height * 4);
+
+			if (!ExpandTo(pixels.data(), static_cast<size_t>(Width) * 4))
+				return {};
+
+			return pixels;
+		}
+	};
+
+
+	struct LoadOptions
+	{
+		// Decodes textures and models on this pool when set, otherwise on the calling thread
+		ThreadPool* Workers = nullptr;
+
+		// Reuse (or write) a pre-built cache of the decoded meshes and textures
+		bool UseCache = false;
+
+		// Where cache files go, named after the model and a hash of its full path; next to the model when empty
+		std::wstring CacheDirectory;
+
+		// Keep 16-byte CompactVertex data instead of float Vertex data
+		bool CompactVertices = false;
+
+		// Reorder triangles for the post-transform cache and vertices for fetch locality.
+		// Strips keep their triangle order and only get the vertex reordering.
+		bool OptimizeVertexCache = false;
+
+		// Then draw the outward facing parts of each triangle list first, judged in the
+		// reference pose (MeshOptimizer::OptimizeOverdraw). Strips are left as they are.
+		bool OptimizeOverdraw = false;
+
+		// Fill in LoadReport::VertexTransformsBefore/After, which simulates the cache twice per mesh
+		bool MeasureVertexCache = false;
+
+		// Build PrimitiveTopology::TriangleStrip meshes: GoldSrc strips as they are, fans turned into strips
+		bool TriangleStrips = false;
+	};
+
+
+	// Filled in while a model is built from the studio file (not when it comes from a cache)
+	struct LoadReport
+	{
+		size_t NumVertices;
+		size_t VertexBytes;
+		size_t FloatVertexBytes;
+		CompactVertexError MaxCompactVertexError;
+
+		// Through a MeshOptimizer::DefaultCacheSize FIFO, before and after OptimizeVertexCache
+		// and OptimizeOverdraw; only with LoadOptions::MeasureVertexCache.
+		// ACMR = transforms / NumTriangles, ATVR = transforms / NumVertices.
+		size_t NumTriangles;
+		size_t VertexTransformsBefore;
+		size_t VertexTransformsAfter;
+
+		// Indices kept, against the same meshes as triangle lists
+		size_t NumIndices;
+		size_t NumListIndices;
+
+		void Add(const LoadReport& other)
+		{
+			NumVertices += other.NumVertices;
+			VertexBytes += other.VertexBytes;
+			FloatVertexBytes += other.FloatVertexBytes;
+			NumTriangles += other.NumTriangles;
+			VertexTransformsBefore += other.VertexTransformsBefore;
+			VertexTransformsAfter += other.VertexTransformsAfter;
+			NumIndices += other.NumIndices;
+			NumListIndices += other.NumListIndices;
+			MaxCompactVertexError.Position = (std::max)(MaxCompactVertexError.Position, other.MaxCompactVertexError.Position);
+			MaxCompactVertexError.Normal = (std::max)(MaxCompactVertexError.Normal, other.MaxCompactVertexError.Normal);
+			MaxCompactVertexError.TexCoord = (std::max)(MaxCompactVertexError.TexCoord, other.MaxCompactVertexError.TexCoord);
+		}
+	};
+
+
+	// One frame of one animated channel in raw mstudioanimvalue_t units, exactly as
+	// the span walk of StudioModelAnimating reads it for that frame
+	struct DecodedKey
+	{
+		int16_t Value1;
+		int16_t Value2; // the value interpolated towards
+		int16_t Interpolate; // position channels: blend Value1 and Value2 instead of holding Value1
+	};
+
+
+	// Dense keys of every animated channel of a sequence. Channel c (0-2 position,
+	// 3-5 rotation) of bone b in blend n starts at Keys[Channels[(n * NumBones + b) * 6 + c]]
+	// and has NumFrames keys, or is NoKeys when the bone's default value is used.
+	struct DecodedSequence
+	{
+		static constexpr uint32_t NoKeys = 0xFFFFFFFF;
+
+		int Sequence;
+		int NumFrames;
+		int NumBones;
+		std::vector<uint32_t> Channels;
+		std::vector<DecodedKey> Keys;
+
+		size_t GetSize() const
+		{
+			return sizeof(*this) + sizeof(uint32_t) * Channels.size() + sizeof(DecodedKey) * Keys.size();
 		}
 	};
 
 
+	// Covers the positions and texcoords of the given vertices
+	static CompactVertexFormat MakeCompactVertexFormat(const Vertex* vertices, size_t count)
+	{
+		CompactVertexFormat format{};
+
+		if (count == 0)
+			return format;
+
+		VEC3 minPosition = vertices[0].Position, maxPosition = vertices[0].Position;
+		VEC2 minTexCoord = vertices[0].TexCoord, maxTexCoord = vertices[0].TexCoord;
+
+		for (size_t i = 1; i < count; i++)
+		{
+			const auto& v = vertices[i];
+
+			minPosition = { (std::min)(minPosition.x, v.Position.x), (std::min)(minPosition.y, v.Position.y), (std::min)(minPosition.z, v.Position.z) };
+			maxPosition = { (std::max)(maxPosition.x, v.Position.x), (std::max)(maxPosition.y, v.Position.y), (std::max)(maxPosition.z, v.Position.z) };
+			minTexCoord = { (std::min)(minTexCoord.x, v.TexCoord.x), (std::min)(minTexCoord.y, v.TexCoord.y) };
+			maxTexCoord = { (std::max)(maxTexCoord.x, v.TexCoord.x), (std::max)(maxTexCoord.y, v.TexCoord.y) };
+		}
+
+		format.PositionMin = minPosition;
+		format.PositionScale = { (maxPosition.x - minPosition.x) / 65535.0f, (maxPosition.y - minPosition.y) / 65535.0f, (maxPosition.z - minPosition.z) / 65535.0f };
+		format.TexCoordMin = minTexCoord;
+		format.TexCoordScale = { (maxTexCoord.x - minTexCoord.x) / 65535.0f, (maxTexCoord.y - minTexCoord.y) / 65535.0f };
+
+		return format;
+	}
+
+
+	static CompactVertex EncodeVertex(const Vertex& vertex, const CompactVertexFormat& format)
+	{
+		auto unorm16 = [](float value, float min, float scale) -> uint16_t
+		{
+			if (scale <= 0.0f)
+				return 0;
+
+			auto q = (value - min) / scale + 0.5f;
+			return static_cast<uint16_t>((std::min)((std::max)(q, 0.0f), 65535.0f));
+		};
+
+		auto snorm16 = [](float value) -> int16_t
+		{
+			auto q = (std::min)((std::max)(value, -1.0f), 1.0f) * 32767.0f;
+			return static_cast<int16_t>(q < 0.0f ? q - 0.5f : q + 0.5f);
+		};
+
+		CompactVertex compact{};
+
+		compact.Position[0] = unorm16(vertex.Position.x, format.PositionMin.x, format.PositionScale.x);
+		compact.Position[1] = unorm16(vertex.Position.y, format.PositionMin.y, format.PositionScale.y);
+		compact.Position[2] = unorm16(vertex.Position.z, format.PositionMin.z, format.PositionScale.z);
+		compact.Bone = static_cast<uint8_t>(vertex.Bone);
+		compact.TexCoord[0] = unorm16(vertex.TexCoord.x, format.TexCoordMin.x, format.TexCoordScale.x);
+		compact.TexCoord[1] = unorm16(vertex.TexCoord.y, format.TexCoordMin.y, format.TexCoordScale.y);
+
+		// Project onto the octahedron |x| + |y| + |z| = 1 and fold the lower half over the upper
+		const auto& n = vertex.Normal;
+		auto length = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+
+		if (length > 0.0f)
+		{
+			auto x = n.x / length;
+			auto y = n.y / length;
+
+			if (n.z < 0.0f)
+			{
+				auto fx = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+				auto fy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+				x = fx;
+				y = fy;
+			}
+
+			compact.Normal[0] = snorm16(x);
+			compact.Normal[1] = snorm16(y);
+		}
+
+		return compact;
+	}
+
+
+	static Vertex DecodeVertex(const CompactVertex& compact, const CompactVertexFormat& format)
+	{
+		Vertex vertex{};
+
+		vertex.Position.x = format.PositionMin.x + compact.Position[0] * format.PositionScale.x;
+		vertex.Position.y = format.PositionMin.y + compact.Position[1] * format.PositionScale.y;
+		vertex.Position.z = format.PositionMin.z + compact.Position[2] * format.PositionScale.z;
+		vertex.Bone = compact.Bone;
+		vertex.TexCoord.x = format.TexCoordMin.x + compact.TexCoord[0] * format.TexCoordScale.x;
+		vertex.TexCoord.y = format.TexCoordMin.y + compact.TexCoord[1] * format.TexCoordScale.y;
+
+		auto x = compact.Normal[0] / 32767.0f;
+		auto y = compact.Normal[1] / 32767.0f;
+		auto z = 1.0f - fabsf(x) - fabsf(y);
+
+		if (z < 0.0f)
+		{
+			auto ux = (1.0f - fabsf(y)) * (x >= 0.0f ? 1.0f : -1.0f);
+			auto uy = (1.0f - fabsf(x)) * (y >= 0.0f ? 1.0f : -1.0f);
+			x = ux;
+			y = uy;
+		}
+
+		auto length = sqrtf(x * x + y * y + z * z);
+		vertex.Normal = { x / length, y / length, z / length };
+
+		return vertex;
+	}
+
+
+	static CompactVertexError MeasureCompactVertexError(const Vertex* vertices, const CompactVertex* compact, size_t count, const CompactVertexFormat& format)
+	{
+		CompactVertexError error{};
+
+		for (size_t i = 0; i < count; i++)
+		{
+			auto decoded = DecodeVertex(compact[i], format);
+			const auto& v = vertices[i];
+
+			error.Position = (std::max)({ error.Position, fabsf(decoded.Position.x - v.Position.x), fabsf(decoded.Position.y - v.Position.y), fabsf(decoded.Position.z - v.Position.z) });
+			error.Normal = (std::max)({ error.Normal, fabsf(decoded.Normal.x - v.Normal.x), fabsf(decoded.Normal.y - v.Normal.y), fabsf(decoded.Normal.z - v.Normal.z) });
+			error.TexCoord = (std::max)({ error.TexCoord, fabsf(decoded.TexCoord.x - v.TexCoord.x), fabsf(decoded.TexCoord.y - v.TexCoord.y) });
+		}
+
+		return error;
+	}
+
+
 private:
 
 	template<typename T>
@@ -158,27 +574,120 @@ private:
 	}
 
 
-	static uint32_t InsertVertex(std::vector<Vertex>& vertices, const Vertex& vertex)
+	// Open-addressing hash index used to weld vertices while one mstudiomodel_t is
+	// loaded. Keys follow Vertex::operator== (the bone is not part of the key) so the
+	// emitted vertex order and indices match a linear search of the vertex list.
+	class VertexIndex
 	{
-		auto it = std::find_if(vertices.cbegin(), vertices.cend(), [&vertex](const auto& elem) {
-			return elem == vertex;
-		});
+	public:
 
-		if (it != vertices.cend())
+		VertexIndex(std::vector<Vertex>& vertices, size_t expectedCount)
+			: m_Vertices(vertices)
 		{
-			return static_cast<uint32_t>(it - vertices.cbegin());
+			size_t capacity = 16;
+
+			while (capacity < expectedCount * 2)
+				capacity <<= 1;
+
+			m_Slots.assign(capacity, EmptySlot);
 		}
 
-		vertices.push_back(vertex);
 
-		return static_cast<uint32_t>(vertices.size() - 1);
-	}
+		uint32_t Insert(const Vertex& vertex)
+		{
+			size_t mask = m_Slots.size() - 1;
+			size_t slot = Hash(vertex) & mask;
+
+			while (m_Slots[slot] != EmptySlot)
+			{
+				if (m_Vertices[m_Slots[slot]] == vertex)
+					return m_Slots[slot];
+
+				slot = (slot + 1) & mask;
+			}
+
+			auto index = static_cast<uint32_t>(m_Vertices.size());
+
+			m_Vertices.push_back(vertex);
+			m_Slots[slot] = index;
+
+			if (m_Vertices.size() * 2 > m_Slots.size())
+				Rehash(m_Slots.size() * 2);
+
+			return index;
+		}
+
+
+	private:
+
+		static constexpr uint32_t EmptySlot = 0xFFFFFFFF;
+
+
+		static uint32_t FloatBits(float value)
+		{
+			// +0.0 and -0.0 compare equal, so they must hash equal too
+			if (value == 0.0f)
+				value = 0.0f;
+
+			uint32_t bits;
+			memcpy(&bits, &value, sizeof(bits));
+			return bits;
+		}
+
+
+		static size_t Hash(const Vertex& vertex)
+		{
+			const float values[] =
+			{
+				vertex.Position.x, vertex.Position.y, vertex.Position.z,
+				vertex.Normal.x, vertex.Normal.y, vertex.Normal.z,
+				vertex.TexCoord.x, vertex.TexCoord.y,
+			};
+
+			uint64_t hash = 0xcbf29ce484222325ull;
+
+			for (auto value : values)
+			{
+				hash ^= FloatBits(value);
+				hash *= 0x100000001b3ull;
+				hash ^= hash >> 29;
+			}
+
+			return static_cast<size_t>(hash ^ (hash >> 32));
+		}
+
+
+		void Rehash(size_t capacity)
+		{
+			m_Slots.assign(capacity, EmptySlot);
+
+			size_t mask = capacity - 1;
+
+			for (uint32_t i = 0; i < static_cast<uint32_t>(m_Vertices.size()); i++)
+			{
+				size_t slot = Hash(m_Vertices[i]) & mask;
+
+				while (m_Slots[slot] != EmptySlot)
+					slot = (slot + 1) & mask;
+
+				m_Slots[slot] = i;
+			}
+		}
+
+
+		std::vector<Vertex>& m_Vertices;
+		std::vector<uint32_t> m_Slots;
+	};
 
 
-	Mesh LoadMesh(mstudiomesh_t* studioMesh, mstudiomodel_t* studioModel, std::vector<Vertex>& vertices)
+	// The indices go to triangles, so the model can still reorder them
+	Mesh LoadMesh(mstudiomesh_t* studioMesh, mstudiomodel_t* studioModel, VertexIndex& vertexIndex, std::vector<uint32_t>& triangles, const LoadOptions& options, LoadReport& report)
 	{
 		Mesh mesh{};
-		mesh.Indices.reserve(2048);
+
+		mesh.Topology = options.TriangleStrips ? PrimitiveTopology::TriangleStrip : PrimitiveTopology::TriangleList;
+
+		triangles.reserve(2048);
 
 		auto studioVertices = GetPtr<VEC3>(studioModel->vertindex);
 		auto studioVertexBones = GetPtr<uint8_t>(studioModel->vertinfoindex);
@@ -219,24 +728,65 @@ private:
 				vert.TexCoord = VEC2{ s * tricmds[2] , t * tricmds[3] };
 				vert.Bone = studioVertexBones[tricmds[0]];
 
-				indices.push_back(InsertVertex(vertices, vert));
+				indices.push_back(vertexIndex.Insert(vert));
 			}
 
-			if (strip)
+			if (indices.size() < 3)
+				continue;
+
+			report.NumTriangles += indices.size() - 2;
+
+			if (mesh.Topology == PrimitiveTopology::TriangleStrip)
+			{
+				if (!triangles.empty())
+					triangles.push_back(RestartIndex);
+
+				if (strip)
+				{
+					triangles.insert(triangles.end(), indices.begin(), indices.end());
+				}
+				else
+				{
+					// The fan c, f1 .. fn becomes f1 f2 c f3 f4, then f c f' f'' for every two more
+					// triangles. The repeated f and c only add degenerate triangles.
+					triangles.push_back(indices[1]);
+					triangles.push_back(indices[2]);
+					triangles.push_back(indices[0]);
+
+					size_t j = 3;
+
+					if (j < indices.size())
+						triangles.push_back(indices[j++]);
+
+					if (j < indices.size())
+						triangles.push_back(indices[j++]);
+
+					while (j < indices.size())
+					{
+						triangles.push_back(indices[j - 1]);
+						triangles.push_back(indices[0]);
+						triangles.push_back(indices[j++]);
+
+						if (j < indices.size())
+							triangles.push_back(indices[j++]);
+					}
+				}
+			}
+			else if (strip)
 			{
 				for (size_t j = 2; j < indices.size(); j++)
 				{
 					if (j % 2)
 					{
-						mesh.Indices.push_back(indices[j - 1]);
-						mesh.Indices.push_back(indices[j - 2]);
-						mesh.Indices.push_back(indices[j]);
+						triangles.push_back(indices[j - 1]);
+						triangles.push_back(indices[j - 2]);
+						triangles.push_back(indices[j]);
 					}
 					else
 					{
-						mesh.Indices.push_back(indices[j - 2]);
-						mesh.Indices.push_back(indices[j - 1]);
-						mesh.Indices.push_back(indices[j]);
+						triangles.push_back(indices[j - 2]);
+						triangles.push_back(indices[j - 1]);
+						triangles.push_back(indices[j]);
 					}
 				}
 			}
@@ -244,9 +794,9 @@ private:
 			{
 				for (size_t j = 2; j < indices.size(); j++)
 				{
-					mesh.Indices.push_back(indices[0]);
-					mesh.Indices.push_back(indices[j - 1]);
-					mesh.Indices.push_back(indices[j]);
+					triangles.push_back(indices[0]);
+					triangles.push_back(indices[j - 1]);
+					triangles.push_back(indices[j]);
 				}
 			}
 		}
@@ -255,7 +805,33 @@ private:
 	}
 
 
-	Model LoadModel(mstudiomodel_t* studioModel)
+	// Bone transforms of the default DoF values, the pose the mesh was modelled in
+	void GetReferencePose(float (*boneTransforms)[3][4])
+	{
+		auto pbones = GetPtr<mstudiobone_t>(m_StudioHeader->boneindex);
+
+		for (int i = 0; i < m_StudioHeader->numbones; i++)
+		{
+			vec4_t q;
+			float boneMatrix[3][4];
+
+			AngleQuaternion(&pbones[i].value[3], q);
+			QuaternionMatrix(q, boneMatrix);
+
+			boneMatrix[0][3] = pbones[i].value[0];
+			boneMatrix[1][3] = pbones[i].value[1];
+			boneMatrix[2][3] = pbones[i].value[2];
+
+			if (pbones[i].parent == -1)
+				memcpy(boneTransforms[i], boneMatrix, sizeof(float) * 12);
+			else
+				R_ConcatTransforms(boneTransforms[pbones[i].parent], boneMatrix, boneTransforms[i]);
+		}
+	}
+
+
+	// referencePose (from GetReferencePose) is needed for LoadOptions::OptimizeOverdraw only
+	Model LoadModel(mstudiomodel_t* studioModel, const float (*referencePose)[3][4], const LoadOptions& options, LoadReport& report)
 	{
 		Model model{};
 
@@ -263,99 +839,123 @@ private:
 		{
 			model.Meshes.reserve(static_cast<size_t>(studioModel->nummesh));
 
+			std::vector<Vertex> vertices;
+			VertexIndex vertexIndex(vertices, static_cast<size_t>(studioModel->numverts));
+
+			std::vector<std::vector<uint32_t>> meshIndices(static_cast<size_t>(studioModel->nummesh));
+
 			for (int i = 0; i < studioModel->nummesh; i++)
 			{
 				auto studioMesh = GetPtr<mstudiomesh_t>(studioModel->meshindex) + i;
-				auto mesh = LoadMesh(studioMesh, studioModel, model.Vertices);
+				auto mesh = LoadMesh(studioMesh, studioModel, vertexIndex, meshIndices[i], options, report);
 				model.Meshes.push_back(std::move(mesh));
 			}
-		}
-
-		return model;
-	}
 
+			for (const auto& indices : meshIndices)
+			{
+				report.NumIndices += indices.size();
 
-	BodyPart LoadBodyPart(mstudiobodyparts_t* studioBodyPart)
-	{
-		BodyPart bodypart{};
-
-		if (studioBodyPart->nummodels > 0)
-		{
-			bodypart.Models.reserve(static_cast<size_t>(studioBodyPart->nummodels));
+				if (options.MeasureVertexCache)
+					report.VertexTransformsBefore += MeshOptimizer::CountVertexTransforms(indices.data(), indices.size(), vertices.size());
+			}
 
-			for (int i = 0; i < studioBodyPart->nummodels; i++)
+			if (options.OptimizeVertexCache && !options.TriangleStrips)
 			{
-				auto studioModel = GetPtr<mstudiomodel_t>(studioBodyPart->modelindex) + i;
-				auto model = LoadModel(studioModel);
-				bodypart.Models.push_back(std::move(model));
+				for (auto& indices : meshIndices)
+					MeshOptimizer::OptimizeVertexCache(indices.data(), indices.size(), vertices.size());
 			}
-		}
 
-		return bodypart;
-	}
+			if (options.OptimizeOverdraw && !options.TriangleStrips && referencePose)
+			{
+				std::vector<float> positions(vertices.size() * 3);
 
+				auto lastBone = static_cast<uint32_t>(m_StudioHeader->numbones - 1);
 
-	Texture LoadTexture(mstudiotexture_t* studioTexture)
-	{
-		Texture texture{};
+				for (size_t i = 0; i < vertices.size(); i++)
+					VectorTransform(&vertices[i].Position.x, referencePose[(std::min)(vertices[i].Bone, lastBone)], &positions[i * 3]);
 
-		texture.Width = studioTexture->width;
-		texture.Height = studioTexture->height;
+				for (auto& indices : meshIndices)
+					MeshOptimizer::OptimizeOverdraw(indices.data(), indices.size(), positions.data(), vertices.size());
+			}
 
-		auto size = studioTexture->width * studioTexture->height;
+			if (options.OptimizeVertexCache)
+			{
+				// Meshes share the vertex buffer, so number vertices by first use over all of them
+				std::vector<uint32_t> remap(vertices.size(), MeshOptimizer::InvalidIndex);
+				uint32_t nextVertex = 0;
 
-		auto indices = AdjustPtr<uint8_t>(m_StudioTextureHeader, studioTexture->index);
-		auto palette = indices + size;
+				for (const auto& indices : meshIndices)
+					nextVertex = MeshOptimizer::AppendFetchRemap(indices.data(), indices.size(), remap.data(), nextVertex);
 
-		texture.Data.resize(static_cast<size_t>(size * 4));
-		auto pixels = texture.Data.data();
+				for (auto& index : remap)
+				{
+					if (index == MeshOptimizer::InvalidIndex)
+						index = nextVertex++;
+				}
 
-		for (int i = 0; i < size; i++)
-		{
-			auto color_offset = indices[i] * 3;
-			auto pixel_offset = i * 4;
+				for (auto& indices : meshIndices)
+					MeshOptimizer::RemapIndices(indices.data(), indices.size(), remap.data());
 
-			pixels[pixel_offset + 0] = palette[color_offset + 0];
-			pixels[pixel_offset + 1] = palette[color_offset + 1];
-			pixels[pixel_offset + 2] = palette[color_offset + 2];
-			pixels[pixel_offset + 3] = 0xff;
+				MeshOptimizer::RemapVertices(vertices, remap.data());
+			}
 
-			if (studioTexture->flags & STUDIO_NF_MASKED)
+			for (size_t i = 0; i < meshIndices.size(); i++)
 			{
-				if (indices[i] == 255)
-				{
-					pixels[pixel_offset + 0] = 0;
-					pixels[pixel_offset + 1] = 0;
-					pixels[pixel_offset + 2] = 0;
-					pixels[pixel_offset + 3] = 0;
-				}
+				if (options.MeasureVertexCache)
+					report.VertexTransformsAfter += MeshOptimizer::CountVertexTransforms(meshIndices[i].data(), meshIndices[i].size(), vertices.size());
+
+				model.Meshes[i].Indices = std::move(meshIndices[i]);
+			}
+
+			report.NumListIndices = report.NumTriangles * 3;
+			report.NumVertices = vertices.size();
+			report.FloatVertexBytes = sizeof(Vertex) * vertices.size();
+
+			if (options.CompactVertices)
+			{
+				model.CompactFormat = MakeCompactVertexFormat(vertices.data(), vertices.size());
+
+				std::vector<CompactVertex> compact(vertices.size());
+
+				for (size_t i = 0; i < vertices.size(); i++)
+					compact[i] = EncodeVertex(vertices[i], model.CompactFormat);
+
+				report.MaxCompactVertexError = MeasureCompactVertexError(vertices.data(), compact.data(), compact.size(), model.CompactFormat);
+				report.VertexBytes = sizeof(CompactVertex) * compact.size();
+
+				model.CompactVertices = std::move(compact);
+			}
+			else
+			{
+				report.VertexBytes = report.FloatVertexBytes;
+
+				model.Vertices = std::move(vertices);
 			}
 		}
 
-		return texture;
+		return model;
 	}
 
 
-	static std::vector<uint8_t> ReadAllBytes(const std::wstring& filePath)
+	Texture LoadTexture(mstudiotexture_t* studioTexture)
 	{
-		std::vector<uint8_t> buffer;
+		Texture texture{};
 
-		std::ifstream file(filePath, std::ios::binary);
+		texture.Width = studioTexture->width;
+		texture.Height = studioTexture->height;
 
-		if (!file)
-			return {};
+		auto size = studioTexture->width * studioTexture->height;
 
-		file.seekg(0, std::ios::end);
-		size_t file_size = file.tellg();
-		file.seekg(0, std::ios::beg);
+		auto indices = AdjustPtr<uint8_t>(m_StudioTextureHeader, studioTexture->index);
+		auto palette = indices + size;
 
-		buffer.resize(file_size);
-		file.read(reinterpret_cast<char*>(buffer.data()), file_size);
+		std::vector<uint32_t> table(256);
+		PaletteExpand::BuildTable(palette, (studioTexture->flags & STUDIO_NF_MASKED) != 0, table.data());
 
-		if (!file)
-			return {};
+		texture.Indices = Array<uint8_t>::View(indices, static_cast<size_t>(size));
+		texture.Palette = std::move(table);
 
-		return buffer;
+		return texture;
 	}
 
 
@@ -372,17 +972,17 @@ private:
 	}
 
 
-	static bool VerifyStudioFile(std::vector<uint8_t>& buffer)
+	static bool VerifyStudioFile(const MappedFile& file)
 	{
-		if (buffer.size() < sizeof(studiohdr_t))
+		if (file.GetSize() < sizeof(studiohdr_t))
 			return false;
 
-		auto signature = *reinterpret_cast<int*>(buffer.data());
+		auto signature = *reinterpret_cast<int*>(file.GetData());
 
 		if (signature != 0x54534449) // "IDST"
 			return false;
 
-		auto version = *reinterpret_cast<int*>(buffer.data() + 4);
+		auto version = *reinterpret_cast<int*>(file.GetData() + 4);
 
 		if (version != 10)
 			return false;
@@ -391,17 +991,17 @@ private:
 	}
 
 
-	static bool VerifySequenceStudioFile(std::vector<uint8_t>& buffer)
+	static bool VerifySequenceStudioFile(const MappedFile& file)
 	{
-		if (buffer.size() < sizeof(studioseqhdr_t))
+		if (file.GetSize() < sizeof(studioseqhdr_t))
 			return false;
 
-		auto signature = *reinterpret_cast<int*>(buffer.data());
+		auto signature = *reinterpret_cast<int*>(file.GetData());
 
 		if (signature != 0x51534449) // "IDSQ"
 			return false;
 
-		auto version = *reinterpret_cast<int*>(buffer.data() + 4);
+		auto version = *reinterpret_cast<int*>(file.GetData() + 4);
 
 		if (version != 10)
 			return false;
@@ -410,165 +1010,1303 @@ private:
 	}
 
 
-public:
+	static constexpr int MaxSequenceGroups = 32;
+	static constexpr size_t DefaultSequenceGroupCacheBudget = 32 * 1024 * 1024;
 
-	void LoadFromFile(const std::wstring& filePath)
+
+	// File is read without m_SequenceGroupMutex and only written with it held
+	struct SequenceGroupEntry
 	{
-		m_FileData = ReadAllBytes(filePath);
+		std::atomic<std::shared_ptr<MappedFile>> File;
+		std::weak_ptr<MappedFile> Evicted; // readmitted instead of mapped again while someone holds it
+		std::atomic<uint64_t> LastUse;
+		bool Missing;
+	};
 
-		if (m_FileData.empty())
-			return;
 
-		if (!VerifyStudioFile(m_FileData))
-			return;
+	// Drops least recently used groups until the cache fits its budget. The group that
+	// was just requested is never evicted, and neither is a group still held outside the
+	// cache: dropping it would free nothing. Pinned groups can keep the cache over budget.
+	void EvictSequenceGroups(int keepGroup)
+	{
+		while (m_SequenceGroupCacheSize > m_SequenceGroupCacheBudget)
+		{
+			int oldest = -1;
+			std::shared_ptr<MappedFile> oldestFile;
 
-		m_FilePath = filePath;
+			for (int i = 1; i < MaxSequenceGroups; i++)
+			{
+				if (i == keepGroup)
+					continue;
 
-		m_StudioHeader = reinterpret_cast<studiohdr_t*>(m_FileData.data());
+				auto file = m_SequenceGroups[i].File.load();
 
-		m_StudioTextureHeader = m_StudioHeader;
+				// One reference is the entry's, one is ours
+				if (!file || file.use_count() > 2)
+					continue;
 
-		if (m_StudioHeader->numtextures == 0)
+				if (oldest == -1 || m_SequenceGroups[i].LastUse.load(std::memory_order_relaxed) < m_SequenceGroups[oldest].LastUse.load(std::memory_order_relaxed))
+				{
+					oldest = i;
+					oldestFile = std::move(file);
+				}
+			}
+
+			if (oldest == -1)
+				break;
+
+			m_SequenceGroupCacheSize -= oldestFile->GetSize();
+			m_SequenceGroups[oldest].Evicted = oldestFile;
+			m_SequenceGroups[oldest].File.store(nullptr);
+		}
+	}
+
+
+	struct DecodedSequenceEntry
+	{
+		std::shared_ptr<const DecodedSequence> Sequence;
+		uint64_t LastUse;
+		bool Unavailable;
+		bool Decoding; // by a thread that has released m_DecodedSequenceMutex meanwhile
+	};
+
+
+	// Same span walk as StudioModelAnimating::CalcBonePosition/CalcBoneQuaternion, but
+	// the span and its first frame carry over from one frame to the next
+	static bool DecodeChannel(const mstudioanimvalue_t* span, int numFrames, bool rotation, DecodedKey* keys)
+	{
+		int base = 0;
+
+		for (int frame = 0; frame < numFrames; frame++)
 		{
-			// "testT.mdl"
-			auto externalFileName = AddSuffixToFileName(filePath, L"T");
+			int k = frame - base;
 
-			m_StudioTextureFileData = ReadAllBytes(externalFileName);
+			while (span->num.total <= k)
+			{
+				// A zero-length span would make the walk spin forever
+				if (span->num.total == 0)
+					return false;
 
-			if (VerifyStudioFile(m_StudioTextureFileData))
+				k -= span->num.total;
+				base += span->num.total;
+				span += span->num.valid + 1;
+			}
+
+			auto& key = keys[frame];
+
+			if (rotation)
+			{
+				if (span->num.valid > k)
+				{
+					key.Value1 = span[k + 1].value;
+
+					if (span->num.valid > k + 1)
+						key.Value2 = span[k + 2].value;
+					else if (span->num.total > k + 1)
+						key.Value2 = key.Value1;
+					else
+						key.Value2 = span[span->num.valid + 2].value;
+				}
+				else
+				{
+					key.Value1 = span[span->num.valid].value;
+
+					if (span->num.total > k + 1)
+						key.Value2 = key.Value1;
+					else
+						key.Value2 = span[span->num.valid + 2].value;
+				}
+
+				key.Interpolate = 0;
+			}
+			else
 			{
-				m_StudioTextureHeader = reinterpret_cast<studiohdr_t*>(m_StudioTextureFileData.data());
+				if (span->num.valid > k)
+				{
+					key.Value1 = span[k + 1].value;
+					key.Interpolate = span->num.valid > k + 1;
+					key.Value2 = key.Interpolate ? span[k + 2].value : key.Value1;
+				}
+				else
+				{
+					key.Value1 = span[span->num.valid].value;
+					key.Interpolate = span->num.total <= k + 1;
+					key.Value2 = key.Interpolate ? span[span->num.valid + 2].value : key.Value1;
+				}
 			}
 		}
 
-		if (m_StudioTextureHeader->numtextures > 0)
+		return true;
+	}
+
+
+	std::shared_ptr<DecodedSequence> DecodeSequence(int sequence)
+	{
+		auto seqdesc = GetPtr<mstudioseqdesc_t>(m_StudioHeader->seqindex) + sequence;
+
+		if (seqdesc->numframes <= 0 || seqdesc->numblends <= 0)
+			return {};
+
+		// Keeps a demand-loaded group alive while it is decoded
+		std::shared_ptr<const MappedFile> group;
+		const uint8_t* animBase;
+
+		if (seqdesc->seqgroup == 0)
+		{
+			auto seqgroup = GetPtr<mstudioseqgroup_t>(m_StudioHeader->seqgroupindex);
+			animBase = reinterpret_cast<const uint8_t*>(m_StudioHeader) + seqgroup->data;
+		}
+		else
+		{
+			group = GetSequenceGroup(seqdesc->seqgroup);
+
+			if (!group)
+				return {};
+
+			animBase = group->GetData();
+		}
+
+		auto anims = reinterpret_cast<const mstudioanim_t*>(animBase + seqdesc->animindex);
+
+		auto decoded = std::make_shared<DecodedSequence>();
+		decoded->Sequence = sequence;
+		decoded->NumFrames = seqdesc->numframes;
+		decoded->NumBones = m_StudioHeader->numbones;
+
+		auto numChannels = static_cast<size_t>(seqdesc->numblends) * m_StudioHeader->numbones * 6;
+		decoded->Channels.assign(numChannels, DecodedSequence::NoKeys);
+
+		size_t numKeys = 0;
+
+		for (size_t i = 0; i < numChannels; i++)
+		{
+			if (anims[i / 6].offset[i % 6] != 0)
+				numKeys += static_cast<size_t>(seqdesc->numframes);
+		}
+
+		decoded->Keys.resize(numKeys);
+
+		uint32_t nextKey = 0;
+
+		for (size_t i = 0; i < numChannels; i++)
+		{
+			const auto& anim = anims[i / 6];
+			auto channel = i % 6;
+
+			if (anim.offset[channel] == 0)
+				continue;
+
+			auto span = reinterpret_cast<const mstudioanimvalue_t*>(reinterpret_cast<const uint8_t*>(&anim) + anim.offset[channel]);
+
+			if (!DecodeChannel(span, seqdesc->numframes, channel >= 3, decoded->Keys.data() + nextKey))
+				return {};
+
+			decoded->Channels[i] = nextKey;
+			nextKey += static_cast<uint32_t>(seqdesc->numframes);
+		}
+
+		return decoded;
+	}
+
+
+	void EvictDecodedSequences(int keepSequence)
+	{
+		while (m_DecodedSequenceCacheSize > m_DecodedSequenceCacheBudget)
+		{
+			int oldest = -1;
+
+			for (int i = 0; i < static_cast<int>(m_DecodedSequences.size()); i++)
+			{
+				if (i == keepSequence || !m_DecodedSequences[i].Sequence)
+					continue;
+
+				if (oldest == -1 || m_DecodedSequences[i].LastUse < m_DecodedSequences[oldest].LastUse)
+					oldest = i;
+			}
+
+			if (oldest == -1)
+				break;
+
+			m_DecodedSequenceCacheSize -= m_DecodedSequences[oldest].Sequence->GetSize();
+			m_DecodedSequences[oldest].Sequence.reset();
+		}
+	}
+
+
+	//
+	// Model cache: a versioned file holding the finished vertex, index and texel
+	// arrays. Every array starts on a cache-line boundary, so a valid cache is used
+	// in place from its mapping and loading it only rebuilds the small tables.
+	//
+
+	static constexpr uint32_t CacheMagic = 0x434d5347; // "GSMC"
+	static constexpr uint32_t CacheVersion = 3;
+	static constexpr uint64_t CacheAlignment = 64;
+
+	// Load options that change the cached arrays
+	static constexpr uint32_t CacheBuildCompactVertices = 1 << 0;
+	static constexpr uint32_t CacheBuildOptimizeVertexCache = 1 << 1;
+	static constexpr uint32_t CacheBuildTriangleStrips = 1 << 2;
+	static constexpr uint32_t CacheBuildOptimizeOverdraw = 1 << 3;
+
+
+	struct CacheSource
+	{
+		uint64_t Size;
+		int64_t WriteTime;
+		uint64_t Hash;
+	};
+
+
+	struct CacheHeader
+	{
+		uint32_t Magic;
+		uint32_t Version;
+		uint32_t BuildFlags;
+		uint32_t NumTextures;
+		uint32_t NumBodyParts;
+		uint32_t NumModels;
+		uint32_t NumMeshes;
+		uint32_t Reserved;
+		CacheSource Sources[2]; // the model and its "T.mdl"
+		uint64_t TextureTableOffset;
+		uint64_t BodyPartTableOffset;
+		uint64_t ModelTableOffset;
+		uint64_t MeshTableOffset;
+		uint64_t FileSize;
+	};
+
+
+	// Texels are not cached: they are viewed in the (validated) texture source file
+	struct CacheTexture
+	{
+		int32_t Width;
+		int32_t Height;
+		uint64_t IndexOffset;
+		uint64_t PaletteOffset;
+	};
+
+
+	struct CacheBodyPart
+	{
+		uint32_t FirstModel;
+		uint32_t NumModels;
+	};
+
+
+	// Vertices are CompactVertex (decoded with Format) under CacheBuildCompactVertices
+	struct CacheModel
+	{
+		uint64_t VertexOffset;
+		uint32_t NumVertices;
+		uint32_t FirstMesh;
+		uint32_t NumMeshes;
+		uint32_t Reserved;
+		CompactVertexFormat Format;
+	};
+
+
+	struct CacheMesh
+	{
+		uint64_t IndexOffset;
+		uint32_t NumIndices;
+		int32_t TextureId;
+	};
+
+
+	static uint64_t HashBytes(const uint8_t* data, size_t size)
+	{
+		uint64_t hash = 0xcbf29ce484222325ull ^ size;
+		size_t i = 0;
+
+		for (; i + 8 <= size; i += 8)
+		{
+			uint64_t word;
+			memcpy(&word, data + i, sizeof(word));
+
+			hash = (hash ^ word) * 0x100000001b3ull;
+			hash ^= hash >> 31;
+		}
+
+		for (; i < size; i++)
+			hash = (hash ^ data[i]) * 0x100000001b3ull;
+
+		return hash;
+	}
+
+
+	static CacheSource DescribeSource(const std::wstring& filePath, const MappedFile& file)
+	{
+		CacheSource source{};
+
+		if (file.IsEmpty())
+			return source;
+
+		std::error_code error;
+		auto writeTime = std::filesystem::last_write_time(filePath, error);
+
+		source.Size = file.GetSize();
+		source.WriteTime = error ? 0 : static_cast<int64_t>(writeTime.time_since_epoch().count());
+		source.Hash = HashBytes(file.GetData(), file.GetSize());
+
+		return source;
+	}
+
+
+	static bool IsSameSource(const CacheSource& cached, const std::wstring& filePath, const MappedFile& file)
+	{
+		if (cached.Size != file.GetSize())
+			return false;
+
+		if (file.IsEmpty())
+			return true;
+
+		std::error_code error;
+		auto writeTime = std::filesystem::last_write_time(filePath, error);
+
+		if (error || cached.WriteTime != static_cast<int64_t>(writeTime.time_since_epoch().count()))
+			return false;
+
+		return cached.Hash == HashBytes(file.GetData(), file.GetSize());
+	}
+
+
+	static std::wstring GetCacheFilePath(const std::wstring& filePath, const LoadOptions& options)
+	{
+		std::filesystem::path path(filePath);
+
+		if (options.CacheDirectory.empty())
+			return path.wstring() + L".cache";
+
+		// A shared directory sees many models of the same name (every mod has a player.mdl),
+		// so the name also carries a hash of where the model is
+		std::error_code error;
+		auto canonical = std::filesystem::weakly_canonical(path, error);
+
+		if (error)
+			canonical = std::filesystem::absolute(path, error);
+
+		auto key = canonical.generic_wstring();
+		uint64_t hash = HashBytes(reinterpret_cast<const uint8_t*>(key.data()), key.size() * sizeof(wchar_t));
+
+		wchar_t suffix[18];
+		swprintf(suffix, std::size(suffix), L"-%016llx", static_cast<unsigned long long>(hash));
+
+		return (std::filesystem::path(options.CacheDirectory) / (path.stem().wstring() + suffix + L".cache")).wstring();
+	}
+
+
+	static uint32_t GetCacheBuildFlags(const LoadOptions& options)
+	{
+		uint32_t flags = 0;
+
+		if (options.CompactVertices)
+			flags |= CacheBuildCompactVertices;
+
+		if (options.OptimizeVertexCache)
+			flags |= CacheBuildOptimizeVertexCache;
+
+		if (options.TriangleStrips)
+			flags |= CacheBuildTriangleStrips;
+
+		if (options.OptimizeOverdraw)
+			flags |= CacheBuildOptimizeOverdraw;
+
+		return flags;
+	}
+
+
+	bool LoadCache(const std::wstring& cachePath, const LoadOptions& options)
+	{
+		MappedFile file;
+
+		if (!file.Open(cachePath))
+			return false;
+
+		if (file.GetSize() < sizeof(CacheHeader))
+			return false;
+
+		auto base = file.GetData();
+		auto header = reinterpret_cast<const CacheHeader*>(base);
+
+		if (header->Magic != CacheMagic || header->Version != CacheVersion || header->FileSize != file.GetSize())
+			return false;
+
+		if (header->BuildFlags != GetCacheBuildFlags(options))
+			return false;
+
+		if (!IsSameSource(header->Sources[0], m_FilePath, m_FileData))
+			return false;
+
+		if (!IsSameSource(header->Sources[1], AddSuffixToFileName(m_FilePath, L"T"), m_StudioTextureFileData))
+			return false;
+
+		auto inFile = [&file](uint64_t offset, uint64_t size)
+		{
+			return offset <= file.GetSize() && size <= file.GetSize() - offset;
+		};
+
+		if (!inFile(header->TextureTableOffset, sizeof(CacheTexture) * uint64_t(header->NumTextures)) ||
+			!inFile(header->BodyPartTableOffset, sizeof(CacheBodyPart) * uint64_t(header->NumBodyParts)) ||
+			!inFile(header->ModelTableOffset, sizeof(CacheModel) * uint64_t(header->NumModels)) ||
+			!inFile(header->MeshTableOffset, sizeof(CacheMesh) * uint64_t(header->NumMeshes)))
+			return false;
+
+		auto cacheTextures = reinterpret_cast<const CacheTexture*>(base + header->TextureTableOffset);
+		auto cacheBodyParts = reinterpret_cast<const CacheBodyPart*>(base + header->BodyPartTableOffset);
+		auto cacheModels = reinterpret_cast<const CacheModel*>(base + header->ModelTableOffset);
+		auto cacheMeshes = reinterpret_cast<const CacheMesh*>(base + header->MeshTableOffset);
+
+		std::vector<Texture> textures(header->NumTextures);
+
+		auto textureBase = reinterpret_cast<const uint8_t*>(m_StudioTextureHeader);
+		auto textureSourceSize = (m_StudioTextureHeader == m_StudioHeader) ? m_FileData.GetSize() : m_StudioTextureFileData.GetSize();
+
+		for (uint32_t i = 0; i < header->NumTextures; i++)
+		{
+			const auto& cacheTexture = cacheTextures[i];
+
+			if (cacheTexture.Width < 0 || cacheTexture.Height < 0)
+				return false;
+
+			auto size = uint64_t(cacheTexture.Width) * uint64_t(cacheTexture.Height);
+
+			if (cacheTexture.IndexOffset > textureSourceSize || size > textureSourceSize - cacheTexture.IndexOffset)
+				return false;
+
+			if (!inFile(cacheTexture.PaletteOffset, sizeof(uint32_t) * 256))
+				return false;
+
+			textures[i].Width = cacheTexture.Width;
+			textures[i].Height = cacheTexture.Height;
+			textures[i].Indices = Array<uint8_t>::View(textureBase + cacheTexture.IndexOffset, static_cast<size_t>(size));
+			textures[i].Palette = Array<uint32_t>::View(reinterpret_cast<const uint32_t*>(base + cacheTexture.PaletteOffset), 256);
+		}
+
+		std::vector<BodyPart> bodyParts(header->NumBodyParts);
+
+		for (uint32_t i = 0; i < header->NumBodyParts; i++)
+		{
+			const auto& cacheBodyPart = cacheBodyParts[i];
+
+			if (cacheBodyPart.FirstModel > header->NumModels || cacheBodyPart.NumModels > header->NumModels - cacheBodyPart.FirstModel)
+				return false;
+
+			bodyParts[i].Models.resize(cacheBodyPart.NumModels);
+
+			for (uint32_t j = 0; j < cacheBodyPart.NumModels; j++)
+			{
+				const auto& cacheModel = cacheModels[cacheBodyPart.FirstModel + j];
+				auto& model = bodyParts[i].Models[j];
+
+				auto vertexSize = options.CompactVertices ? sizeof(CompactVertex) : sizeof(Vertex);
+
+				if (!inFile(cacheModel.VertexOffset, vertexSize * uint64_t(cacheModel.NumVertices)))
+					return false;
+
+				if (cacheModel.FirstMesh > header->NumMeshes || cacheModel.NumMeshes > header->NumMeshes - cacheModel.FirstMesh)
+					return false;
+
+				if (options.CompactVertices)
+				{
+					model.CompactVertices = Array<CompactVertex>::View(reinterpret_cast<const CompactVertex*>(base + cacheModel.VertexOffset), cacheModel.NumVertices);
+					model.CompactFormat = cacheModel.Format;
+				}
+				else
+				{
+					model.Vertices = Array<Vertex>::View(reinterpret_cast<const Vertex*>(base + cacheModel.VertexOffset), cacheModel.NumVertices);
+				}
+				model.Meshes.resize(cacheModel.NumMeshes);
+
+				for (uint32_t k = 0; k < cacheModel.NumMeshes; k++)
+				{
+					const auto& cacheMesh = cacheMeshes[cacheModel.FirstMesh + k];
+					auto& mesh = model.Meshes[k];
+
+					if (!inFile(cacheMesh.IndexOffset, sizeof(uint32_t) * uint64_t(cacheMesh.NumIndices)))
+						return false;
+
+					if (cacheMesh.TextureId < 0 || static_cast<uint32_t>(cacheMesh.TextureId) >= header->NumTextures)
+						return false;
+
+					auto indices = reinterpret_cast<const uint32_t*>(base + cacheMesh.IndexOffset);
+
+					// The renderers index the vertex buffer with these unchecked
+					for (uint32_t n = 0; n < cacheMesh.NumIndices; n++)
+					{
+						if (indices[n] >= cacheModel.NumVertices && !(options.TriangleStrips && indices[n] == RestartIndex))
+							return false;
+					}
+
+					mesh.Indices = Array<uint32_t>::View(indices, cacheMesh.NumIndices);
+					mesh.TextureId = cacheMesh.TextureId;
+					mesh.Topology = options.TriangleStrips ? PrimitiveTopology::TriangleStrip : PrimitiveTopology::TriangleList;
+				}
+			}
+		}
+
+		m_Textures = std::move(textures);
+		m_BodyParts = std::move(bodyParts);
+		m_CacheFile = std::move(file);
+
+		return true;
+	}
+
+
+	bool SaveCache(const std::wstring& cachePath, const LoadOptions& options) const
+	{
+		std::vector<uint8_t> buffer(sizeof(CacheHeader));
+
+		auto append = [&buffer](const void* data, size_t size, uint64_t alignment)
+		{
+			auto offset = (buffer.size() + alignment - 1) / alignment * alignment;
+			buffer.resize(static_cast<size_t>(offset) + size);
+
+			if (size > 0)
+				memcpy(buffer.data() + offset, data, size);
+
+			return static_cast<uint64_t>(offset);
+		};
+
+		std::vector<CacheTexture> cacheTextures;
+		std::vector<CacheBodyPart> cacheBodyParts;
+		std::vector<CacheModel> cacheModels;
+		std::vector<CacheMesh> cacheMeshes;
+
+		auto textureBase = reinterpret_cast<const uint8_t*>(m_StudioTextureHeader);
+
+		for (const auto& texture : m_Textures)
+		{
+			CacheTexture cacheTexture{};
+			cacheTexture.Width = texture.Width;
+			cacheTexture.Height = texture.Height;
+			cacheTexture.IndexOffset = static_cast<uint64_t>(texture.Indices.data() - textureBase);
+			cacheTexture.PaletteOffset = append(texture.Palette.data(), sizeof(uint32_t) * texture.Palette.size(), CacheAlignment);
+			cacheTextures.push_back(cacheTexture);
+		}
+
+		for (const auto& bodyPart : m_BodyParts)
+		{
+			CacheBodyPart cacheBodyPart{};
+			cacheBodyPart.FirstModel = static_cast<uint32_t>(cacheModels.size());
+			cacheBodyPart.NumModels = static_cast<uint32_t>(bodyPart.Models.size());
+			cacheBodyParts.push_back(cacheBodyPart);
+
+			for (const auto& model : bodyPart.Models)
+			{
+				CacheModel cacheModel{};
+				cacheModel.NumVertices = static_cast<uint32_t>(model.GetVertexCount());
+
+				if (options.CompactVertices)
+				{
+					cacheModel.VertexOffset = append(model.CompactVertices.data(), sizeof(CompactVertex) * model.CompactVertices.size(), CacheAlignment);
+					cacheModel.Format = model.CompactFormat;
+				}
+				else
+				{
+					cacheModel.VertexOffset = append(model.Vertices.data(), sizeof(Vertex) * model.Vertices.size(), CacheAlignment);
+				}
+
+				cacheModel.FirstMesh = static_cast<uint32_t>(cacheMeshes.size());
+				cacheModel.NumMeshes = static_cast<uint32_t>(model.Meshes.size());
+				cacheModels.push_back(cacheModel);
+
+				for (const auto& mesh : model.Meshes)
+				{
+					CacheMesh cacheMesh{};
+					cacheMesh.NumIndices = static_cast<uint32_t>(mesh.Indices.size());
+					cacheMesh.IndexOffset = append(mesh.Indices.data(), sizeof(uint32_t) * mesh.Indices.size(), CacheAlignment);
+					cacheMesh.TextureId = mesh.TextureId;
+					cacheMeshes.push_back(cacheMesh);
+				}
+			}
+		}
+
+		CacheHeader header{};
+		header.Magic = CacheMagic;
+		header.Version = CacheVersion;
+		header.BuildFlags = GetCacheBuildFlags(options);
+		header.NumTextures = static_cast<uint32_t>(cacheTextures.size());
+		header.NumBodyParts = static_cast<uint32_t>(cacheBodyParts.size());
+		header.NumModels = static_cast<uint32_t>(cacheModels.size());
+		header.NumMeshes = static_cast<uint32_t>(cacheMeshes.size());
+		header.Sources[0] = DescribeSource(m_FilePath, m_FileData);
+		header.Sources[1] = DescribeSource(AddSuffixToFileName(m_FilePath, L"T"), m_StudioTextureFileData);
+		header.TextureTableOffset = append(cacheTextures.data(), sizeof(CacheTexture) * cacheTextures.size(), 8);
+		header.BodyPartTableOffset = append(cacheBodyParts.data(), sizeof(CacheBodyPart) * cacheBodyParts.size(), 8);
+		header.ModelTableOffset = append(cacheModels.data(), sizeof(CacheModel) * cacheModels.size(), 8);
+		header.MeshTableOffset = append(cacheMeshes.data(), sizeof(CacheMesh) * cacheMeshes.size(), 8);
+		header.FileSize = buffer.size();
+
+		memcpy(buffer.data(), &header, sizeof(header));
+
+		// Write next to the target and rename, so readers never see a partial cache. The
+		// temporary name is unique to this writer, as other processes or threads may be
+		// building the same cache.
+		auto unique = (static_cast<uint64_t>(std::random_device{}()) << 32) ^ std::hash<std::thread::id>{}(std::this_thread::get_id()) ^
+			static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+
+		wchar_t suffix[22];
+		swprintf(suffix, std::size(suffix), L".%016llx.tmp", static_cast<unsigned long long>(unique));
+
+		auto tempPath = cachePath + suffix;
+
+		std::error_code error;
+
+		{
+			std::ofstream file(std::filesystem::path(tempPath), std::ios::binary | std::ios::trunc);
+
+			if (!file)
+				return false;
+
+			file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size());
+			file.close();
+
+			if (!file)
+			{
+				std::filesystem::remove(tempPath, error);
+				return false;
+			}
+		}
+
+		std::filesystem::rename(tempPath, cachePath, error);
+
+		if (error)
+		{
+			std::filesystem::remove(tempPath, error);
+			return false;
+		}
+
+		return true;
+	}
+
+
+public:
+
+	void LoadFromFile(const std::wstring& filePath)
+	{
+		LoadFromFile(filePath, LoadOptions{});
+	}
+
+
+	void LoadFromFile(const std::wstring& filePath, const LoadOptions& options)
+	{
+		if (!m_FileData.Open(filePath))
+			return;
+
+		if (!VerifyStudioFile(m_FileData))
+			return;
+
+		m_FilePath = filePath;
+
+		static std::atomic<uint64_t> nextGeneration{ 1 };
+		m_Generation = nextGeneration.fetch_add(1, std::memory_order_relaxed);
+
+		m_StudioHeader = reinterpret_cast<studiohdr_t*>(m_FileData.GetData());
+
+		m_StudioTextureHeader = m_StudioHeader;
+
+		if (m_StudioHeader->numtextures == 0)
+		{
+			// "testT.mdl"
+			auto externalFileName = AddSuffixToFileName(filePath, L"T");
+
+			m_StudioTextureFileData.Open(externalFileName);
+
+			if (VerifyStudioFile(m_StudioTextureFileData))
+			{
+				m_StudioTextureHeader = reinterpret_cast<studiohdr_t*>(m_StudioTextureFileData.GetData());
+			}
+		}
+
+		// Start reading the sequence group of the default sequence while the meshes are built
+		std::future<void> sequenceGroupPrefetch;
+
+		if (options.Workers && m_StudioHeader->numseq > 0)
+		{
+			auto group = GetPtr<mstudioseqdesc_t>(m_StudioHeader->seqindex)->seqgroup;
+
+			if (group > 0)
+				sequenceGroupPrefetch = options.Workers->Async([this, group]() { GetSequenceGroup(group); });
+		}
+
+		// The prefetch uses this, so it must finish however the load ends, a throw included
+		struct PrefetchWait
+		{
+			std::future<void>& Prefetch;
+
+			~PrefetchWait()
+			{
+				if (Prefetch.valid())
+					Prefetch.wait();
+			}
+		} prefetchWait{ sequenceGroupPrefetch };
+
+		std::wstring cachePath;
+
+		if (options.UseCache)
+		{
+			cachePath = GetCacheFilePath(filePath, options);
+
+			if (LoadCache(cachePath, options))
+				return;
+		}
+
+		if (m_StudioTextureHeader->numtextures > 0)
+			m_Textures.resize(static_cast<size_t>(m_StudioTextureHeader->numtextures));
+
+		// Every mstudiomodel_t is an independent unit of work, whichever body part it belongs to
+		std::vector<std::pair<int, int>> studioModels;
+
+		if (m_StudioHeader->numbodyparts > 0)
+		{
+			m_BodyParts.resize(static_cast<size_t>(m_StudioHeader->numbodyparts));
+
+			for (int i = 0; i < m_StudioHeader->numbodyparts; i++)
+			{
+				auto studioBodyPart = GetPtr<mstudiobodyparts_t>(m_StudioHeader->bodypartindex) + i;
+
+				if (studioBodyPart->nummodels <= 0)
+					continue;
+
+				m_BodyParts[i].Models.resize(static_cast<size_t>(studioBodyPart->nummodels));
+
+				for (int j = 0; j < studioBodyPart->nummodels; j++)
+					studioModels.emplace_back(i, j);
+			}
+		}
+
+		std::vector<LoadReport> modelReports(studioModels.size());
+
+		std::vector<float> referencePose;
+
+		if (options.OptimizeOverdraw && m_StudioHeader->numbones > 0)
+		{
+			referencePose.resize(static_cast<size_t>(m_StudioHeader->numbones) * 12);
+			GetReferencePose(reinterpret_cast<float(*)[3][4]>(referencePose.data()));
+		}
+
+		auto loadItem = [this, &studioModels, &modelReports, &referencePose, &options](size_t item)
+		{
+			if (item < m_Textures.size())
+			{
+				auto studioTexture = AdjustPtr<mstudiotexture_t>(m_StudioTextureHeader, m_StudioTextureHeader->textureindex) + item;
+				m_Textures[item] = LoadTexture(studioTexture);
+				return;
+			}
+
+			auto modelItem = item - m_Textures.size();
+			auto [bodyPartIndex, modelIndex] = studioModels[modelItem];
+
+			auto studioBodyPart = GetPtr<mstudiobodyparts_t>(m_StudioHeader->bodypartindex) + bodyPartIndex;
+			auto studioModel = GetPtr<mstudiomodel_t>(studioBodyPart->modelindex) + modelIndex;
+
+			auto pose = referencePose.empty() ? nullptr : reinterpret_cast<const float(*)[3][4]>(referencePose.data());
+
+			m_BodyParts[bodyPartIndex].Models[modelIndex] = LoadModel(studioModel, pose, options, modelReports[modelItem]);
+		};
+
+		// Results land in their slots, so the order matches a serial load exactly
+		auto count = m_Textures.size() + studioModels.size();
+
+		if (options.Workers)
+		{
+			options.Workers->ParallelFor(count, loadItem);
+		}
+		else
+		{
+			for (size_t i = 0; i < count; i++)
+				loadItem(i);
+		}
+
+		for (const auto& modelReport : modelReports)
+			m_LoadReport.Add(modelReport);
+
+		m_ModelLoadReports = std::move(modelReports);
+
+		if (options.UseCache)
+			SaveCache(cachePath, options);
+	}
+
+
+	const std::wstring& GetFilePath() const
+	{
+		return m_FilePath;
+	}
+
+
+	// Unique to each load over the whole process, so a model reloaded in place, or a new
+	// model at the address of a destroyed one, is never mistaken for the old one
+	uint64_t GetGeneration() const
+	{
+		return m_Generation;
+	}
+
+
+	studiohdr_t* GetStudioHeader() const
+	{
+		return m_StudioHeader;
+	}
+
+
+	const std::vector<BodyPart>& GetBodyParts() const
+	{
+		return m_BodyParts;
+	}
+
+
+	const std::vector<Texture>& GetTextures() const
+	{
+		return m_Textures;
+	}
+
+
+	const LoadReport& GetLoadReport() const
+	{
+		return m_LoadReport;
+	}
+
+
+	// One entry per mstudiomodel_t, body part by body part
+	const std::vector<LoadReport>& GetModelLoadReports() const
+	{
+		return m_ModelLoadReports;
+	}
+
+
+	// Returns a demand-loaded sequence group ("test01.mdl"), reading it on first
+	// use. The returned pointer keeps the file alive, and resident in the cache, for
+	// as long as it is held. Resident groups are returned without taking the mutex.
+	std::shared_ptr<const MappedFile> GetSequenceGroup(int group)
+	{
+		if (!m_StudioHeader)
+			return {};
+
+		if (group <= 0 || group >= m_StudioHeader->numseqgroups || group >= MaxSequenceGroups)
+			return {};
+
+		auto& entry = m_SequenceGroups[group];
+
+		entry.LastUse.store(m_SequenceGroupClock.fetch_add(1, std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+		if (auto file = entry.File.load())
+			return file;
+
+		std::lock_guard<std::mutex> lock(m_SequenceGroupMutex);
+
+		if (auto file = entry.File.load())
+			return file;
+
+		if (entry.Missing)
+			return {};
+
+		// Evicted, but a caller that fetched it just before still has it
+		if (auto file = entry.Evicted.lock())
+		{
+			entry.File.store(file);
+			m_SequenceGroupCacheSize += file->GetSize();
+
+			EvictSequenceGroups(group);
+
+			return file;
+		}
+
+		wchar_t suffix[4];
+
+		// "test01.mdl"
+		swprintf(suffix, std::size(suffix), L"%02d", group);
+
+		auto file = std::make_shared<MappedFile>();
+		file->Open(AddSuffixToFileName(m_FilePath, suffix));
+
+		if (!VerifySequenceStudioFile(*file))
+		{
+			entry.Missing = true;
+			return {};
+		}
+
+		entry.File.store(file);
+		m_SequenceGroupCacheSize += file->GetSize();
+
+		EvictSequenceGroups(group);
+
+		return file;
+	}
+
+
+	void SetSequenceGroupCacheBudget(size_t budget)
+	{
+		std::lock_guard<std::mutex> lock(m_SequenceGroupMutex);
+
+		m_SequenceGroupCacheBudget = budget;
+
+		EvictSequenceGroups(0);
+	}
+
+
+	size_t GetSequenceGroupCacheSize() const
+	{
+		std::lock_guard<std::mutex> lock(m_SequenceGroupMutex);
+
+		return m_SequenceGroupCacheSize;
+	}
+
+
+	// Returns the decoded keys of a sequence, decoding it on first use. Returns null
+	// while the decoded cache is disabled (budget 0), or if the sequence cannot be
+	// decoded or alone exceeds the budget; animators then walk the RLE spans.
+	std::shared_ptr<const DecodedSequence> GetDecodedSequence(int sequence)
+	{
+		if (!m_StudioHeader || sequence < 0 || sequence >= m_StudioHeader->numseq)
+			return {};
+
+		std::unique_lock<std::mutex> lock(m_DecodedSequenceMutex);
+
+		if (m_DecodedSequenceCacheBudget == 0)
+			return {};
+
+		if (m_DecodedSequences.size() != static_cast<size_t>(m_StudioHeader->numseq))
+			m_DecodedSequences.resize(static_cast<size_t>(m_StudioHeader->numseq));
+
+		m_DecodedSequences[sequence].LastUse = ++m_DecodedSequenceClock;
+
+		// Another thread decoding this sequence publishes it shortly; other sequences are not held up
+		m_DecodedSequenceDecoded.wait(lock, [this, sequence]() { return !m_DecodedSequences[sequence].Decoding; });
+
+		if (m_DecodedSequences[sequence].Sequence || m_DecodedSequences[sequence].Unavailable)
+			return m_DecodedSequences[sequence].Sequence;
+
+		m_DecodedSequences[sequence].Decoding = true;
+
+		// Reads only the model data and the sequence group cache, which locks on its own
+		lock.unlock();
+
+		std::shared_ptr<const DecodedSequence> decoded;
+
+		try
+		{
+			decoded = DecodeSequence(sequence);
+		}
+		catch (...)
+		{
+			lock.lock();
+			m_DecodedSequences[sequence].Decoding = false;
+			m_DecodedSequenceDecoded.notify_all();
+			throw;
+		}
+
+		lock.lock();
+
+		auto& entry = m_DecodedSequences[sequence];
+		entry.Decoding = false;
+		m_DecodedSequenceDecoded.notify_all();
+
+		if (!decoded || decoded->GetSize() > m_DecodedSequenceCacheBudget)
+		{
+			entry.Unavailable = true;
+			return {};
+		}
+
+		entry.Sequence = std::move(decoded);
+		m_DecodedSequenceCacheSize += entry.Sequence->GetSize();
+
+		EvictDecodedSequences(sequence);
+
+		return entry.Sequence;
+	}
+
+
+	// 0 (the default) disables the decoded cache
+	void SetDecodedSequenceCacheBudget(size_t budget)
+	{
+		std::lock_guard<std::mutex> lock(m_DecodedSequenceMutex);
+
+		m_DecodedSequenceCacheBudget = budget;
+
+		// Sequences that did not fit before may fit now
+		for (auto& entry : m_DecodedSequences)
+			entry.Unavailable = false;
+
+		EvictDecodedSequences(-1);
+	}
+
+
+	size_t GetDecodedSequenceCacheSize() const
+	{
+		std::lock_guard<std::mutex> lock(m_DecodedSequenceMutex);
+
+		return m_DecodedSequenceCacheSize;
+	}
+
+
+	StudioModel()
+		: m_Generation{}
+		, m_StudioHeader{}
+		, m_StudioTextureHeader{}
+		, m_SequenceGroups{}
+		, m_SequenceGroupClock{}
+		, m_SequenceGroupCacheSize{}
+		, m_SequenceGroupCacheBudget{ DefaultSequenceGroupCacheBudget }
+		, m_DecodedSequenceClock{}
+		, m_DecodedSequenceCacheSize{}
+		, m_DecodedSequenceCacheBudget{}
+		, m_LoadReport{}
+	{
+		// TODO
+	}
+
+
+private:
+
+	std::wstring m_FilePath;
+	uint64_t m_Generation;
+
+	MappedFile m_FileData;
+	studiohdr_t* m_StudioHeader;
+
+	MappedFile m_StudioTextureFileData;
+	studiohdr_t* m_StudioTextureHeader;
+
+	MappedFile m_CacheFile;
+
+	SequenceGroupEntry m_SequenceGroups[MaxSequenceGroups];
+	std::atomic<uint64_t> m_SequenceGroupClock;
+	size_t m_SequenceGroupCacheSize;
+	size_t m_SequenceGroupCacheBudget;
+	mutable std::mutex m_SequenceGroupMutex;
+
+	std::vector<DecodedSequenceEntry> m_DecodedSequences;
+	uint64_t m_DecodedSequenceClock;
+	size_t m_DecodedSequenceCacheSize;
+	size_t m_DecodedSequenceCacheBudget;
+	mutable std::mutex m_DecodedSequenceMutex;
+	std::condition_variable m_DecodedSequenceDecoded; // an entry stopped Decoding
+
+	std::vector<BodyPart> m_BodyParts;
+	std::vector<Texture> m_Textures;
+
+	LoadReport m_LoadReport;
+	std::vector<LoadReport> m_ModelLoadReports;
+};
+
+
+class StudioModelAnimating
+{
+public:
+
+	// Blend and conversion space for SetUpBones. Nothing in it outlives one call,
+	// so one per thread serves any number of animators.
+	struct Scratch
+	{
+		vec3_t Pos[4][MAXSTUDIOBONES];
+		float Q[4][4][MAXSTUDIOBONES]; // per blend, component by component for BoneKernels
+		float Angle1[3][MAXSTUDIOBONES];
+		float Angle2[3][MAXSTUDIOBONES];
+		float BoneMatrix[MAXSTUDIOBONES][3][4];
+		bool Changed[MAXSTUDIOBONES];
+	};
+
+
+	static Scratch& GetThreadScratch()
+	{
+		// Kept on the heap, a thread-local block this size would be set up for every thread
+		thread_local std::unique_ptr<Scratch> scratch = std::make_unique<Scratch>();
+		return *scratch;
+	}
+
+
+	// Everything that selects one pose of a model
+	struct PoseParameters
+	{
+		int Sequence;
+		float Frame;
+		byte Controllers[4];
+		byte Blendings[2];
+		byte Mouth;
+	};
+
+
+	// Bone palettes as uploaded to the GPU, one entry per bone of the model.
+	// Matrix3x4 is the layout SetUpBones writes, three rows of a model space transform,
+	// so SetUpBones can fill a mapped buffer directly.
+	enum class BonePaletteLayout
+	{
+		Matrix3x4,
+		QuaternionTranslation, // PaletteBone
+	};
+
+
+	struct PaletteBone
+	{
+		float Rotation[4]; // x, y, z, w
+		float Position[3];
+		float Reserved;
+	};
+
+
+	// Bones First .. First + Count - 1
+	struct BoneRange
+	{
+		int First;
+		int Count;
+	};
+
+
+	static size_t GetBonePaletteStride(BonePaletteLayout layout)
+	{
+		return layout == BonePaletteLayout::Matrix3x4 ? sizeof(float) * 12 : sizeof(PaletteBone);
+	}
+
+
+	// The quaternion of a rotation matrix; matrix may hold a translation in its last column
+	static void MatrixQuaternion(const float (*matrix)[4], float* q)
+	{
+		float trace = matrix[0][0] + matrix[1][1] + matrix[2][2];
+
+		if (trace > 0.0f)
 		{
-			m_Textures.reserve(static_cast<size_t>(m_StudioTextureHeader->numtextures));
+			float s = sqrtf(trace + 1.0f) * 2.0f;
 
-			for (int i = 0; i < m_StudioTextureHeader->numtextures; i++)
-			{
-				auto studioTexture = AdjustPtr<mstudiotexture_t>(m_StudioTextureHeader, m_StudioTextureHeader->textureindex) + i;
-				auto texture = LoadTexture(studioTexture);
-				m_Textures.push_back(std::move(texture));
-			}
+			q[3] = 0.25f * s;
+			q[0] = (matrix[2][1] - matrix[1][2]) / s;
+			q[1] = (matrix[0][2] - matrix[2][0]) / s;
+			q[2] = (matrix[1][0] - matrix[0][1]) / s;
 		}
-
-		if (m_StudioHeader->numbodyparts > 0)
+		else if (matrix[0][0] > matrix[1][1] && matrix[0][0] > matrix[2][2])
 		{
-			m_BodyParts.reserve(static_cast<size_t>(m_StudioHeader->numbodyparts));
+			float s = sqrtf(1.0f + matrix[0][0] - matrix[1][1] - matrix[2][2]) * 2.0f;
 
-			for (int i = 0; i < m_StudioHeader->numbodyparts; i++)
-			{
-				auto studiobodypart = GetPtr<mstudiobodyparts_t>(m_StudioHeader->bodypartindex) + i;
-				auto bodypart = LoadBodyPart(studiobodypart);
-				m_BodyParts.push_back(std::move(bodypart));
-			}
+			q[3] = (matrix[2][1] - matrix[1][2]) / s;
+			q[0] = 0.25f * s;
+			q[1] = (matrix[0][1] + matrix[1][0]) / s;
+			q[2] = (matrix[0][2] + matrix[2][0]) / s;
 		}
-
-		if (m_StudioHeader->numseqgroups > 1)
+		else if (matrix[1][1] > matrix[2][2])
 		{
-			for (int i = 1; i < m_StudioHeader->numseqgroups; i++)
-			{
-				wchar_t suffix[4];
-
-				// "test01.mdl"
-				swprintf_s(suffix, L"%02d", i);
+			float s = sqrtf(1.0f + matrix[1][1] - matrix[0][0] - matrix[2][2]) * 2.0f;
 
-				auto seqGroupFileName = AddSuffixToFileName(filePath, suffix);
-
-				auto buffer = ReadAllBytes(seqGroupFileName);
-
-				if (!VerifySequenceStudioFile(buffer))
-					continue;
+			q[3] = (matrix[0][2] - matrix[2][0]) / s;
+			q[0] = (matrix[0][1] + matrix[1][0]) / s;
+			q[1] = 0.25f * s;
+			q[2] = (matrix[1][2] + matrix[2][1]) / s;
+		}
+		else
+		{
+			float s = sqrtf(1.0f + matrix[2][2] - matrix[0][0] - matrix[1][1]) * 2.0f;
 
-				m_StudioSequenceGroupFileData[i] = std::move(buffer);
-				m_StudioSequenceGroupHeaders[i] = reinterpret_cast<studioseqhdr_t*>(m_StudioSequenceGroupFileData[i].data());
-			}
+			q[3] = (matrix[1][0] - matrix[0][1]) / s;
+			q[0] = (matrix[0][2] + matrix[2][0]) / s;
+			q[1] = (matrix[1][2] + matrix[2][1]) / s;
+			q[2] = 0.25f * s;
 		}
 	}
 
 
-	const std::wstring& GetFilePath() const
+	// Writes range of boneTransforms to the same bones of palette, which starts at bone 0
+	// and holds GetBonePaletteStride(layout) bytes per bone
+	static void WriteBonePalette(const float (*boneTransforms)[3][4], BoneRange range, BonePaletteLayout layout, void* palette)
 	{
-		return m_FilePath;
-	}
+		if (range.Count <= 0)
+			return;
 
+		if (layout == BonePaletteLayout::Matrix3x4)
+		{
+			memcpy(static_cast<float(*)[3][4]>(palette) + range.First, boneTransforms + range.First, sizeof(float) * 12 * range.Count);
+			return;
+		}
 
-	studiohdr_t* GetStudioHeader() const
-	{
-		return m_StudioHeader;
-	}
+		auto bones = static_cast<PaletteBone*>(palette);
 
+		for (int i = range.First; i < range.First + range.Count; i++)
+		{
+			MatrixQuaternion(boneTransforms[i], bones[i].Rotation);
 
-	const std::vector<BodyPart>& GetBodyParts() const
-	{
-		return m_BodyParts;
+			bones[i].Position[0] = boneTransforms[i][0][3];
+			bones[i].Position[1] = boneTransforms[i][1][3];
+			bones[i].Position[2] = boneTransforms[i][2][3];
+			bones[i].Reserved = 0.0f;
+		}
 	}
 
 
-	const std::vector<Texture>& GetTextures() const
-	{
-		return m_Textures;
-	}
-
+private:
 
-	auto GetSequenceGroupHeaders()
+	// Where the last lookup of one channel ended: the span, counted in values from the
+	// channel's first span, and the frame it starts at. Zero is the first span.
+	struct SpanCursor
 	{
-		return (studioseqhdr_t**)m_StudioSequenceGroupHeaders;
-	}
+		uint32_t Offset;
+		int Base;
+	};
 
 
-	StudioModel()
-		: m_StudioHeader{}
-		, m_StudioTextureHeader{}
-		, m_StudioSequenceGroupHeaders{}
+	// Walks from the cursor when the frame is not behind it, otherwise from the first span.
+	// Returns the span holding frame and sets k to the frame's offset in it.
+	static const mstudioanimvalue_t* FindSpan(const mstudioanimvalue_t* panimvalue, int frame, SpanCursor* cursor, int& k)
 	{
-		// TODO
-	}
+		auto first = panimvalue;
+		int base = 0;
 
+		if (cursor && frame >= cursor->Base)
+		{
+			panimvalue = first + cursor->Offset;
+			base = cursor->Base;
+		}
 
-private:
-
-	std::wstring m_FilePath;
+		k = frame - base;
 
-	std::vector<uint8_t> m_FileData;
-	studiohdr_t* m_StudioHeader;
+		while (panimvalue->num.total <= k)
+		{
+			k -= panimvalue->num.total;
+			base += panimvalue->num.total;
+			panimvalue += panimvalue->num.valid + 1;
+		}
 
-	std::vector<uint8_t> m_StudioTextureFileData;
-	studiohdr_t* m_StudioTextureHeader;
+		if (cursor)
+		{
+			cursor->Offset = static_cast<uint32_t>(panimvalue - first);
+			cursor->Base = base;
+		}
 
-	std::vector<uint8_t> m_StudioSequenceGroupFileData[32];
-	studioseqhdr_t* m_StudioSequenceGroupHeaders[32];
+		return panimvalue;
+	}
 
-	std::vector<BodyPart> m_BodyParts;
-	std::vector<Texture> m_Textures;
-};
 
+	// What one evaluation samples besides the pose parameters
+	struct PoseSources
+	{
+		const studiohdr_t* Header;
+		const mstudioanim_t* Anim; // first blend of the sequence
+		const StudioModel::DecodedSequence* Decoded; // may be null
+		SpanCursor* Cursors; // may be null, laid out like m_SpanCursors
+		size_t* Mismatches; // if set, decoded keys are checked against the span walk
+		BoneKernels::Kernel Kernel;
+		const uint8_t* RigidBones; // may be null, see EvaluatePose
+		const uint8_t* DirtyBones; // may be null to sample every bone; the rest take LocalTransforms
+		float (*LocalTransforms)[3][4]; // may be null, each bone relative to its parent as of the last call
+	};
 
-class StudioModelAnimating
-{
-private:
 
-	void CalcBoneAdj()
+	static void CalcBoneAdj(const studiohdr_t* header, const PoseParameters& pose, float* boneAdjust)
 	{
 		int i, j;
 		float value;
-		mstudiobonecontroller_t* pbonecontroller;
+		const mstudiobonecontroller_t* pbonecontroller;
 
-		pbonecontroller = (mstudiobonecontroller_t*)((byte*)m_StudioHeader + m_StudioHeader->bonecontrollerindex);
+		pbonecontroller = (const mstudiobonecontroller_t*)((const byte*)header + header->bonecontrollerindex);
 
-		for (j = 0; j < m_StudioHeader->numbonecontrollers; j++)
+		for (j = 0; j < header->numbonecontrollers; j++)
 		{
 			i = pbonecontroller[j].index;
 			if (i <= 3)
 			{
 				if (pbonecontroller[j].type & STUDIO_RLOOP)
 				{
-					value = m_Controllers[i] * (360.0f / 256.0f) + pbonecontroller[j].start;
+					value = pose.Controllers[i] * (360.0f / 256.0f) + pbonecontroller[j].start;
 				}
 				else
 				{
-					value = m_Controllers[i] / 255.0f;
+					value = pose.Controllers[i] / 255.0f;
 					if (value < 0) value = 0;
 					if (value > 1.0f) value = 1.0f;
 					value = (1.0f - value) * pbonecontroller[j].start + value * pbonecontroller[j].end;
@@ -576,7 +2314,7 @@ private:
 			}
 			else
 			{
-				value = m_Mouth / 64.0f;
+				value = pose.Mouth / 64.0f;
 				if (value > 1.0f) value = 1.0f;
 				value = (1.0f - value) * pbonecontroller[j].start + value * pbonecontroller[j].end;
 			}
@@ -585,24 +2323,27 @@ private:
 				case STUDIO_XR:
 				case STUDIO_YR:
 				case STUDIO_ZR:
-					m_BoneAdjust[j] = (float)(value * (Q_PI / 180.0));
+					boneAdjust[j] = (float)(value * (Q_PI / 180.0));
 					break;
 				case STUDIO_X:
 				case STUDIO_Y:
 				case STUDIO_Z:
-					m_BoneAdjust[j] = value;
+					boneAdjust[j] = value;
 					break;
 			}
 		}
 	}
 
 
-	void CalcBoneQuaternion(int frame, float s, mstudiobone_t* pbone, mstudioanim_t* panim, float* q) const
+	// The two Euler angles a bone's rotation is interpolated between; BoneKernels
+	// turns them into the quaternion. cursors: the bone's 6 channel cursors, or
+	// null to walk from the first span. Without Controllers the model has none and
+	// the per-channel controller checks are compiled out.
+	template<bool Controllers = true>
+	static void CalcBoneAngles(int frame, const mstudiobone_t* pbone, const mstudioanim_t* panim, const float* boneAdjust, float* angle1, float* angle2, SpanCursor* cursors = nullptr)
 	{
 		int j, k;
-		vec4_t q1, q2;
-		vec3_t angle1{}, angle2{};
-		mstudioanimvalue_t* panimvalue;
+		const mstudioanimvalue_t* panimvalue;
 
 		for (j = 0; j < 3; j++)
 		{
@@ -612,13 +2353,8 @@ private:
 			}
 			else
 			{
-				panimvalue = (mstudioanimvalue_t*)((byte*)panim + panim->offset[j + 3]);
-				k = frame;
-				while (panimvalue->num.total <= k)
-				{
-					k -= panimvalue->num.total;
-					panimvalue += panimvalue->num.valid + 1;
-				}
+				panimvalue = (const mstudioanimvalue_t*)((const byte*)panim + panim->offset[j + 3]);
+				panimvalue = FindSpan(panimvalue, frame, cursors ? &cursors[j + 3] : nullptr, k);
 				// Bah, missing blend!
 				if (panimvalue->num.valid > k)
 				{
@@ -648,30 +2384,20 @@ private:
 				angle2[j] = pbone->value[j + 3] + angle2[j] * pbone->scale[j + 3];
 			}
 
-			if (pbone->bonecontroller[j + 3] != -1)
+			if (Controllers && pbone->bonecontroller[j + 3] != -1)
 			{
-				angle1[j] += m_BoneAdjust[pbone->bonecontroller[j + 3]];
-				angle2[j] += m_BoneAdjust[pbone->bonecontroller[j + 3]];
+				angle1[j] += boneAdjust[pbone->bonecontroller[j + 3]];
+				angle2[j] += boneAdjust[pbone->bonecontroller[j + 3]];
 			}
 		}
-
-		if (!VectorCompare(angle1, angle2))
-		{
-			AngleQuaternion(angle1, q1);
-			AngleQuaternion(angle2, q2);
-			QuaternionSlerp(q1, q2, s, q);
-		}
-		else
-		{
-			AngleQuaternion(angle1, q);
-		}
 	}
 
 
-	void CalcBonePosition(int frame, float s, mstudiobone_t* pbone, mstudioanim_t* panim, float* pos) const
+	template<bool Controllers = true>
+	static void CalcBonePosition(int frame, float s, const mstudiobone_t* pbone, const mstudioanim_t* panim, const float* boneAdjust, float* pos, SpanCursor* cursors = nullptr)
 	{
 		int j, k;
-		mstudioanimvalue_t* panimvalue;
+		const mstudioanimvalue_t* panimvalue;
 
 		for (j = 0; j < 3; j++)
 		{
@@ -679,15 +2405,10 @@ private:
 
 			if (panim->offset[j] != 0)
 			{
-				panimvalue = (mstudioanimvalue_t*)((byte*)panim + panim->offset[j]);
+				panimvalue = (const mstudioanimvalue_t*)((const byte*)panim + panim->offset[j]);
 
-				k = frame;
 				// find span of values that includes the frame we want
-				while (panimvalue->num.total <= k)
-				{
-					k -= panimvalue->num.total;
-					panimvalue += panimvalue->num.valid + 1;
-				}
+				panimvalue = FindSpan(panimvalue, frame, cursors ? &cursors[j] : nullptr, k);
 				// if we're inside the span
 				if (panimvalue->num.valid > k)
 				{
@@ -706,125 +2427,541 @@ private:
 						pos[j] += panimvalue[panimvalue->num.valid].value * pbone->scale[j];
 				}
 			}
-			if (pbone->bonecontroller[j] != -1)
+			if (Controllers && pbone->bonecontroller[j] != -1)
+			{
+				pos[j] += boneAdjust[pbone->bonecontroller[j]];
+			}
+		}
+	}
+
+
+	// Decoded-key versions of the above: same arithmetic on the same values, so the
+	// results are bit-identical to the span walk
+	template<bool Controllers = true>
+	static void CalcBoneAngles(int frame, const mstudiobone_t* pbone, const uint32_t* channels, const StudioModel::DecodedKey* keys, const float* boneAdjust, float* angle1, float* angle2)
+	{
+		int j;
+
+		for (j = 0; j < 3; j++)
+		{
+			if (channels[j + 3] == StudioModel::DecodedSequence::NoKeys)
+			{
+				angle2[j] = angle1[j] = pbone->value[j + 3];
+			}
+			else
+			{
+				const auto& key = keys[channels[j + 3] + frame];
+				angle1[j] = pbone->value[j + 3] + key.Value1 * pbone->scale[j + 3];
+				angle2[j] = pbone->value[j + 3] + key.Value2 * pbone->scale[j + 3];
+			}
+
+			if (Controllers && pbone->bonecontroller[j + 3] != -1)
+			{
+				angle1[j] += boneAdjust[pbone->bonecontroller[j + 3]];
+				angle2[j] += boneAdjust[pbone->bonecontroller[j + 3]];
+			}
+		}
+	}
+
+
+	template<bool Controllers = true>
+	static void CalcBonePosition(int frame, float s, const mstudiobone_t* pbone, const uint32_t* channels, const StudioModel::DecodedKey* keys, const float* boneAdjust, float* pos)
+	{
+		int j;
+
+		for (j = 0; j < 3; j++)
+		{
+			pos[j] = pbone->value[j];
+
+			if (channels[j] != StudioModel::DecodedSequence::NoKeys)
+			{
+				const auto& key = keys[channels[j] + frame];
+
+				if (key.Interpolate)
+					pos[j] += (key.Value1 * (1.0f - s) + s * key.Value2) * pbone->scale[j];
+				else
+					pos[j] += key.Value1 * pbone->scale[j];
+			}
+			if (Controllers && pbone->bonecontroller[j] != -1)
+			{
+				pos[j] += boneAdjust[pbone->bonecontroller[j]];
+			}
+		}
+	}
+
+
+	// q: quaternions in BoneKernels layout, component by component. Decoded samples
+	// sources.Decoded instead of the spans; only Masked looks at the per-bone options
+	// of sources (rigid and dirty bones, validation).
+	template<bool Controllers, bool Decoded, bool Masked>
+	static void CalcRotations(const PoseSources& sources, const PoseParameters& pose, const float* boneAdjust, vec3_t* pos, float (*q)[MAXSTUDIOBONES], const mstudioseqdesc_t* pseqdesc, const mstudioanim_t* panim, int blend, Scratch& scratch)
+	{
+		int i;
+		int frame;
+		const mstudiobone_t* pbone;
+		float s;
+
+		auto header = sources.Header;
+		auto decoded = sources.Decoded; // CanSampleDecoded holds when Decoded is set
+
+		frame = (int)pose.Frame;
+		s = (pose.Frame - frame);
+
+		pbone = (const mstudiobone_t*)((const byte*)header + header->boneindex);
+		for (i = 0; i < header->numbones; i++, pbone++, panim++)
+		{
+			vec3_t angle1, angle2;
+
+			// Replaced by its kept transform later, only the values must be defined
+			if (Masked && sources.DirtyBones && !sources.DirtyBones[i])
+			{
+				for (int j = 0; j < 3; j++)
+					angle2[j] = angle1[j] = pos[i][j] = 0.0f;
+			}
+			else if (Masked && sources.RigidBones && sources.RigidBones[i])
+			{
+				for (int j = 0; j < 3; j++)
+				{
+					angle2[j] = angle1[j] = pbone->value[j + 3];
+					pos[i][j] = pbone->value[j];
+				}
+			}
+			else if constexpr (Decoded)
+			{
+				auto channels = decoded->Channels.data() + (static_cast<size_t>(blend) * decoded->NumBones + i) * 6;
+
+				CalcBoneAngles<Controllers>(frame, pbone, channels, decoded->Keys.data(), boneAdjust, angle1, angle2);
+				CalcBonePosition<Controllers>(frame, s, pbone, channels, decoded->Keys.data(), boneAdjust, pos[i]);
+
+				if (Masked && sources.Mismatches)
+				{
+					vec3_t checkAngle1, checkAngle2, checkPos;
+
+					CalcBoneAngles<Controllers>(frame, pbone, panim, boneAdjust, checkAngle1, checkAngle2);
+					CalcBonePosition<Controllers>(frame, s, pbone, panim, boneAdjust, checkPos);
+
+					if (memcmp(checkAngle1, angle1, sizeof(checkAngle1)) != 0 || memcmp(checkAngle2, angle2, sizeof(checkAngle2)) != 0 ||
+						memcmp(checkPos, pos[i], sizeof(checkPos)) != 0)
+						(*sources.Mismatches)++;
+				}
+			}
+			else
+			{
+				SpanCursor* cursors = nullptr;
+
+				if (sources.Cursors)
+					cursors = sources.Cursors + (static_cast<size_t>(blend) * header->numbones + i) * 6;
+
+				CalcBoneAngles<Controllers>(frame, pbone, panim, boneAdjust, angle1, angle2, cursors);
+				CalcBonePosition<Controllers>(frame, s, pbone, panim, boneAdjust, pos[i], cursors);
+			}
+
+			for (int j = 0; j < 3; j++)
+			{
+				scratch.Angle1[j][i] = angle1[j];
+				scratch.Angle2[j][i] = angle2[j];
+			}
+		}
+
+		BoneKernels::AnglesToQuaternions(sources.Kernel, scratch.Angle1[0], scratch.Angle2[0], s, q[0], header->numbones, MAXSTUDIOBONES);
+
+		if (pseqdesc->motiontype & STUDIO_X)
+			pos[pseqdesc->motionbone][0] = 0.0f;
+		if (pseqdesc->motiontype & STUDIO_Y)
+			pos[pseqdesc->motionbone][1] = 0.0f;
+		if (pseqdesc->motiontype & STUDIO_Z)
+			pos[pseqdesc->motionbone][2] = 0.0f;
+	}
+
+
+	// Animation of a sequence in the model file itself; null for sequence group files
+	static const mstudioanim_t* GetAnim(const studiohdr_t* header, const mstudioseqdesc_t* pseqdesc)
+	{
+		if (pseqdesc->seqgroup != 0)
+			return nullptr;
+
+		auto pseqgroup = (const mstudioseqgroup_t*)((const byte*)header + header->seqgroupindex);
+
+		return (const mstudioanim_t*)((const byte*)header + pseqgroup->data + pseqdesc->animindex);
+	}
+
+
+	mstudioanim_t* GetAnim(mstudioseqdesc_t* pseqdesc)
+	{
+		if (pseqdesc->seqgroup == 0)
+		{
+			m_SequenceGroup.reset();
+			return (mstudioanim_t*)GetAnim(m_StudioHeader, pseqdesc);
+		}
+
+		if (!m_StudioModel)
+			return NULL;
+
+		// Hold on to the group so an eviction cannot free it while we sample it
+		m_SequenceGroup = m_StudioModel->GetSequenceGroup(pseqdesc->seqgroup);
+
+		if (!m_SequenceGroup)
+			return NULL;
+
+		return (mstudioanim_t*)(m_SequenceGroup->GetData() + pseqdesc->animindex);
+	}
+
+
+	static void SlerpBones(BoneKernels::Kernel kernel, int numbones, float (*q1)[MAXSTUDIOBONES], vec3_t pos1[], float (*q2)[MAXSTUDIOBONES], vec3_t pos2[], float s)
+	{
+		int i;
+		float s1;
+
+		if (s < 0) {
+			s = 0;
+		}
+		else if (s > 1.0f) {
+			s = 1.0f;
+		}
+
+		s1 = 1.0f - s;
+
+		BoneKernels::Slerp(kernel, q1[0], q2[0], s, numbones, MAXSTUDIOBONES);
+
+		for (i = 0; i < numbones; i++)
+		{
+			pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s;
+			pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s;
+			pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s;
+		}
+	}
+
+
+	// One evaluator per blend count, controller presence, sample source and use of the
+	// per-bone options, so none of these are tested per bone or per blend
+	template<int NumBlends, bool Controllers, bool Decoded, bool Masked>
+	static void EvaluatePose(const PoseSources& sources, const PoseParameters& pose, float (*boneTransforms)[3][4], Scratch& scratch)
+	{
+		int i;
+
+		auto header = sources.Header;
+		auto pseqdesc = (const mstudioseqdesc_t*)((const byte*)header + header->seqindex) + pose.Sequence;
+		auto panim = sources.Anim;
+		auto pos = scratch.Pos;
+		auto q = scratch.Q;
+
+		// add in programatic controllers
+		float boneAdjust[MAXSTUDIOCONTROLLERS]{};
+
+		if constexpr (Controllers)
+			CalcBoneAdj(header, pose, boneAdjust);
+
+		CalcRotations<Controllers, Decoded, Masked>(sources, pose, boneAdjust, pos[0], q[0], pseqdesc, panim, 0, scratch);
+
+		if constexpr (NumBlends > 1)
+		{
+			float s;
+
+			panim += header->numbones;
+			CalcRotations<Controllers, Decoded, Masked>(sources, pose, boneAdjust, pos[1], q[1], pseqdesc, panim, 1, scratch);
+			s = pose.Blendings[0] / 255.0f;
+
+			SlerpBones(sources.Kernel, header->numbones, q[0], pos[0], q[1], pos[1], s);
+
+			if constexpr (NumBlends == 4) {
+				panim += header->numbones;
+				CalcRotations<Controllers, Decoded, Masked>(sources, pose, boneAdjust, pos[2], q[2], pseqdesc, panim, 2, scratch);
+
+				panim += header->numbones;
+				CalcRotations<Controllers, Decoded, Masked>(sources, pose, boneAdjust, pos[3], q[3], pseqdesc, panim, 3, scratch);
+
+				s = pose.Blendings[0] / 255.0f;
+				SlerpBones(sources.Kernel, header->numbones, q[2], pos[2], q[3], pos[3], s);
+
+				s = pose.Blendings[1] / 255.0f;
+				SlerpBones(sources.Kernel, header->numbones, q[0], pos[0], q[2], pos[2], s);
+			}
+		}
+
+		auto pbones = (const mstudiobone_t*)((const byte*)header + header->boneindex);
+
+		BoneKernels::QuaternionsToMatrices(sources.Kernel, q[0][0], pos[0], scratch.BoneMatrix, header->numbones, MAXSTUDIOBONES);
+
+		if constexpr (!Masked)
+		{
+			// Parents come before their children, so this stays a serial pass in bone order
+			for (i = 0; i < header->numbones; i++)
+			{
+				if (pbones[i].parent == -1)
+					memcpy(boneTransforms[i], scratch.BoneMatrix[i], sizeof(float) * 12);
+				else
+					R_ConcatTransforms(boneTransforms[pbones[i].parent], scratch.BoneMatrix[i], boneTransforms[i]);
+			}
+
+			return;
+		}
+
+		if (sources.LocalTransforms)
+		{
+			for (i = 0; i < header->numbones; i++)
 			{
-				pos[j] += m_BoneAdjust[pbone->bonecontroller[j]];
+				if (!sources.DirtyBones || sources.DirtyBones[i])
+					memcpy(sources.LocalTransforms[i], scratch.BoneMatrix[i], sizeof(float) * 12);
+				else
+					memcpy(scratch.BoneMatrix[i], sources.LocalTransforms[i], sizeof(float) * 12);
 			}
 		}
+
+		// With dirty bones only they and their descendants change; boneTransforms
+		// still holds the rest from the last call.
+		for (i = 0; i < header->numbones; i++)
+		{
+			int parent = pbones[i].parent;
+
+			scratch.Changed[i] = !sources.DirtyBones || sources.DirtyBones[i] || (parent != -1 && scratch.Changed[parent]);
+
+			if (!scratch.Changed[i])
+				continue;
+
+			if (parent == -1)
+				memcpy(boneTransforms[i], scratch.BoneMatrix[i], sizeof(float) * 12);
+			else
+				R_ConcatTransforms(boneTransforms[parent], scratch.BoneMatrix[i], boneTransforms[i]);
+		}
+	}
+
+
+	using PoseEvaluator = void (*)(const PoseSources& sources, const PoseParameters& pose, float (*boneTransforms)[3][4], Scratch& scratch);
+
+
+	// Frames outside the sequence have no keys; the span walk handles them as before
+	static bool CanSampleDecoded(const PoseSources& sources, const PoseParameters& pose)
+	{
+		auto decoded = sources.Decoded;
+		int frame = (int)pose.Frame;
+
+		return decoded && frame >= 0 && frame < decoded->NumFrames && decoded->NumBones == sources.Header->numbones;
+	}
+
+
+	// generic picks the evaluator that applies controllers and tests the per-bone options
+	// whatever the model and sources need, which is what every pose ran before
+	static PoseEvaluator GetPoseEvaluator(const PoseSources& sources, const PoseParameters& pose, const mstudioseqdesc_t* pseqdesc, bool generic = false)
+	{
+		static const PoseEvaluator evaluators[3][2][2][2] =
+		{
+			{
+				{ { &EvaluatePose<1, false, false, false>, &EvaluatePose<1, false, false, true> }, { &EvaluatePose<1, false, true, false>, &EvaluatePose<1, false, true, true> } },
+				{ { &EvaluatePose<1, true, false, false>, &EvaluatePose<1, true, false, true> }, { &EvaluatePose<1, true, true, false>, &EvaluatePose<1, true, true, true> } },
+			},
+			{
+				{ { &EvaluatePose<2, false, false, false>, &EvaluatePose<2, false, false, true> }, { &EvaluatePose<2, false, true, false>, &EvaluatePose<2, false, true, true> } },
+				{ { &EvaluatePose<2, true, false, false>, &EvaluatePose<2, true, false, true> }, { &EvaluatePose<2, true, true, false>, &EvaluatePose<2, true, true, true> } },
+			},
+			{
+				{ { &EvaluatePose<4, false, false, false>, &EvaluatePose<4, false, false, true> }, { &EvaluatePose<4, false, true, false>, &EvaluatePose<4, false, true, true> } },
+				{ { &EvaluatePose<4, true, false, false>, &EvaluatePose<4, true, false, true> }, { &EvaluatePose<4, true, true, false>, &EvaluatePose<4, true, true, true> } },
+			},
+		};
+
+		// Any other count above one samples the first two blends, as the studio renderer always has
+		int blends = pseqdesc->numblends == 4 ? 2 : (pseqdesc->numblends > 1 ? 1 : 0);
+		bool controllers = generic || sources.Header->numbonecontrollers > 0;
+		bool decoded = CanSampleDecoded(sources, pose);
+		bool masked = generic || sources.RigidBones || sources.DirtyBones || sources.LocalTransforms || sources.Mismatches;
+
+		return evaluators[blends][controllers][decoded][masked];
 	}
 
 
-	void CalcRotations(vec3_t* pos, vec4_t* q, mstudioseqdesc_t* pseqdesc, mstudioanim_t* panim, float f)
+	// Reads only sources, pose and the model data, writes only boneTransforms and scratch
+	static void EvaluatePose(const PoseSources& sources, const PoseParameters& pose, float (*boneTransforms)[3][4], Scratch& scratch, bool generic = false)
 	{
-		int i;
-		int frame;
-		mstudiobone_t* pbone;
-		float s;
+		auto pseqdesc = (const mstudioseqdesc_t*)((const byte*)sources.Header + sources.Header->seqindex) + pose.Sequence;
 
-		frame = (int)f;
-		s = (f - frame);
+		GetPoseEvaluator(sources, pose, pseqdesc, generic)(sources, pose, boneTransforms, scratch);
+	}
 
-		// add in programatic controllers
-		CalcBoneAdj();
 
-		pbone = (mstudiobone_t*)((byte*)m_StudioHeader + m_StudioHeader->boneindex);
-		for (i = 0; i < m_StudioHeader->numbones; i++, pbone++, panim++)
+	static int EvaluatePose(StudioModel& studioModel, const PoseParameters& pose, float (*boneTransforms)[3][4], size_t maxBones, Scratch& scratch,
+		BoneKernels::Kernel kernel, const uint8_t* rigidBones, bool generic)
+	{
+		const studiohdr_t* header = studioModel.GetStudioHeader();
+
+		if (!header || pose.Sequence < 0 || pose.Sequence >= header->numseq || maxBones < static_cast<size_t>(header->numbones))
+			return 0;
+
+		auto pseqdesc = (const mstudioseqdesc_t*)((const byte*)header + header->seqindex) + pose.Sequence;
+		auto panim = GetAnim(header, pseqdesc);
+
+		std::shared_ptr<const MappedFile> sequenceGroup;
+
+		if (pseqdesc->seqgroup != 0)
 		{
-			CalcBoneQuaternion(frame, s, pbone, panim, q[i]);
-			CalcBonePosition(frame, s, pbone, panim, pos[i]);
+			sequenceGroup = studioModel.GetSequenceGroup(pseqdesc->seqgroup);
+
+			if (!sequenceGroup)
+				return 0;
+
+			panim = (const mstudioanim_t*)(sequenceGroup->GetData() + pseqdesc->animindex);
 		}
 
-		if (pseqdesc->motiontype & STUDIO_X)
-			pos[pseqdesc->motionbone][0] = 0.0f;
-		if (pseqdesc->motiontype & STUDIO_Y)
-			pos[pseqdesc->motionbone][1] = 0.0f;
-		if (pseqdesc->motiontype & STUDIO_Z)
-			pos[pseqdesc->motionbone][2] = 0.0f;
+		auto decoded = studioModel.GetDecodedSequence(pose.Sequence);
+
+		PoseSources sources{ header, panim, decoded.get(), nullptr, nullptr, kernel, rigidBones, nullptr, nullptr };
+
+		EvaluatePose(sources, pose, boneTransforms, scratch, generic);
+
+		return header->numbones;
 	}
 
 
-	mstudioanim_t* GetAnim(mstudioseqdesc_t* pseqdesc)
+public:
+
+	// Returns frame advanced by dt seconds of sequence and wrapped to its length
+	static float AdvanceFrame(const studiohdr_t* header, int sequence, float frame, double dt)
 	{
-		mstudioseqgroup_t* pseqgroup;
-		pseqgroup = (mstudioseqgroup_t*)((byte*)m_StudioHeader + m_StudioHeader->seqgroupindex) + pseqdesc->seqgroup;
+		const mstudioseqdesc_t* pseqdesc;
+		pseqdesc = (const mstudioseqdesc_t*)((const byte*)header + header->seqindex) + sequence;
 
-		if (pseqdesc->seqgroup == 0)
+		if (dt > 0.1)
+			dt = 0.1;
+		frame += (float)(dt * pseqdesc->fps);
+
+		if (pseqdesc->numframes <= 1)
+		{
+			frame = 0;
+		}
+		else
 		{
-			return (mstudioanim_t*)((byte*)m_StudioHeader + pseqgroup->data + pseqdesc->animindex);
+			// wrap
+			frame -= (int)(frame / (pseqdesc->numframes - 1)) * (pseqdesc->numframes - 1);
 		}
 
-		if (!m_StudioSequenceGroupHeaders)
-			return NULL;
+		return frame;
+	}
 
-		if (!m_StudioSequenceGroupHeaders[pseqdesc->seqgroup])
-			return NULL;
 
-		return (mstudioanim_t*)((byte*)m_StudioSequenceGroupHeaders[pseqdesc->seqgroup] + pseqdesc->animindex);
+	// Side-effect free: reads only header, pose and the sequence's animation, and writes only
+	// boneTransforms and scratch, so any number of threads may evaluate poses of one model
+	// at once. Returns the number of transforms written, or 0 if maxBones is too small, the
+	// sequence is out of range or it lives in a sequence group file (see the overload below).
+	// rigidBones, if set, flags bones that are not sampled and keep their rest pose relative
+	// to their parent.
+	static int EvaluatePose(const studiohdr_t* header, const PoseParameters& pose, float (*boneTransforms)[3][4], size_t maxBones, Scratch& scratch,
+		BoneKernels::Kernel kernel = BoneKernels::GetDefaultKernel(), const uint8_t* rigidBones = nullptr)
+	{
+		if (!header || pose.Sequence < 0 || pose.Sequence >= header->numseq || maxBones < static_cast<size_t>(header->numbones))
+			return 0;
+
+		auto pseqdesc = (const mstudioseqdesc_t*)((const byte*)header + header->seqindex) + pose.Sequence;
+		auto panim = GetAnim(header, pseqdesc);
+
+		if (!panim)
+			return 0;
+
+		PoseSources sources{ header, panim, nullptr, nullptr, nullptr, kernel, rigidBones, nullptr, nullptr };
+
+		EvaluatePose(sources, pose, boneTransforms, scratch);
+
+		return header->numbones;
 	}
 
 
-	void SlerpBones(vec4_t q1[], vec3_t pos1[], vec4_t q2[], vec3_t pos2[], float s)
+	// Also samples sequence group files and decoded keys. Those come from the model's
+	// caches, which lock briefly; the evaluation itself shares nothing between threads.
+	static int EvaluatePose(StudioModel& studioModel, const PoseParameters& pose, float (*boneTransforms)[3][4], size_t maxBones, Scratch& scratch,
+		BoneKernels::Kernel kernel = BoneKernels::GetDefaultKernel(), const uint8_t* rigidBones = nullptr)
 	{
-		int i;
-		vec4_t q3;
-		float s1;
+		return EvaluatePose(studioModel, pose, boneTransforms, maxBones, scratch, kernel, rigidBones, false);
+	}
 
-		if (s < 0) {
-			s = 0;
-		}
-		else if (s > 1.0f) {
-			s = 1.0f;
-		}
 
-		s1 = 1.0f - s;
+	// The same pose through the evaluator without the specializations, for measuring
+	// what they save (see Benchmark)
+	static int EvaluateGenericPose(StudioModel& studioModel, const PoseParameters& pose, float (*boneTransforms)[3][4], size_t maxBones, Scratch& scratch,
+		BoneKernels::Kernel kernel = BoneKernels::GetDefaultKernel())
+	{
+		return EvaluatePose(studioModel, pose, boneTransforms, maxBones, scratch, kernel, nullptr, true);
+	}
+
+
+	void AdvanceFrame(double dt)
+	{
+		m_Frame = AdvanceFrame(m_StudioHeader, m_Sequence, m_Frame, dt);
+	}
+
+
+	void SetUpBones()
+	{
+		if (!m_StudioHeader)
+			return;
+
+		auto numFloats = static_cast<size_t>(m_StudioHeader->numbones) * 12;
 
-		for (i = 0; i < m_StudioHeader->numbones; i++)
+		if (m_BoneTransforms.size() != numFloats)
 		{
-			QuaternionSlerp(q1[i], q2[i], s, q3);
-			q1[i][0] = q3[0];
-			q1[i][1] = q3[1];
-			q1[i][2] = q3[2];
-			q1[i][3] = q3[3];
-			pos1[i][0] = pos1[i][0] * s1 + pos2[i][0] * s;
-			pos1[i][1] = pos1[i][1] * s1 + pos2[i][1] * s;
-			pos1[i][2] = pos1[i][2] * s1 + pos2[i][2] * s;
+			m_BoneTransforms.resize(numFloats);
+			m_LastPoseValid = false;
 		}
+
+		SetUpBones(reinterpret_cast<float(*)[3][4]>(m_BoneTransforms.data()), GetThreadScratch(), true);
 	}
 
 
-public:
+	// Writes numbones transforms to boneTransforms instead of the animator's own array.
+	// Every bone is evaluated, only the animator's own array is updated incrementally.
+	void SetUpBones(float (*boneTransforms)[3][4])
+	{
+		SetUpBones(boneTransforms, GetThreadScratch(), false);
+	}
 
-	void AdvanceFrame(double dt)
+
+	void SetUpBones(float (*boneTransforms)[3][4], Scratch& scratch)
 	{
-		mstudioseqdesc_t* pseqdesc;
-		pseqdesc = (mstudioseqdesc_t*)((byte*)m_StudioHeader + m_StudioHeader->seqindex) + m_Sequence;
+		SetUpBones(boneTransforms, scratch, false);
+	}
 
-		if (dt > 0.1)
-			dt = 0.1;
-		m_Frame += (float)(dt * pseqdesc->fps);
 
-		if (pseqdesc->numframes <= 1)
+private:
+
+	// Marks the bones driven by the controllers whose value differs between the poses
+	void MarkControllerBones(const PoseParameters& pose, const PoseParameters& lastPose, uint8_t* dirtyBones) const
+	{
+		auto pbonecontroller = (const mstudiobonecontroller_t*)((const byte*)m_StudioHeader + m_StudioHeader->bonecontrollerindex);
+		auto pbones = (const mstudiobone_t*)((const byte*)m_StudioHeader + m_StudioHeader->boneindex);
+		bool changed[MAXSTUDIOCONTROLLERS]{};
+
+		for (int j = 0; j < m_StudioHeader->numbonecontrollers && j < MAXSTUDIOCONTROLLERS; j++)
 		{
-			m_Frame = 0;
+			int i = pbonecontroller[j].index;
+
+			// Same split as CalcBoneAdj: every index above 3 reads the mouth
+			if (i <= 3)
+				changed[j] = pose.Controllers[i] != lastPose.Controllers[i];
+			else
+				changed[j] = pose.Mouth != lastPose.Mouth;
 		}
-		else
+
+		for (int i = 0; i < m_StudioHeader->numbones; i++)
 		{
-			// wrap
-			m_Frame -= (int)(m_Frame / (pseqdesc->numframes - 1)) * (pseqdesc->numframes - 1);
+			dirtyBones[i] = 0;
+
+			for (int k = 0; k < 6; k++)
+			{
+				int j = pbones[i].bonecontroller[k];
+
+				if (j >= 0 && j < MAXSTUDIOCONTROLLERS && changed[j])
+					dirtyBones[i] = 1;
+			}
 		}
 	}
 
 
-	void SetUpBones()
+	// With trackChanges boneTransforms must hold the result of the last tracked call.
+	// Nothing is evaluated again if no input changed, and only the bones bound to
+	// changed controllers are sampled if nothing else did; their descendants are
+	// concatenated again from the kept local transforms.
+	void SetUpBones(float (*boneTransforms)[3][4], Scratch& scratch, bool trackChanges)
 	{
-		int i;
-
-		mstudiobone_t* pbones;
 		mstudioseqdesc_t* pseqdesc;
 		mstudioanim_t* panim;
 
-		float bonematrix[3][4];
-
 		if (!m_StudioHeader)
 			return;
 
@@ -837,101 +2974,279 @@ public:
 		if (!panim)
 			return;
 
-		CalcRotations(tmp_pos, tmp_q, pseqdesc, panim, m_Frame);
+		if (m_StudioModel && (!m_DecodedSequence || m_DecodedSequence->Sequence != m_Sequence))
+			m_DecodedSequence = m_StudioModel->GetDecodedSequence(m_Sequence);
 
-		if (pseqdesc->numblends > 1)
-		{
-			float s;
+		// A reloaded sequence group lives at a new address, so the cursors must start over
+		auto numCursors = static_cast<size_t>(pseqdesc->numblends) * m_StudioHeader->numbones * 6;
 
-			panim += m_StudioHeader->numbones;
-			CalcRotations(tmp_pos2, tmp_q2, pseqdesc, panim, m_Frame);
-			s = m_Blendings[0] / 255.0f;
+		if (panim != m_SpanCursorAnim || m_SpanCursors.size() != numCursors)
+		{
+			m_SpanCursors.assign(numCursors, SpanCursor{});
+			m_SpanCursorAnim = panim;
+		}
 
-			SlerpBones(tmp_q, tmp_pos, tmp_q2, tmp_pos2, s);
+		auto pose = GetPoseParameters();
+		auto numBones = static_cast<size_t>(m_StudioHeader->numbones);
+		uint8_t dirtyBones[MAXSTUDIOBONES];
+		bool controllersOnly = false;
 
-			if (pseqdesc->numblends == 4) {
-				panim += m_StudioHeader->numbones;
-				CalcRotations(tmp_pos3, tmp_q3, pseqdesc, panim, m_Frame);
+		if (trackChanges && m_LastPoseValid && panim == m_LastPoseAnim && m_BoneKernel == m_LastPoseKernel &&
+			pose.Sequence == m_LastPose.Sequence && pose.Frame == m_LastPose.Frame &&
+			memcmp(pose.Blendings, m_LastPose.Blendings, sizeof(pose.Blendings)) == 0)
+		{
+			if (memcmp(pose.Controllers, m_LastPose.Controllers, sizeof(pose.Controllers)) == 0 && pose.Mouth == m_LastPose.Mouth)
+			{
+				m_BonesSkipped += numBones;
+				m_ChangedBones = BoneRange{};
+				return;
+			}
 
-				panim += m_StudioHeader->numbones;
-				CalcRotations(tmp_pos4, tmp_q4, pseqdesc, panim, m_Frame);
+			MarkControllerBones(pose, m_LastPose, dirtyBones);
+			controllersOnly = true;
+		}
 
-				s = m_Blendings[0] / 255.0f;
-				SlerpBones(tmp_q3, tmp_pos3, tmp_q4, tmp_pos4, s);
+		float (*localTransforms)[3][4] = nullptr;
 
-				s = m_Blendings[1] / 255.0f;
-				SlerpBones(tmp_q, tmp_pos, tmp_q3, tmp_pos3, s);
-			}
+		if (trackChanges)
+		{
+			m_LocalTransforms.resize(numBones * 12);
+			localTransforms = reinterpret_cast<float(*)[3][4]>(m_LocalTransforms.data());
 		}
 
-		pbones = (mstudiobone_t*)((byte*)m_StudioHeader + m_StudioHeader->boneindex);
+		PoseSources sources{ m_StudioHeader, panim, m_DecodedSequence.get(), m_SpanCursors.data(),
+			m_ValidateDecodedSequence ? &m_DecodedSequenceMismatches : nullptr, m_BoneKernel, nullptr,
+			controllersOnly ? dirtyBones : nullptr, localTransforms };
+
+		EvaluatePose(sources, pose, boneTransforms, scratch);
 
-		for (i = 0; i < m_StudioHeader->numbones; i++)
+		size_t evaluated = numBones;
+
+		if (controllersOnly)
+			evaluated = std::count(dirtyBones, dirtyBones + numBones, uint8_t{ 1 });
+
+		m_BonesEvaluated += evaluated;
+		m_BonesSkipped += numBones - evaluated;
+
+		if (trackChanges)
 		{
-			QuaternionMatrix(tmp_q[i], bonematrix);
+			m_ChangedBones = BoneRange{ 0, static_cast<int>(numBones) };
+
+			if (controllersOnly)
+			{
+				auto first = std::find(scratch.Changed, scratch.Changed + numBones, true);
+				auto last = std::find(std::make_reverse_iterator(scratch.Changed + numBones), std::make_reverse_iterator(first), true);
 
-			bonematrix[0][3] = tmp_pos[i][0];
-			bonematrix[1][3] = tmp_pos[i][1];
-			bonematrix[2][3] = tmp_pos[i][2];
+				m_ChangedBones.First = static_cast<int>(first - scratch.Changed);
+				m_ChangedBones.Count = static_cast<int>(last.base() - first);
+			}
 
-			if (pbones[i].parent == -1)
-				memcpy(m_BoneTransforms[i], bonematrix, sizeof(float) * 12);
-			else
-				R_ConcatTransforms(m_BoneTransforms[pbones[i].parent], bonematrix, m_BoneTransforms[i]);
+			m_LastPose = pose;
+			m_LastPoseAnim = panim;
+			m_LastPoseKernel = m_BoneKernel;
+			m_LastPoseValid = true;
 		}
 	}
 
 
+public:
+
+
+	PoseParameters GetPoseParameters() const
+	{
+		PoseParameters pose{};
+
+		pose.Sequence = m_Sequence;
+		pose.Frame = m_Frame;
+		memcpy(pose.Controllers, m_Controllers, sizeof(pose.Controllers));
+		memcpy(pose.Blendings, m_Blendings, sizeof(pose.Blendings));
+		pose.Mouth = m_Mouth;
+
+		return pose;
+	}
+
+
 	void SetStudioHeader(studiohdr_t* studioHeader)
 	{
+		if (m_StudioHeader != studioHeader)
+		{
+			m_DecodedSequence.reset();
+			ResetSpanCursors();
+			m_LastPoseValid = false;
+		}
+
 		m_StudioHeader = studioHeader;
 	}
 
 
-	void SetStudioSequenceGroupHeaders(studioseqhdr_t** studioSequenceGroupHeaders)
+	void SetStudioModel(StudioModel* studioModel)
 	{
-		m_StudioSequenceGroupHeaders = studioSequenceGroupHeaders;
+		if (m_StudioModel != studioModel)
+		{
+			m_SequenceGroup.reset();
+			m_DecodedSequence.reset();
+			ResetSpanCursors();
+			m_LastPoseValid = false;
+		}
+
+		m_StudioModel = studioModel;
+		m_StudioHeader = studioModel ? studioModel->GetStudioHeader() : nullptr;
 	}
 
 
 	void SetSequence(int seq)
 	{
+		if (seq != m_Sequence)
+			ResetSpanCursors();
+
 		m_Sequence = seq;
 	}
 
 
 	void SetFrame(float frame)
 	{
+		if (frame < m_Frame)
+			ResetSpanCursors();
+
 		m_Frame = frame;
 	}
 
 
-	auto GetBoneTransforms() const
+	void SetController(int controller, byte value)
+	{
+		if (controller >= 0 && controller < 4)
+			m_Controllers[controller] = value;
+	}
+
+
+	void SetBlending(int blender, byte value)
+	{
+		if (blender >= 0 && blender < 2)
+			m_Blendings[blender] = value;
+	}
+
+
+	void SetMouth(byte value)
+	{
+		m_Mouth = value;
+	}
+
+
+	int GetSequence() const
+	{
+		return m_Sequence;
+	}
+
+
+	float GetFrame() const
+	{
+		return m_Frame;
+	}
+
+
+	void ResetSpanCursors()
+	{
+		m_SpanCursors.clear();
+		m_SpanCursorAnim = nullptr;
+	}
+
+
+	// numbones transforms, set up by SetUpBones()
+	const float (*GetBoneTransforms() const)[3][4]
+	{
+		return reinterpret_cast<const float(*)[3][4]>(m_BoneTransforms.data());
+	}
+
+
+	int GetBoneCount() const
+	{
+		return static_cast<int>(m_BoneTransforms.size() / 12);
+	}
+
+
+	// Bones of GetBoneTransforms() that the last SetUpBones() changed. Empty if it
+	// kept every bone, so a palette filled from them is still current.
+	BoneRange GetChangedBones() const
+	{
+		return m_ChangedBones;
+	}
+
+
+	void WriteBonePalette(BoneRange range, BonePaletteLayout layout, void* palette) const
+	{
+		WriteBonePalette(GetBoneTransforms(), range, layout, palette);
+	}
+
+
+	// Recomputes every decoded-key sample with the span walk and counts the bones that differ
+	void SetValidateDecodedSequence(bool validate)
+	{
+		m_ValidateDecodedSequence = validate;
+	}
+
+
+	size_t GetDecodedSequenceMismatches() const
+	{
+		return m_DecodedSequenceMismatches;
+	}
+
+
+	// The default, BoneKernels::Kernel::Scalar, reproduces the mathlib results exactly;
+	// BoneKernels::DetectKernel() returns the fastest approximation the CPU runs
+	void SetBoneKernel(BoneKernels::Kernel kernel)
+	{
+		m_BoneKernel = kernel;
+	}
+
+
+	// Bones sampled from the animation by SetUpBones, and bones whose last result was kept
+	size_t GetBonesEvaluated() const
+	{
+		return m_BonesEvaluated;
+	}
+
+
+	size_t GetBonesSkipped() const
+	{
+		return m_BonesSkipped;
+	}
+
+
+	void ResetBoneCounters()
+	{
+		m_BonesEvaluated = 0;
+		m_BonesSkipped = 0;
+	}
+
+
+	// Forces the next SetUpBones() to evaluate every bone, e.g. after the model data was edited in place
+	void InvalidatePose()
 	{
-		return m_BoneTransforms;
+		m_LastPoseValid = false;
 	}
 
 
 	StudioModelAnimating()
 		: m_StudioHeader{}
-		, m_StudioSequenceGroupHeaders{}
+		, m_StudioModel{}
+		, m_ValidateDecodedSequence{}
+		, m_DecodedSequenceMismatches{}
+		, m_BoneKernel{ BoneKernels::GetDefaultKernel() }
 		, m_Sequence{}
+		, m_SpanCursorAnim{}
 		, m_Frame{}
 		, m_Body{}
 		, m_Skin{}
 		, m_Controllers{}
 		, m_Blendings{}
 		, m_Mouth{}
-		, m_BoneAdjust{}
-		, m_BoneTransforms{}
-		, tmp_pos{}
-		, tmp_q{}
-		, tmp_pos2{}
-		, tmp_q2{}
-		, tmp_pos3{}
-		, tmp_q3{}
-		, tmp_pos4{}
-		, tmp_q4{}
+		, m_LastPose{}
+		, m_LastPoseAnim{}
+		, m_LastPoseKernel{}
+		, m_LastPoseValid{}
+		, m_BonesEvaluated{}
+		, m_BonesSkipped{}
+		, m_ChangedBones{}
 	{
 		// TODO
 	}
@@ -940,29 +3255,35 @@ public:
 private:
 
 	studiohdr_t* m_StudioHeader;
-	studioseqhdr_t** m_StudioSequenceGroupHeaders;
+	StudioModel* m_StudioModel;
+	std::shared_ptr<const MappedFile> m_SequenceGroup;
+	std::shared_ptr<const StudioModel::DecodedSequence> m_DecodedSequence;
+	bool m_ValidateDecodedSequence;
+	size_t m_DecodedSequenceMismatches;
+	BoneKernels::Kernel m_BoneKernel;
 	int m_Sequence;
+	std::vector<SpanCursor> m_SpanCursors; // blend by bone by channel, like the mstudioanim_t offsets
+	mstudioanim_t* m_SpanCursorAnim;
 	float m_Frame;
 	int m_Body;
 	int m_Skin;
 	byte m_Controllers[4];
 	byte m_Blendings[2];
 	byte m_Mouth;
-	float m_BoneAdjust[4];
-	float m_BoneTransforms[MAXSTUDIOBONES][3][4];
-
-	// Big array moved from SetUpBones()
-	vec3_t tmp_pos[MAXSTUDIOBONES];
-	vec4_t tmp_q[MAXSTUDIOBONES];
-	vec3_t tmp_pos2[MAXSTUDIOBONES];
-	vec4_t tmp_q2[MAXSTUDIOBONES];
-	vec3_t tmp_pos3[MAXSTUDIOBONES];
-	vec4_t tmp_q3[MAXSTUDIOBONES];
-	vec3_t tmp_pos4[MAXSTUDIOBONES];
-	vec4_t tmp_q4[MAXSTUDIOBONES];
+	std::vector<float> m_BoneTransforms; // numbones * 3 * 4
+	std::vector<float> m_LocalTransforms; // numbones * 3 * 4, relative to the parent
+	PoseParameters m_LastPose; // inputs of m_BoneTransforms
+	mstudioanim_t* m_LastPoseAnim;
+	BoneKernels::Kernel m_LastPoseKernel;
+	bool m_LastPoseValid;
+	size_t m_BonesEvaluated;
+	size_t m_BonesSkipped;
+	BoneRange m_ChangedBones;
 };
 
 
+#ifdef _WIN32
+
 class D3DStudioModel
 {
 public:
@@ -972,10 +3293,12 @@ public:
 		ComPtr<ID3D11Buffer> IndexBuffer;
 		UINT NumIndices;
 		int TextureId;
+		D3D11_PRIMITIVE_TOPOLOGY Topology;
 
 		D3DMesh()
 			: NumIndices{}
 			, TextureId{}
+			, Topology{ D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST }
 		{}
 
 		D3DMesh(D3DMesh&& other) noexcept
@@ -983,13 +3306,25 @@ public:
 			this->IndexBuffer = std::move(other.IndexBuffer);
 			this->NumIndices = other.NumIndices;
 			this->TextureId = other.TextureId;
+			this->Topology = other.Topology;
 		}
 	};
 
 
+	// Dequantization constants of a compact model, laid out as the CompactFormatBuffer shader constants
+	struct D3DCompactFormat
+	{
+		float PositionMin[4];
+		float PositionScale[4];
+		float TexCoordMinScale[4];
+	};
+
+
+	// VertexBuffer holds StudioModel::Vertex, or StudioModel::CompactVertex when FormatBuffer is set
 	struct D3DModel
 	{
 		ComPtr<ID3D11Buffer> VertexBuffer;
+		ComPtr<ID3D11Buffer> FormatBuffer;
 		std::vector<D3DMesh> Meshes;
 
 		D3DModel() = default;
@@ -997,6 +3332,7 @@ public:
 		D3DModel(D3DModel&& other) noexcept
 		{
 			this->VertexBuffer = std::move(other.VertexBuffer);
+			this->FormatBuffer = std::move(other.FormatBuffer);
 			this->Meshes = std::move(other.Meshes);
 		}
 	};
@@ -1039,6 +3375,10 @@ private:
 		mesh.NumIndices = static_cast<UINT>(studioMesh.Indices.size());
 		mesh.TextureId = studioMesh.TextureId;
 
+		// Strip cuts need no state: 0xFFFFFFFF always restarts a strip with 32-bit indices
+		if (studioMesh.Topology == StudioModel::PrimitiveTopology::TriangleStrip)
+			mesh.Topology = D3D11_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP;
+
 		D3D11_BUFFER_DESC ibd{};
 		ibd.Usage = D3D11_USAGE_IMMUTABLE;
 		ibd.ByteWidth = static_cast<UINT>(sizeof(UINT) * studioMesh.Indices.size());
@@ -1062,21 +3402,51 @@ private:
 	{
 		D3DModel model{};
 
+		// Compact vertices are uploaded as they are and decoded by CompactVertexShader
+		auto compact = !studioModel.CompactVertices.empty();
+
 		D3D11_BUFFER_DESC vbd{};
 		vbd.Usage = D3D11_USAGE_IMMUTABLE;
-		vbd.ByteWidth = static_cast<UINT>(sizeof(StudioModel::Vertex) * studioModel.Vertices.size());
+		vbd.ByteWidth = static_cast<UINT>((compact ? sizeof(StudioModel::CompactVertex) : sizeof(StudioModel::Vertex)) * studioModel.GetVertexCount());
 		vbd.BindFlags = D3D11_BIND_VERTEX_BUFFER;
 		vbd.CPUAccessFlags = 0;
 		vbd.MiscFlags = 0;
 
 		D3D11_SUBRESOURCE_DATA bufferData{};
-		bufferData.pSysMem = studioModel.Vertices.data();
+		bufferData.pSysMem = compact ? static_cast<const void*>(studioModel.CompactVertices.data()) : static_cast<const void*>(studioModel.Vertices.data());
 
 		auto hr = device->CreateBuffer(&vbd, &bufferData, model.VertexBuffer.ReleaseAndGetAddressOf());
 
 		if (FAILED(hr))
 			return {};
 
+		if (compact)
+		{
+			const auto& format = studioModel.CompactFormat;
+
+			D3DCompactFormat compactFormat =
+			{
+				{ format.PositionMin.x, format.PositionMin.y, format.PositionMin.z, 0.0f },
+				{ format.PositionScale.x, format.PositionScale.y, format.PositionScale.z, 0.0f },
+				{ format.TexCoordMin.x, format.TexCoordMin.y, format.TexCoordScale.x, format.TexCoordScale.y },
+			};
+
+			D3D11_BUFFER_DESC cbd{};
+			cbd.Usage = D3D11_USAGE_IMMUTABLE;
+			cbd.ByteWidth = sizeof(D3DCompactFormat);
+			cbd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
+			cbd.CPUAccessFlags = 0;
+			cbd.MiscFlags = 0;
+
+			D3D11_SUBRESOURCE_DATA formatData{};
+			formatData.pSysMem = &compactFormat;
+
+			hr = device->CreateBuffer(&cbd, &formatData, model.FormatBuffer.ReleaseAndGetAddressOf());
+
+			if (FAILED(hr))
+				return {};
+		}
+
 		const auto& studioMeshes = studioModel.Meshes;
 
 		if (!studioMeshes.empty())
@@ -1115,7 +3485,7 @@ private:
 	}
 
 
-	D3DTexture LoadTexture(ID3D11Device* device, const StudioModel::Texture& studioTexture)
+	D3DTexture LoadTexture(ID3D11Device* device, const StudioModel::Texture& studioTexture, std::vector<uint8_t>& uploadBuffer)
 	{
 		D3DTexture texture{};
 
@@ -1132,10 +3502,19 @@ private:
 		desc.CPUAccessFlags = 0;
 		desc.MiscFlags = 0;
 
+		// Texels are expanded just for the upload and dropped again afterwards
+		auto rowPitch = static_cast<size_t>(studioTexture.Width) * 4;
+
+		uploadBuffer.resize(rowPitch * studioTexture.Height);
+
+		// Meshes using a texture that failed to load are not drawn
+		if (!studioTexture.ExpandTo(uploadBuffer.data(), rowPitch))
+			return {};
+
 		D3D11_SUBRESOURCE_DATA textureData{};
-		textureData.pSysMem = studioTexture.Data.data();
-		textureData.SysMemPitch = static_cast<UINT>(studioTexture.Width * 4);
-		textureData.SysMemSlicePitch = static_cast<UINT>(studioTexture.Width * studioTexture.Height * 4);
+		textureData.pSysMem = uploadBuffer.data();
+		textureData.SysMemPitch = static_cast<UINT>(rowPitch);
+		textureData.SysMemSlicePitch = static_cast<UINT>(rowPitch * studioTexture.Height);
 
 		HRESULT hr;
 
@@ -1155,11 +3534,11 @@ private:
 
 public:
 
-	void Load(ID3D11Device* device, const std::wstring& filePath)
+	void Load(ID3D11Device* device, const std::wstring& filePath, const StudioModel::LoadOptions& options = {})
 	{
 		m_StudioModel = std::make_unique<StudioModel>();
 
-		m_StudioModel->LoadFromFile(filePath);
+		m_StudioModel->LoadFromFile(filePath, options);
 
 		const auto& studioBodyParts = m_StudioModel->GetBodyParts();
 
@@ -1180,9 +3559,11 @@ public:
 		{
 			m_Textures.reserve(studioTextures.size());
 
+			std::vector<uint8_t> uploadBuffer;
+
 			for (const auto& studioTexture : studioTextures)
 			{
-				auto texture = LoadTexture(device, studioTexture);
+				auto texture = LoadTexture(device, studioTexture, uploadBuffer);
 				m_Textures.push_back(std::move(texture));
 			}
 		}
@@ -1227,9 +3608,10 @@ private:
 	};
 
 
+	// Rows of 3x4 transforms, as the shader reads them; only the model's bones are written
 	struct BoneBuffer
 	{
-		XMMATRIX BoneTransforms[128];
+		float BoneTransforms[MAXSTUDIOBONES][3][4];
 	};
 
 
@@ -1272,10 +3654,16 @@ private:
 		//
 
 		auto vertexShaderBytecode = ReadAllBytes("VertexShader.cso");
+		auto compactVertexShaderBytecode = ReadAllBytes("CompactVertexShader.cso");
 		auto pixelShaderBytecode = ReadAllBytes("PixelShader.cso");
 
 		hr = m_D3DDevice->CreateVertexShader(vertexShaderBytecode.data(), vertexShaderBytecode.size(), nullptr, m_VertexShader.ReleaseAndGetAddressOf());
 
+		if (FAILED(hr))
+			return hr;
+
+		hr = m_D3DDevice->CreateVertexShader(compactVertexShaderBytecode.data(), compactVertexShaderBytecode.size(), nullptr, m_CompactVertexShader.ReleaseAndGetAddressOf());
+
 		if (FAILED(hr))
 			return hr;
 
@@ -1298,6 +3686,19 @@ private:
 
 		hr = m_D3DDevice->CreateInputLayout(ied, ARRAYSIZE(ied), vertexShaderBytecode.data(), vertexShaderBytecode.size(), m_InputLayout.ReleaseAndGetAddressOf());
 
+		if (FAILED(hr))
+			return hr;
+
+		// StudioModel::CompactVertex; the bone shares the fourth position component with the reserved byte
+		D3D11_INPUT_ELEMENT_DESC compactIed[] =
+		{
+			{ "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UINT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			{ "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+			{ "TEXCOORD", 0, DXGI_FORMAT_R16G16_UINT, 0, D3D11_APPEND_ALIGNED_ELEMENT, D3D11_INPUT_PER_VERTEX_DATA, 0 },
+		};
+
+		hr = m_D3DDevice->CreateInputLayout(compactIed, ARRAYSIZE(compactIed), compactVertexShaderBytecode.data(), compactVertexShaderBytecode.size(), m_CompactInputLayout.ReleaseAndGetAddressOf());
+
 		if (FAILED(hr))
 			return hr;
 
@@ -1324,16 +3725,18 @@ private:
 		if (FAILED(hr))
 			return hr;
 
-		bd.Usage = D3D11_USAGE_DEFAULT;
+		bd.Usage = D3D11_USAGE_DYNAMIC;
 		bd.ByteWidth = sizeof(BoneBuffer);
 		bd.BindFlags = D3D11_BIND_CONSTANT_BUFFER;
-		bd.CPUAccessFlags = 0;
+		bd.CPUAccessFlags = D3D11_CPU_ACCESS_WRITE;
 
 		hr = m_D3DDevice->CreateBuffer(&bd, nullptr, m_BoneBuffer.ReleaseAndGetAddressOf());
 
 		if (FAILED(hr))
 			return hr;
 
+		m_BoneBufferCurrent = false;
+
 		//
 		// Create sampler state
 		//
@@ -1458,8 +3861,6 @@ private:
 
 	void DrawModel()
 	{
-		m_D3DDeviceContext->IASetPrimitiveTopology(D3D11_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
-
 		const auto& textures = m_D3DStudioModel->GetTextures();
 
 		if (textures.empty())
@@ -1472,11 +3873,21 @@ private:
 				if (!model.VertexBuffer)
 					continue;
 
+				auto compact = model.FormatBuffer.Get() != nullptr;
+
 				ID3D11Buffer* vertexBuffers[] = { model.VertexBuffer.Get() };
-				UINT strides[] = { sizeof(StudioModel::Vertex) };
+				UINT strides[] = { static_cast<UINT>(compact ? sizeof(StudioModel::CompactVertex) : sizeof(StudioModel::Vertex)) };
 				UINT offsets[] = { 0 };
 
+				m_D3DDeviceContext->IASetInputLayout(compact ? m_CompactInputLayout.Get() : m_InputLayout.Get());
 				m_D3DDeviceContext->IASetVertexBuffers(0, ARRAYSIZE(vertexBuffers), vertexBuffers, strides, offsets);
+				m_D3DDeviceContext->VSSetShader(compact ? m_CompactVertexShader.Get() : m_VertexShader.Get(), 0, 0);
+
+				if (compact)
+				{
+					ID3D11Buffer* formatBuffers[] = { model.FormatBuffer.Get() };
+					m_D3DDeviceContext->VSSetConstantBuffers(2, ARRAYSIZE(formatBuffers), formatBuffers);
+				}
 
 				for (const auto& mesh : model.Meshes)
 				{
@@ -1497,6 +3908,7 @@ private:
 
 					ID3D11ShaderResourceView* shaderResourceViews[] = { texture.View.Get() };
 
+					m_D3DDeviceContext->IASetPrimitiveTopology(mesh.Topology);
 					m_D3DDeviceContext->IASetIndexBuffer(mesh.IndexBuffer.Get(), DXGI_FORMAT_R32_UINT, 0);
 
 					m_D3DDeviceContext->PSSetShaderResources(0, ARRAYSIZE(shaderResourceViews), shaderResourceViews);
@@ -1526,23 +3938,21 @@ public:
 
 		if (!m_InputLayout)
 			return;
+		if (!m_CompactInputLayout)
+			return;
 		if (!m_MatrixBuffer)
 			return;
 		if (!m_BoneBuffer)
 			return;
 		if (!m_VertexShader)
 			return;
+		if (!m_CompactVertexShader)
+			return;
 		if (!m_PixelShader)
 			return;
 		if (!m_SamplerState)
 			return;
 
-		//
-		// Activate input layout
-		//
-
-		m_D3DDeviceContext->IASetInputLayout(m_InputLayout.Get());
-
 		//
 		// Update MVP matrix
 		//
@@ -1560,51 +3970,32 @@ public:
 		// Update bone matrix
 		//
 
-		m_Animating.SetStudioHeader(m_D3DStudioModel->GetStudioModel()->GetStudioHeader());
-		m_Animating.SetStudioSequenceGroupHeaders(m_D3DStudioModel->GetStudioModel()->GetSequenceGroupHeaders());
+		m_Animating.SetStudioModel(m_D3DStudioModel->GetStudioModel());
 		m_Animating.SetUpBones();
-		auto boneTransforms = m_Animating.GetBoneTransforms();
 
 		auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - m_LastUpdateTime).count();
 		auto sec = ms / 1000.0;
 		m_LastUpdateTime = std::chrono::steady_clock::now();
 		m_Animating.AdvanceFrame(sec);
 
-		BoneBuffer boneBuffer{};
-
-		for (int i = 0; i < 128; i++)
-		{
-			XMMATRIX matrix
-			{
-				boneTransforms[i][0][0],
-				boneTransforms[i][1][0],
-				boneTransforms[i][2][0],
-				0.0f,
-				boneTransforms[i][0][1],
-				boneTransforms[i][1][1],
-				boneTransforms[i][2][1],
-				0.0f,
-				boneTransforms[i][0][2],
-				boneTransforms[i][1][2],
-				boneTransforms[i][2][2],
-				0.0f,
-				boneTransforms[i][0][3],
-				boneTransforms[i][1][3],
-				boneTransforms[i][2][3],
-				1.0f,
-			};
+		// A discarded buffer starts out undefined, so every bone is written whenever any changed
+		if (m_Animating.GetChangedBones().Count > 0 || !m_BoneBufferCurrent)
+		{
+			D3D11_MAPPED_SUBRESOURCE mapped;
 
-			boneBuffer.BoneTransforms[i] = XMMatrixTranspose(matrix);
-		}
+			if (SUCCEEDED(m_D3DDeviceContext->Map(m_BoneBuffer.Get(), 0, D3D11_MAP_WRITE_DISCARD, 0, &mapped)))
+			{
+				m_Animating.WriteBonePalette(StudioModelAnimating::BoneRange{ 0, m_Animating.GetBoneCount() }, StudioModelAnimating::BonePaletteLayout::Matrix3x4, mapped.pData);
+				m_D3DDeviceContext->Unmap(m_BoneBuffer.Get(), 0);
 
-		m_D3DDeviceContext->UpdateSubresource(m_BoneBuffer.Get(), 0, nullptr, &boneBuffer, 0, 0);
+				m_BoneBufferCurrent = true;
+			}
+		}
 
 		//
 		// Set pixel shader
 		//
 
-		m_D3DDeviceContext->VSSetShader(m_VertexShader.Get(), 0, 0);
-
 		ID3D11Buffer* constantBuffers[] =
 		{
 			m_MatrixBuffer.Get(),
@@ -1669,7 +4060,8 @@ public:
 
 
 	D3DStudioModelRenderer()
-		: m_World{}
+		: m_BoneBufferCurrent{}
+		, m_World{}
 		, m_View{}
 		, m_Projection{}
 		, m_ViewportWidth{}
@@ -1685,11 +4077,14 @@ private:
 	ComPtr<ID3D11Device> m_D3DDevice;
 	ComPtr<ID3D11DeviceContext> m_D3DDeviceContext;
 	ComPtr<ID3D11VertexShader> m_VertexShader;
+	ComPtr<ID3D11VertexShader> m_CompactVertexShader; // for models with compact vertices
 	ComPtr<ID3D11PixelShader> m_PixelShader;
 	ComPtr<ID3D11InputLayout> m_InputLayout;
+	ComPtr<ID3D11InputLayout> m_CompactInputLayout;
 	ComPtr<ID3D11Buffer> m_MatrixBuffer;
 	ComPtr<ID3D11Buffer> m_BoneBuffer;
 	ComPtr<ID3D11SamplerState> m_SamplerState;
+	bool m_BoneBufferCurrent; // holds the bones of m_Animating
 
 	XMMATRIX m_World;
 	XMMATRIX m_View;
@@ -1703,3 +4098,5 @@ private:
 	StudioModelAnimating m_Animating;
 	std::chrono::steady_clock::time_point m_LastUpdateTime;
 };
+
+#endif
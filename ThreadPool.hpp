@@ -0,0 +1,290 @@
+#pragma once
+
+#include <cstddef>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <future>
+#include <memory>
+#include <exception>
+#include <algorithm>
+#include <type_traits>
+
+
+// Fixed set of worker threads, each with its own task deque. A worker runs the
+// newest task of its own deque first and, when that is empty, steals the oldest
+// task of another worker, so tasks submitted from inside a task stay on the
+// submitting thread while idle workers take over whatever is left.
+class ThreadPool
+{
+private:
+
+	struct Worker
+	{
+		std::mutex Mutex;
+		std::deque<std::function<void()>> Tasks;
+	};
+
+
+	// The worker the calling thread belongs to, or -1 if it is not one of ours
+	int GetCurrentWorker() const
+	{
+		return t_Pool == this ? t_Worker : -1;
+	}
+
+
+	bool PopTask(size_t worker, std::function<void()>& task)
+	{
+		auto& own = *m_Workers[worker];
+
+		{
+			std::lock_guard<std::mutex> lock(own.Mutex);
+
+			if (!own.Tasks.empty())
+			{
+				task = std::move(own.Tasks.back());
+				own.Tasks.pop_back();
+				m_Pending.fetch_sub(1);
+				return true;
+			}
+		}
+
+		for (size_t i = 1; i < m_Workers.size(); i++)
+		{
+			auto& victim = *m_Workers[(worker + i) % m_Workers.size()];
+
+			std::lock_guard<std::mutex> lock(victim.Mutex);
+
+			if (!victim.Tasks.empty())
+			{
+				task = std::move(victim.Tasks.front());
+				victim.Tasks.pop_front();
+				m_Pending.fetch_sub(1);
+				m_Steals.fetch_add(1, std::memory_order_relaxed);
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+
+	void WorkerMain(size_t worker)
+	{
+		t_Pool = this;
+		t_Worker = static_cast<int>(worker);
+
+		while (true)
+		{
+			std::function<void()> task;
+
+			if (PopTask(worker, task))
+			{
+				task();
+				continue;
+			}
+
+			std::unique_lock<std::mutex> lock(m_Mutex);
+
+			m_TaskAvailable.wait(lock, [this]() { return m_Stopping || m_Pending.load() > 0; });
+
+			if (m_Stopping && m_Pending.load() == 0)
+				return;
+		}
+	}
+
+
+public:
+
+	void Submit(std::function<void()> task)
+	{
+		// Without workers the caller does the work, so waiting on a result cannot hang
+		if (m_Workers.empty())
+		{
+			task();
+			return;
+		}
+
+		// Tasks from a worker stay with it, the rest are dealt out in turn
+		int current = GetCurrentWorker();
+		size_t worker = current >= 0 ? static_cast<size_t>(current) : m_NextWorker.fetch_add(1, std::memory_order_relaxed) % m_Workers.size();
+
+		// Counted first, under m_Mutex, so the count never drops below the queued
+		// tasks and a worker about to sleep cannot miss it
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Pending.fetch_add(1);
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(m_Workers[worker]->Mutex);
+			m_Workers[worker]->Tasks.push_back(std::move(task));
+		}
+
+		m_TaskAvailable.notify_one();
+	}
+
+
+	template<typename Function>
+	auto Async(Function&& function) -> std::future<std::invoke_result_t<Function>>
+	{
+		using Result = std::invoke_result_t<Function>;
+
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Function>(function));
+		auto future = task->get_future();
+
+		Submit([task]() { (*task)(); });
+
+		return future;
+	}
+
+
+	// Runs body(0) .. body(count - 1) and returns when all of them have finished.
+	// The calling thread takes items too, so this may be used from inside a task
+	// without starving the pool. The first exception thrown by body is rethrown.
+	template<typename Body>
+	void ParallelFor(size_t count, Body&& body)
+	{
+		if (count == 0)
+			return;
+
+		if (count == 1 || m_Workers.empty())
+		{
+			for (size_t i = 0; i < count; i++)
+				body(i);
+
+			return;
+		}
+
+		struct State
+		{
+			std::atomic<size_t> Next{};
+			std::atomic<size_t> Done{};
+			std::mutex Mutex;
+			std::condition_variable Finished;
+			std::exception_ptr Error;
+		};
+
+		auto state = std::make_shared<State>();
+
+		// Helpers that start after every item was claimed return without touching body
+		auto run = [state, count, &body]()
+		{
+			while (true)
+			{
+				size_t i = state->Next.fetch_add(1);
+
+				if (i >= count)
+					return;
+
+				try
+				{
+					body(i);
+				}
+				catch (...)
+				{
+					std::lock_guard<std::mutex> lock(state->Mutex);
+
+					if (!state->Error)
+						state->Error = std::current_exception();
+				}
+
+				if (state->Done.fetch_add(1) + 1 == count)
+				{
+					std::lock_guard<std::mutex> lock(state->Mutex);
+					state->Finished.notify_all();
+				}
+			}
+		};
+
+		size_t helpers = (std::min)(m_Threads.size(), count - 1);
+
+		for (size_t i = 0; i < helpers; i++)
+			Submit(run);
+
+		run();
+
+		std::unique_lock<std::mutex> lock(state->Mutex);
+
+		state->Finished.wait(lock, [&state, count]() { return state->Done.load() == count; });
+
+		if (state->Error)
+			std::rethrow_exception(state->Error);
+	}
+
+
+	size_t GetThreadCount() const
+	{
+		return m_Threads.size();
+	}
+
+
+	// Tasks a worker took from another worker's deque since the pool was created
+	size_t GetStealCount() const
+	{
+		return m_Steals.load(std::memory_order_relaxed);
+	}
+
+
+	// Shared pool sized so that the workers plus one calling thread fill the CPU
+	static ThreadPool& GetDefault()
+	{
+		static ThreadPool pool((std::max)(1u, std::thread::hardware_concurrency()) - 1);
+		return pool;
+	}
+
+
+	explicit ThreadPool(unsigned threadCount)
+		: m_Pending{}
+		, m_NextWorker{}
+		, m_Steals{}
+		, m_Stopping{}
+	{
+		m_Workers.reserve(threadCount);
+
+		for (unsigned i = 0; i < threadCount; i++)
+			m_Workers.push_back(std::make_unique<Worker>());
+
+		m_Threads.reserve(threadCount);
+
+		for (unsigned i = 0; i < threadCount; i++)
+			m_Threads.emplace_back(&ThreadPool::WorkerMain, this, static_cast<size_t>(i));
+	}
+
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+
+	~ThreadPool()
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stopping = true;
+		}
+
+		m_TaskAvailable.notify_all();
+
+		for (auto& thread : m_Threads)
+			thread.join();
+	}
+
+
+private:
+
+	std::vector<std::unique_ptr<Worker>> m_Workers;
+	std::vector<std::thread> m_Threads;
+	std::atomic<size_t> m_Pending; // queued in any deque, not yet taken
+	std::atomic<size_t> m_NextWorker;
+	std::atomic<size_t> m_Steals;
+	std::mutex m_Mutex;
+	std::condition_variable m_TaskAvailable;
+	bool m_Stopping;
+
+	static inline thread_local const ThreadPool* t_Pool = nullptr;
+	static inline thread_local int t_Worker = -1;
+};